@@ -0,0 +1,253 @@
+//
+// AgentStateAnalytics.cpp: Time-in-state accounting and turn latency histograms
+//
+
+#include "../general/pch.h"
+#include "AgentStateAnalytics.h"
+#include "../tools/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <sstream>
+
+namespace {
+
+int64_t NowMs() {
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+int StateIndex(AgentState state) {
+    int index = static_cast<int>(state);
+    return (index >= 0 && index < AgentStateStats::STATE_COUNT) ? index : static_cast<int>(AgentState::Unknown);
+}
+
+const char* StateName(int index) {
+    static const char* const names[AgentStateStats::STATE_COUNT] = {
+        "idle", "silent", "listening", "thinking", "speaking", "unknown"
+    };
+    return names[index];
+}
+
+}  // namespace
+
+// =============================================================================
+// SlidingHistogram
+// =============================================================================
+
+const int64_t SlidingHistogram::BUCKET_BOUNDS_MS[SlidingHistogram::BUCKET_COUNT] = {
+    100, 200, 300, 500, 750, 1000, 1500, 2000, 3000, 5000, 8000, INT64_MAX
+};
+
+SlidingHistogram::SlidingHistogram() {
+    Clear();
+}
+
+size_t SlidingHistogram::BucketOf(int64_t valueMs) {
+    // Bucket i holds values up to BUCKET_BOUNDS_MS[i]
+    return std::lower_bound(BUCKET_BOUNDS_MS, BUCKET_BOUNDS_MS + BUCKET_COUNT - 1, valueMs) - BUCKET_BOUNDS_MS;
+}
+
+void SlidingHistogram::Add(int64_t valueMs) {
+    if (valueMs < 0) valueMs = 0;
+
+    // Evict the sample this slot held before counting the new one
+    if (m_count == WINDOW) {
+        int64_t evicted = m_samples[m_next];
+        --m_buckets[BucketOf(evicted)];
+        m_sumMs -= evicted;
+    } else {
+        ++m_count;
+    }
+    m_samples[m_next] = valueMs;
+    ++m_buckets[BucketOf(valueMs)];
+    m_sumMs += valueMs;
+    m_next = (m_next + 1) % WINDOW;
+    ++m_total;
+}
+
+SlidingHistogram::Summary SlidingHistogram::Summarize() const {
+    Summary summary = {};
+    summary.count = m_count;
+    summary.total = m_total;
+    summary.buckets = m_buckets;
+    if (m_count == 0) {
+        return summary;
+    }
+
+    std::array<int64_t, WINDOW> sorted;
+    std::copy(m_samples.begin(), m_samples.begin() + m_count, sorted.begin());
+    std::sort(sorted.begin(), sorted.begin() + m_count);
+
+    auto percentile = [&](size_t p) { return sorted[(m_count - 1) * p / 100]; };
+    summary.meanMs = m_sumMs / static_cast<int64_t>(m_count);
+    summary.p50Ms = percentile(50);
+    summary.p90Ms = percentile(90);
+    summary.p99Ms = percentile(99);
+    summary.maxMs = sorted[m_count - 1];
+    return summary;
+}
+
+void SlidingHistogram::Clear() {
+    m_samples.fill(0);
+    m_buckets.fill(0);
+    m_next = 0;
+    m_count = 0;
+    m_total = 0;
+    m_sumMs = 0;
+}
+
+// =============================================================================
+// AgentStateAnalytics
+// =============================================================================
+
+AgentStateAnalytics::AgentStateAnalytics()
+    : m_slowThinkingMs(DEFAULT_SLOW_THINKING_MS)
+    , m_stopRequested(false) {
+    Reset();
+}
+
+AgentStateAnalytics::~AgentStateAnalytics() {
+    Stop();
+}
+
+void AgentStateAnalytics::Start() {
+    if (m_summaryThread.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = false;
+    }
+    m_summaryThread = std::thread(&AgentStateAnalytics::SummaryLoop, this);
+}
+
+void AgentStateAnalytics::Stop() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = true;
+    }
+    m_summaryCv.notify_one();
+    if (m_summaryThread.joinable()) {
+        m_summaryThread.join();
+    }
+}
+
+void AgentStateAnalytics::SummaryLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_summaryCv.wait_for(lock, std::chrono::milliseconds(SUMMARY_INTERVAL_MS),
+                                 [this] { return m_stopRequested; })) {
+        if (m_stateSinceMs == 0) {
+            continue;  // Nothing recorded yet
+        }
+        std::string summary = FormatSummary(SnapshotLocked(NowMs()));
+        lock.unlock();
+        LOG_INFO("[AgentStateAnalytics] " + summary);
+        lock.lock();
+    }
+}
+
+void AgentStateAnalytics::OnAgentStateChanged(const std::string&, const StateChangeEvent& event) {
+    Record(event);
+}
+
+void AgentStateAnalytics::Record(const StateChangeEvent& event) {
+    int64_t now = NowMs();
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    int to = StateIndex(event.state);
+    int from = StateIndex(m_state);
+    if (m_stateSinceMs != 0 && to == from) {
+        return;  // Repeated state, not a transition
+    }
+
+    if (m_stateSinceMs != 0) {
+        int64_t elapsed = (std::max)(int64_t(0), now - m_stateSinceMs);
+        m_timeInStateMs[from] += elapsed;
+        ++m_transitions[from][to];
+
+        if (m_state == AgentState::Listening && event.state == AgentState::Thinking) {
+            m_listeningToThinking.Add(elapsed);
+        } else if (m_state == AgentState::Thinking && event.state == AgentState::Speaking) {
+            m_thinkingToSpeaking.Add(elapsed);
+            ++m_turns;
+            if (elapsed > m_slowThinkingMs) {
+                ++m_slowThinkingTurns;
+                LOG_INFO("[AgentStateAnalytics] Slow turn " + std::to_string(event.turnId) +
+                         ": thinking took " + std::to_string(elapsed) + " ms");
+            }
+        }
+    }
+
+    m_state = event.state;
+    m_stateSinceMs = now;
+}
+
+AgentStateStats AgentStateAnalytics::Snapshot() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return SnapshotLocked(NowMs());
+}
+
+AgentStateStats AgentStateAnalytics::SnapshotLocked(int64_t nowMs) const {
+    AgentStateStats stats;
+    memcpy(stats.timeInStateMs, m_timeInStateMs, sizeof(m_timeInStateMs));
+    memcpy(stats.transitions, m_transitions, sizeof(m_transitions));
+    stats.currentState = m_state;
+    stats.turns = m_turns;
+    stats.slowThinkingTurns = m_slowThinkingTurns;
+    stats.thinkingToSpeaking = m_thinkingToSpeaking.Summarize();
+    stats.listeningToThinking = m_listeningToThinking.Summarize();
+
+    // Count the state we are in right now up to the snapshot time
+    if (m_stateSinceMs != 0 && nowMs > m_stateSinceMs) {
+        stats.timeInStateMs[StateIndex(m_state)] += nowMs - m_stateSinceMs;
+    }
+    return stats;
+}
+
+void AgentStateAnalytics::SetSlowThinkingThreshold(int64_t ms) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_slowThinkingMs = ms;
+}
+
+void AgentStateAnalytics::LogSummary() const {
+    AgentStateStats stats = Snapshot();
+    LOG_INFO("[AgentStateAnalytics] " + FormatSummary(stats));
+}
+
+void AgentStateAnalytics::Reset() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    memset(m_timeInStateMs, 0, sizeof(m_timeInStateMs));
+    memset(m_transitions, 0, sizeof(m_transitions));
+    m_state = AgentState::Unknown;
+    m_stateSinceMs = 0;
+    m_turns = 0;
+    m_slowThinkingTurns = 0;
+    m_thinkingToSpeaking.Clear();
+    m_listeningToThinking.Clear();
+}
+
+std::string AgentStateAnalytics::FormatSummary(const AgentStateStats& stats) {
+    int64_t totalMs = 0;
+    for (int i = 0; i < AgentStateStats::STATE_COUNT; ++i) {
+        totalMs += stats.timeInStateMs[i];
+    }
+
+    std::ostringstream oss;
+    oss << "turns=" << stats.turns << " slow=" << stats.slowThinkingTurns << " time:";
+    for (int i = 0; i < AgentStateStats::STATE_COUNT; ++i) {
+        if (stats.timeInStateMs[i] == 0) continue;
+        oss << " " << StateName(i) << "=" << stats.timeInStateMs[i] / 1000 << "s";
+        if (totalMs > 0) {
+            oss << "(" << stats.timeInStateMs[i] * 100 / totalMs << "%)";
+        }
+    }
+
+    const SlidingHistogram::Summary& think = stats.thinkingToSpeaking;
+    const SlidingHistogram::Summary& listen = stats.listeningToThinking;
+    oss << " thinking->speaking ms: p50=" << think.p50Ms << " p90=" << think.p90Ms
+        << " p99=" << think.p99Ms << " max=" << think.maxMs
+        << " listening->thinking ms: p50=" << listen.p50Ms << " p90=" << listen.p90Ms;
+    return oss.str();
+}
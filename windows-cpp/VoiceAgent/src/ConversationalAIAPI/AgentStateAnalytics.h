@@ -0,0 +1,119 @@
+//
+// AgentStateAnalytics.h: Time-in-state accounting and turn latency histograms
+//
+#pragma once
+
+#include "ConversationalAIAPI.h"
+
+#include <array>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <cstdint>
+#include <cstddef>
+
+/// Latency histogram over the most recent samples only
+/// A ring of the last WINDOW samples plus bucket counts kept in step with it,
+/// so memory is fixed and older samples age out
+class SlidingHistogram {
+public:
+    static const size_t WINDOW = 256;
+    static const size_t BUCKET_COUNT = 12;
+    static const int64_t BUCKET_BOUNDS_MS[BUCKET_COUNT];  // Upper bounds; the last one is open-ended
+
+    struct Summary {
+        size_t count;       // Samples in the window
+        uint64_t total;     // Samples ever recorded
+        int64_t meanMs;
+        int64_t p50Ms;
+        int64_t p90Ms;
+        int64_t p99Ms;
+        int64_t maxMs;
+        std::array<uint32_t, BUCKET_COUNT> buckets;
+    };
+
+    SlidingHistogram();
+
+    void Add(int64_t valueMs);
+    Summary Summarize() const;
+    void Clear();
+
+private:
+    static size_t BucketOf(int64_t valueMs);
+
+    std::array<int64_t, WINDOW> m_samples;
+    std::array<uint32_t, BUCKET_COUNT> m_buckets;
+    size_t m_next;
+    size_t m_count;
+    uint64_t m_total;
+    int64_t m_sumMs;
+};
+
+/// Point-in-time view of AgentStateAnalytics
+struct AgentStateStats {
+    static const int STATE_COUNT = static_cast<int>(AgentState::Unknown) + 1;
+
+    int64_t timeInStateMs[STATE_COUNT];              // Includes the time spent so far in the current state
+    uint64_t transitions[STATE_COUNT][STATE_COUNT];  // [from][to]
+    AgentState currentState;
+    uint64_t turns;                                  // Thinking -> speaking transitions
+    uint64_t slowThinkingTurns;                      // Turns that thought longer than the threshold
+    SlidingHistogram::Summary thinkingToSpeaking;    // Time thinking before the agent starts speaking
+    SlidingHistogram::Summary listeningToThinking;   // Time listening before the agent starts thinking
+};
+
+/// Event handler that turns the agent state stream into conversational rhythm metrics
+///
+/// Time in state is measured on the local clock, from the time each event is received, so it
+/// is comparable with the time spent in the current state (event timestamps come from the
+/// server clock). Between Start() and Stop() a background thread logs a one-line summary every
+/// SUMMARY_INTERVAL_MS, whether or not events arrive; LogSummary() logs one on demand.
+class AgentStateAnalytics : public IConversationalAIAPIEventHandler {
+public:
+    static const int64_t SUMMARY_INTERVAL_MS = 60 * 1000;
+    static const int64_t DEFAULT_SLOW_THINKING_MS = 3000;
+
+    AgentStateAnalytics();
+    ~AgentStateAnalytics();
+
+    AgentStateAnalytics(const AgentStateAnalytics&) = delete;
+    AgentStateAnalytics& operator=(const AgentStateAnalytics&) = delete;
+
+    /// Start logging the periodic summary (no-op if already started)
+    void Start();
+    /// Stop the periodic summary and wait for its thread
+    void Stop();
+
+    /// Feed one state change (also usable without ConversationalAIAPI)
+    void Record(const StateChangeEvent& event);
+
+    AgentStateStats Snapshot() const;
+
+    void SetSlowThinkingThreshold(int64_t ms);
+    void LogSummary() const;
+    void Reset();
+
+    // IConversationalAIAPIEventHandler
+    void OnAgentStateChanged(const std::string& agentUserId, const StateChangeEvent& event) override;
+    void OnTranscriptUpdated(const std::string&, const Transcript&) override {}
+
+private:
+    void SummaryLoop();
+    AgentStateStats SnapshotLocked(int64_t nowMs) const;
+    static std::string FormatSummary(const AgentStateStats& stats);
+
+    mutable std::mutex m_mutex;
+    int64_t m_timeInStateMs[AgentStateStats::STATE_COUNT];
+    uint64_t m_transitions[AgentStateStats::STATE_COUNT][AgentStateStats::STATE_COUNT];
+    AgentState m_state;
+    int64_t m_stateSinceMs;     // Local time the current state was entered, 0 before the first event
+    uint64_t m_turns;
+    uint64_t m_slowThinkingTurns;
+    int64_t m_slowThinkingMs;
+    SlidingHistogram m_thinkingToSpeaking;
+    SlidingHistogram m_listeningToThinking;
+    std::condition_variable m_summaryCv;
+    bool m_stopRequested;
+    std::thread m_summaryThread;
+};
@@ -5,14 +5,27 @@
 #include "../general/pch.h"
 #include "ConversationalAIAPI.h"
 #include "../tools/Logger.h"
+#include "../tools/Base64.h"
 
+#include <IAgoraRtmClient.h>
 #include <nlohmann/json.hpp>
-#include <sstream>
 #include <algorithm>
+#include <charconv>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
 
 using json = nlohmann::json;
 
+namespace {
+
+int64_t NowMs() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+}  // namespace
+
 // ============================================================================
 // MessageParser Implementation
 // ============================================================================
@@ -71,28 +84,31 @@ void MessageParser::CleanExpiredMessages() {
     }
 }
 
-std::string MessageParser::ParseStreamMessage(const std::string& message) {
+std::string MessageParser::ParseStreamMessage(std::string_view message) {
     try {
         // Clean up expired messages
         CleanExpiredMessages();
         
-        // Split message by '|'
-        std::vector<std::string> parts;
-        std::stringstream ss(message);
-        std::string part;
-        while (std::getline(ss, part, '|')) {
-            parts.push_back(part);
-        }
-        
-        if (parts.size() != 4) {
+        // Split message by '|' without copying the fields
+        size_t sep1 = message.find('|');
+        size_t sep2 = (sep1 == std::string_view::npos) ? sep1 : message.find('|', sep1 + 1);
+        size_t sep3 = (sep2 == std::string_view::npos) ? sep2 : message.find('|', sep2 + 1);
+        if (sep3 == std::string_view::npos || message.find('|', sep3 + 1) != std::string_view::npos) {
             LOG_ERROR("[MessageParser] Invalid message format, expected 4 parts");
             return "";
         }
         
-        std::string messageId = parts[0];
-        int partIndex = std::stoi(parts[1]);
-        int totalParts = std::stoi(parts[2]);
-        std::string base64Content = parts[3];
+        std::string messageId(message.substr(0, sep1));
+        std::string_view partField = message.substr(sep1 + 1, sep2 - sep1 - 1);
+        std::string_view totalField = message.substr(sep2 + 1, sep3 - sep2 - 1);
+        int partIndex = 0;
+        int totalParts = 0;
+        if (std::from_chars(partField.data(), partField.data() + partField.size(), partIndex).ec != std::errc() ||
+            std::from_chars(totalField.data(), totalField.data() + totalField.size(), totalParts).ec != std::errc()) {
+            LOG_ERROR("[MessageParser] Invalid part numbers");
+            return "";
+        }
+        std::string base64Content(message.substr(sep3 + 1));
         
         // Validate partIndex and totalParts
         if (partIndex < 1 || partIndex > totalParts) {
@@ -104,7 +120,7 @@ std::string MessageParser::ParseStreamMessage(const std::string& message) {
         m_lastAccessMap[messageId] = GetCurrentTimeMs();
         
         // Store message part
-        m_messageMap[messageId][partIndex] = base64Content;
+        m_messageMap[messageId][partIndex] = std::move(base64Content);
         
         // Check if all parts are received
         if (static_cast<int>(m_messageMap[messageId].size()) == totalParts) {
@@ -142,35 +158,59 @@ std::string MessageParser::ParseStreamMessage(const std::string& message) {
 // ConversationalAIAPI Implementation
 // ============================================================================
 
-ConversationalAIAPI::ConversationalAIAPI() 
+ConversationalAIAPI::ConversationalAIAPI(agora::rtm::IRtmClient* rtmClient)
     : m_hasInterruptEvent(false)
-    , m_hasStateChangeEvent(false) {
+    , m_hasStateChangeEvent(false)
+    , m_inBatch(false)
+    , m_hasBatchState(false)
+    , m_rtmClient(rtmClient)
+    , m_lastInterruptRttMs(-1)
+    , m_outbound([this](OutboundScheduler::Message& message, OutboundScheduler::Completion completion) {
+          Publish(message.channel, message.payload, message.customType, std::move(completion));
+          ReleaseBuffer(std::move(message.payload));
+      }) {
     LOG_INFO("[ConversationalAIAPI] Initialized");
 }
 
 ConversationalAIAPI::~ConversationalAIAPI() {
+    m_outbound.Shutdown();
     m_handlers.clear();
     m_transcriptCache.clear();
     LOG_INFO("[ConversationalAIAPI] Destroyed");
 }
 
+void ConversationalAIAPI::SetRtmClient(agora::rtm::IRtmClient* rtmClient) {
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    m_rtmClient = rtmClient;
+}
+
 void ConversationalAIAPI::AddHandler(IConversationalAIAPIEventHandler* handler) {
+    std::lock_guard<std::mutex> lock(m_inboundMutex);
     if (handler && std::find(m_handlers.begin(), m_handlers.end(), handler) == m_handlers.end()) {
         m_handlers.push_back(handler);
     }
 }
 
 void ConversationalAIAPI::RemoveHandler(IConversationalAIAPIEventHandler* handler) {
+    std::unique_lock<std::mutex> lock(m_inboundMutex);
     auto it = std::find(m_handlers.begin(), m_handlers.end(), handler);
     if (it != m_handlers.end()) {
         m_handlers.erase(it);
     }
+    // A dispatch may still hold the handler in its copy of the list; let it finish
+    // (unless it is this thread's, i.e. a handler removing itself)
+    m_dispatchDone.wait(lock, [this] { return !m_dispatching || m_dispatchThread == std::this_thread::get_id(); });
 }
 
 void ConversationalAIAPI::ClearCache() {
+    std::lock_guard<std::mutex> lock(m_inboundMutex);
     m_transcriptCache.clear();
+    m_currentAgentTurn.clear();
     m_hasInterruptEvent = false;
     m_hasStateChangeEvent = false;
+    m_batchUpdates.clear();
+    m_batchKeys.clear();
+    m_hasBatchState = false;
     LOG_INFO("[ConversationalAIAPI] Cache cleared");
 }
 
@@ -179,20 +219,65 @@ std::string ConversationalAIAPI::GenerateCacheKey(int turnId, TranscriptType typ
     return std::to_string(turnId) + "_" + std::to_string(static_cast<int>(type));
 }
 
-void ConversationalAIAPI::HandleSplitMessage(const std::string& message, const std::string& fromUserId) {
+void ConversationalAIAPI::HandleSplitMessage(std::string_view message, std::string_view fromUserId) {
+    std::unique_lock<std::mutex> lock(m_inboundMutex);
     std::string jsonString = m_messageParser.ParseStreamMessage(message);
     if (!jsonString.empty()) {
         ParseAndDispatchMessage(jsonString, fromUserId);
     }
+    DispatchNotifications(lock);
 }
 
-void ConversationalAIAPI::HandleMessage(const std::string& jsonString, const std::string& fromUserId) {
+void ConversationalAIAPI::HandleMessage(std::string_view jsonString, std::string_view fromUserId) {
+    std::unique_lock<std::mutex> lock(m_inboundMutex);
     ParseAndDispatchMessage(jsonString, fromUserId);
+    DispatchNotifications(lock);
+}
+
+void ConversationalAIAPI::HandleMessage(const char* data, size_t length, const char* fromUserId) {
+    if (!data || length == 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lock(m_inboundMutex);
+    ParseAndDispatchMessage(std::string_view(data, length), fromUserId ? std::string_view(fromUserId) : std::string_view());
+    DispatchNotifications(lock);
+}
+
+const std::string& ConversationalAIAPI::PublisherId(std::string_view publisher) {
+    if (m_publisher != publisher) {
+        m_publisher.assign(publisher.data(), publisher.size());
+    }
+    return m_publisher;
 }
 
-void ConversationalAIAPI::ParseAndDispatchMessage(const std::string& jsonString, const std::string& userId) {
+void ConversationalAIAPI::HandleMessages(const RawMessage* messages, size_t count) {
+    if (!messages || count == 0) {
+        return;
+    }
+    
+    // Apply every message to the cache first, then notify once
+    std::unique_lock<std::mutex> lock(m_inboundMutex);
+    m_inBatch = true;
+    for (size_t i = 0; i < count; ++i) {
+        ParseAndDispatchMessage(messages[i].message, messages[i].publisher);
+    }
+    m_inBatch = false;
+    
+    LOG_INFO("[ConversationalAIAPI] Batch applied: messages=" + std::to_string(count) +
+             ", turns=" + std::to_string(m_batchUpdates.size()));
+    FlushBatch();
+    DispatchNotifications(lock);
+}
+
+void ConversationalAIAPI::HandleMessages(const std::vector<RawMessage>& messages) {
+    HandleMessages(messages.data(), messages.size());
+}
+
+void ConversationalAIAPI::ParseAndDispatchMessage(std::string_view jsonString, std::string_view publisher) {
     try {
-        json jsonValue = json::parse(jsonString);
+        // Parse straight from the caller's buffer
+        json jsonValue = json::parse(jsonString.data(), jsonString.data() + jsonString.size());
+        const std::string& userId = PublisherId(publisher);
         
         if (!jsonValue.is_object() || !jsonValue.contains("object")) {
             return;
@@ -216,15 +301,31 @@ void ConversationalAIAPI::ParseAndDispatchMessage(const std::string& jsonString,
 
         LOG_INFO("[ConversationalAIAPI] Received message type: " + messageType);
 
+        // Word timings are the only nested field we keep
+        std::vector<TranscriptWord> words;
+        auto wordsIt = jsonValue.find("words");
+        if (wordsIt != jsonValue.end() && wordsIt->is_array()) {
+            words.reserve(wordsIt->size());
+            for (const auto& w : *wordsIt) {
+                if (!w.is_object()) continue;
+                words.emplace_back(w.value("word", std::string()), w.value("start_ms", int64_t(0)),
+                                   w.value("duration_ms", int64_t(0)), w.value("stable", false));
+            }
+        }
+
         // Dispatch based on message type
         if (messageType == "assistant.transcription") {
-            HandleAssistantMessage(userId, messageData);
+            HandleAssistantMessage(userId, messageData, words);
         } else if (messageType == "user.transcription") {
-            HandleUserMessage(userId, messageData);
+            HandleUserMessage(userId, messageData, words);
         } else if (messageType == "message.interrupt") {
             HandleInterruptMessage(userId, messageData);
         } else if (messageType == "message.state") {
             HandleStateMessage(userId, messageData);
+        } else if (messageType == "message.info") {
+            HandleReceiptMessage(userId, messageData, false);
+        } else if (messageType == "message.error") {
+            HandleReceiptMessage(userId, messageData, true);
         } else {
             LOG_INFO("[ConversationalAIAPI] Unknown message type: " + messageType);
         }
@@ -234,7 +335,24 @@ void ConversationalAIAPI::ParseAndDispatchMessage(const std::string& jsonString,
     }
 }
 
-void ConversationalAIAPI::HandleAssistantMessage(const std::string& userId, const std::map<std::string, std::string>& messageData) {
+void ConversationalAIAPI::ApplyTiming(Transcript& transcript, const std::map<std::string, std::string>& messageData,
+                                      std::vector<TranscriptWord>& words) {
+    auto startIt = messageData.find("start_ms");
+    auto durationIt = messageData.find("duration_ms");
+    if (startIt != messageData.end()) {
+        transcript.startMs = std::stoll(startIt->second);
+    }
+    if (durationIt != messageData.end()) {
+        transcript.durationMs = std::stoll(durationIt->second);
+    }
+    // Each update carries the full word list of the turn so far
+    if (!words.empty()) {
+        transcript.words.swap(words);
+    }
+}
+
+void ConversationalAIAPI::HandleAssistantMessage(const std::string& userId, const std::map<std::string, std::string>& messageData,
+                                                 std::vector<TranscriptWord>& words) {
     try {
         auto textIt = messageData.find("text");
         auto turnIdIt = messageData.find("turn_id");
@@ -291,17 +409,30 @@ void ConversationalAIAPI::HandleAssistantMessage(const std::string& userId, cons
             it->second.status = status;
         } else {
             Transcript transcript(turnId, agentUserId, text, status, TranscriptType::Agent);
-            m_transcriptCache[cacheKey] = transcript;
+            it = m_transcriptCache.emplace(cacheKey, std::move(transcript)).first;
         }
+        ApplyTiming(it->second, messageData, words);
         
-        NotifyTranscriptUpdated(userId, m_transcriptCache[cacheKey]);
+        auto current = m_currentAgentTurn.find(userId);
+        if (status == TranscriptStatus::InProgress) {
+            if (current == m_currentAgentTurn.end()) {
+                m_currentAgentTurn.emplace(userId, turnId);
+            } else if (turnId > current->second) {
+                current->second = turnId;
+            }
+        } else if (current != m_currentAgentTurn.end() && current->second == turnId) {
+            m_currentAgentTurn.erase(current);
+        }
+        
+        PublishTranscript(userId, cacheKey);
         
     } catch (const std::exception& e) {
         LOG_ERROR("[ConversationalAIAPI] HandleAssistantMessage error: " + std::string(e.what()));
     }
 }
 
-void ConversationalAIAPI::HandleUserMessage(const std::string& userId, const std::map<std::string, std::string>& messageData) {
+void ConversationalAIAPI::HandleUserMessage(const std::string& userId, const std::map<std::string, std::string>& messageData,
+                                            std::vector<TranscriptWord>& words) {
     try {
         auto textIt = messageData.find("text");
         auto turnIdIt = messageData.find("turn_id");
@@ -341,10 +472,11 @@ void ConversationalAIAPI::HandleUserMessage(const std::string& userId, const std
             it->second.status = status;
         } else {
             Transcript transcript(turnId, transcriptUserId, text, status, TranscriptType::User);
-            m_transcriptCache[cacheKey] = transcript;
+            it = m_transcriptCache.emplace(cacheKey, std::move(transcript)).first;
         }
+        ApplyTiming(it->second, messageData, words);
         
-        NotifyTranscriptUpdated(userId, m_transcriptCache[cacheKey]);
+        PublishTranscript(userId, cacheKey);
         
     } catch (const std::exception& e) {
         LOG_ERROR("[ConversationalAIAPI] HandleUserMessage error: " + std::string(e.what()));
@@ -380,6 +512,9 @@ void ConversationalAIAPI::HandleStateMessage(const std::string& userId, const st
         auto stateIt = messageData.find("state");
         auto turnIdIt = messageData.find("turn_id");
         auto tsMsIt = messageData.find("ts_ms");
+        if (tsMsIt == messageData.end()) {
+            tsMsIt = messageData.find("timestamp");
+        }
         
         if (stateIt == messageData.end()) {
             return;
@@ -388,52 +523,798 @@ void ConversationalAIAPI::HandleStateMessage(const std::string& userId, const st
         int turnId = (turnIdIt != messageData.end()) ? std::stoi(turnIdIt->second) : 0;
         int64_t timestamp = (tsMsIt != messageData.end()) ? std::stoll(tsMsIt->second) : 0;
         
-        // Filter outdated state updates
-        if (m_hasStateChangeEvent) {
-            // Check if turnId is less than current stateChangeEvent turnId
-            if (turnId < m_lastStateChangeEvent.turnId) {
-                return;
-            }
-            // Check if timestamp is less than or equal to current stateChangeEvent timestamp
-            if (timestamp <= m_lastStateChangeEvent.timestamp) {
-                return;
-            }
-        }
+        ApplyStateChange(userId, ParseAgentState(stateIt->second), turnId, timestamp);
         
-        std::string stateStr = stateIt->second;
-        AgentState state = AgentState::Unknown;
-        if (stateStr == "idle") state = AgentState::Idle;
-        else if (stateStr == "silent") state = AgentState::Silent;
-        else if (stateStr == "listening") state = AgentState::Listening;
-        else if (stateStr == "thinking") state = AgentState::Thinking;
-        else if (stateStr == "speaking") state = AgentState::Speaking;
+    } catch (const std::exception& e) {
+        LOG_ERROR("[ConversationalAIAPI] HandleStateMessage error: " + std::string(e.what()));
+    }
+}
+
+void ConversationalAIAPI::HandleReceiptMessage(const std::string& userId, const std::map<std::string, std::string>& messageData,
+                                               bool isError) {
+    try {
+        auto moduleIt = messageData.find("module");
+        auto messageIt = messageData.find("message");
+        std::string module = (moduleIt != messageData.end()) ? moduleIt->second : "";
+        std::string message = (messageIt != messageData.end()) ? messageIt->second : "";
         
-        // Update last state change event
-        m_lastStateChangeEvent = StateChangeEvent(state, turnId, timestamp);
-        m_hasStateChangeEvent = true;
+        // Only context receipts describe something the client sent; their details are a JSON string
+        if (module != "context") {
+            LOG_INFO("[ConversationalAIAPI] " + std::string(isError ? "message.error" : "message.info") +
+                     ": module=" + module + ", ignored");
+            return;
+        }
         
-        LOG_INFO("[ConversationalAIAPI] message.state: state=" + stateStr + 
-                 ", turnId=" + std::to_string(turnId) + ", timestamp=" + std::to_string(timestamp));
+        ChatMessageType type = ChatMessageType::Unknown;
+        std::string uuid;
+        json details = json::parse(message, nullptr, false);
+        if (details.is_object()) {
+            std::string resourceType = details.value("resource_type", std::string());
+            if (resourceType == "picture") {
+                type = ChatMessageType::Image;
+            } else if (resourceType == "text") {
+                type = ChatMessageType::Text;
+            }
+            uuid = details.value("uuid", std::string());
+        }
+        
+        // Correlate with the upload that produced it
+        int64_t sentAtMs = 0;
+        if (!uuid.empty()) {
+            std::lock_guard<std::mutex> lock(m_sendMutex);
+            auto it = m_sentImages.find(uuid);
+            if (it != m_sentImages.end()) {
+                sentAtMs = it->second;
+                m_sentImages.erase(it);
+            }
+        }
+        std::string latency = sentAtMs ? ", after " + std::to_string(NowMs() - sentAtMs) + " ms" : "";
         
-        NotifyStateChanged(userId, m_lastStateChangeEvent);
+        if (isError) {
+            auto codeIt = messageData.find("code");
+            auto sendTsIt = messageData.find("send_ts");
+            MessageError error;
+            error.module = module;
+            error.type = type;
+            error.uuid = uuid;
+            error.code = (codeIt != messageData.end()) ? std::stoi(codeIt->second) : -1;
+            error.message = message;
+            error.timestamp = (sendTsIt != messageData.end()) ? std::stoll(sendTsIt->second) : 0;
+            
+            LOG_ERROR("[ConversationalAIAPI] message.error: uuid=" + uuid + ", code=" + std::to_string(error.code) + latency);
+            NotifyMessageError(userId, error);
+        } else {
+            auto turnIdIt = messageData.find("turn_id");
+            MessageReceipt receipt;
+            receipt.module = module;
+            receipt.type = type;
+            receipt.uuid = uuid;
+            receipt.turnId = (turnIdIt != messageData.end()) ? std::stoi(turnIdIt->second) : 0;
+            receipt.message = message;
+            
+            LOG_INFO("[ConversationalAIAPI] message.info: uuid=" + uuid + latency);
+            NotifyMessageReceipt(userId, receipt);
+        }
         
     } catch (const std::exception& e) {
-        LOG_ERROR("[ConversationalAIAPI] HandleStateMessage error: " + std::string(e.what()));
+        LOG_ERROR("[ConversationalAIAPI] HandleReceiptMessage error: " + std::string(e.what()));
     }
 }
 
-void ConversationalAIAPI::NotifyTranscriptUpdated(const std::string& agentUserId, const Transcript& transcript) {
-    for (auto handler : m_handlers) {
-        if (handler) {
-            handler->OnTranscriptUpdated(agentUserId, transcript);
+void ConversationalAIAPI::HandlePresenceState(std::string_view publisher, std::string_view state, int turnId, int64_t timestamp) {
+    std::unique_lock<std::mutex> lock(m_inboundMutex);
+    // Drop stale updates before paying for the publisher string
+    if (m_hasStateChangeEvent && (turnId < m_lastStateChangeEvent.turnId || timestamp <= m_lastStateChangeEvent.timestamp)) {
+        return;
+    }
+    ApplyStateChange(PublisherId(publisher), ParseAgentState(state), turnId, timestamp);
+    DispatchNotifications(lock);
+}
+
+AgentState ConversationalAIAPI::ParseAgentState(std::string_view state) {
+    if (state == "idle") return AgentState::Idle;
+    if (state == "silent") return AgentState::Silent;
+    if (state == "listening") return AgentState::Listening;
+    if (state == "thinking") return AgentState::Thinking;
+    if (state == "speaking") return AgentState::Speaking;
+    return AgentState::Unknown;
+}
+
+void ConversationalAIAPI::ApplyStateChange(const std::string& userId, AgentState state, int turnId, int64_t timestamp) {
+    // Filter outdated state updates
+    if (m_hasStateChangeEvent) {
+        // Check if turnId is less than current stateChangeEvent turnId
+        if (turnId < m_lastStateChangeEvent.turnId) {
+            return;
+        }
+        // Check if timestamp is less than or equal to current stateChangeEvent timestamp
+        if (timestamp <= m_lastStateChangeEvent.timestamp) {
+            return;
+        }
+    }
+    
+    // Update last state change event
+    m_lastStateChangeEvent = StateChangeEvent(state, turnId, timestamp);
+    m_hasStateChangeEvent = true;
+    
+    static const char* const stateNames[] = { "idle", "silent", "listening", "thinking", "speaking", "unknown" };
+    LOG_INFO("[ConversationalAIAPI] message.state: state=" + std::string(stateNames[static_cast<int>(state)]) +
+             ", turnId=" + std::to_string(turnId) + ", timestamp=" + std::to_string(timestamp));
+    
+    if (m_inBatch) {
+        // Only the final state of the batch is reported
+        m_batchStateUserId = userId;
+        m_hasBatchState = true;
+        return;
+    }
+    
+    NotifyStateChanged(userId, m_lastStateChangeEvent);
+}
+
+void ConversationalAIAPI::PublishTranscript(const std::string& agentUserId, const std::string& cacheKey) {
+    if (m_inBatch) {
+        // Remember the turn once; its final state is read from the cache at flush time
+        if (m_batchKeys.insert(cacheKey).second) {
+            m_batchUpdates.emplace_back(agentUserId, cacheKey);
+        }
+        return;
+    }
+    
+    NotifyTranscriptUpdated(agentUserId, m_transcriptCache[cacheKey]);
+}
+
+void ConversationalAIAPI::FlushBatch() {
+    // Group by publisher, keeping first-touch order within each group
+    std::vector<std::string> publishers;
+    std::map<std::string, std::vector<Transcript>> grouped;
+    for (const auto& update : m_batchUpdates) {
+        auto it = m_transcriptCache.find(update.second);
+        if (it == m_transcriptCache.end()) {
+            continue;
+        }
+        auto& transcripts = grouped[update.first];
+        if (transcripts.empty()) {
+            publishers.push_back(update.first);
         }
+        transcripts.push_back(it->second);
+    }
+    m_batchUpdates.clear();
+    m_batchKeys.clear();
+    
+    for (const auto& publisher : publishers) {
+        NotifyTranscriptsBatchUpdated(publisher, grouped[publisher]);
     }
+    
+    if (m_hasBatchState) {
+        m_hasBatchState = false;
+        NotifyStateChanged(m_batchStateUserId, m_lastStateChangeEvent);
+    }
+}
+
+void ConversationalAIAPI::NotifyTranscriptUpdated(const std::string& agentUserId, const Transcript& transcript) {
+    m_notifications.push_back([agentUserId, transcript](IConversationalAIAPIEventHandler* handler) {
+        handler->OnTranscriptUpdated(agentUserId, transcript);
+    });
+}
+
+void ConversationalAIAPI::NotifyTranscriptsBatchUpdated(const std::string& agentUserId, const std::vector<Transcript>& transcripts) {
+    m_notifications.push_back([agentUserId, transcripts](IConversationalAIAPIEventHandler* handler) {
+        handler->OnTranscriptsBatchUpdated(agentUserId, transcripts);
+    });
 }
 
 void ConversationalAIAPI::NotifyStateChanged(const std::string& agentUserId, const StateChangeEvent& event) {
-    for (auto handler : m_handlers) {
-        if (handler) {
-            handler->OnAgentStateChanged(agentUserId, event);
+    m_notifications.push_back([agentUserId, event](IConversationalAIAPIEventHandler* handler) {
+        handler->OnAgentStateChanged(agentUserId, event);
+    });
+}
+
+void ConversationalAIAPI::NotifyMessageReceipt(const std::string& agentUserId, const MessageReceipt& receipt) {
+    m_notifications.push_back([agentUserId, receipt](IConversationalAIAPIEventHandler* handler) {
+        handler->OnMessageReceiptUpdated(agentUserId, receipt);
+    });
+}
+
+void ConversationalAIAPI::NotifyMessageError(const std::string& agentUserId, const MessageError& error) {
+    m_notifications.push_back([agentUserId, error](IConversationalAIAPIEventHandler* handler) {
+        handler->OnMessageError(agentUserId, error);
+    });
+}
+
+void ConversationalAIAPI::DispatchNotifications(std::unique_lock<std::mutex>& lock) {
+    // A dispatch already running (on another thread, or further up this one's stack when a
+    // handler calls back into the API) delivers what was just queued after what it has
+    if (m_dispatching || m_notifications.empty()) {
+        return;
+    }
+    m_dispatching = true;
+    m_dispatchThread = std::this_thread::get_id();
+    
+    std::vector<Notification> notifications;
+    std::vector<IConversationalAIAPIEventHandler*> handlers;
+    while (!m_notifications.empty()) {
+        notifications.swap(m_notifications);
+        handlers = m_handlers;
+        lock.unlock();
+        
+        for (const auto& notification : notifications) {
+            for (auto handler : handlers) {
+                if (handler) {
+                    notification(handler);
+                }
+            }
         }
+        notifications.clear();
+        lock.lock();
+    }
+    
+    m_dispatching = false;
+    m_dispatchThread = std::thread::id();
+    lock.unlock();
+    m_dispatchDone.notify_all();
+}
+
+// ============================================================================
+// Outbound Messages
+// ============================================================================
+
+namespace {
+
+const char* const kChatCustomType = "user.transcription";
+const size_t kBufferReserve = 1024;
+const size_t kMaxPooledBuffers = 4;
+const size_t kMaxPooledCapacity = 64 * 1024;  // Don't keep buffers grown by one huge message
+const size_t kMaxEarlyResults = 256;
+
+// Everything in a chat payload except the text is known up front:
+// {"priority":"<P>","interruptable":<I>,"message":"<escaped text>"}
+// indexed by [ChatPriority][responseInterruptable]
+const std::string_view kChatPrefix[3][2] = {
+    { "{\"priority\":\"INTERRUPT\",\"interruptable\":false,\"message\":\"",
+      "{\"priority\":\"INTERRUPT\",\"interruptable\":true,\"message\":\"" },
+    { "{\"priority\":\"APPEND\",\"interruptable\":false,\"message\":\"",
+      "{\"priority\":\"APPEND\",\"interruptable\":true,\"message\":\"" },
+    { "{\"priority\":\"IGNORE\",\"interruptable\":false,\"message\":\"",
+      "{\"priority\":\"IGNORE\",\"interruptable\":true,\"message\":\"" }
+};
+const std::string_view kChatSuffix = "\"}";
+
+/// Append text as the body of a JSON string, copying unescaped runs in one go
+void AppendJsonEscaped(std::string& out, std::string_view text) {
+    static const char kHex[] = "0123456789abcdef";
+    
+    size_t runStart = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(text.data() + runStart, i - runStart);
+        runStart = i + 1;
+        switch (c) {
+            case '"': out.append("\\\"", 2); break;
+            case '\\': out.append("\\\\", 2); break;
+            case '\n': out.append("\\n", 2); break;
+            case '\r': out.append("\\r", 2); break;
+            case '\t': out.append("\\t", 2); break;
+            default: {
+                char escaped[6] = { '\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xF] };
+                out.append(escaped, sizeof(escaped));
+                break;
+            }
+        }
+    }
+    out.append(text.data() + runStart, text.size() - runStart);
+}
+
+}  // namespace
+
+void ConversationalAIAPI::Chat(std::string_view agentUserId, const TextMessage& message, SendCompletion completion) {
+    int priority = static_cast<int>(message.priority);
+    if (priority < 0 || priority > 2) {
+        priority = static_cast<int>(ChatPriority::Interrupt);
+    }
+    
+    std::string payload = AcquireBuffer();
+    const std::string_view& prefix = kChatPrefix[priority][message.responseInterruptable ? 1 : 0];
+    payload.append(prefix.data(), prefix.size());
+    AppendJsonEscaped(payload, message.text);
+    payload.append(kChatSuffix.data(), kChatSuffix.size());
+    
+    LOG_INFO("[ConversationalAIAPI] chat: agent=" + std::string(agentUserId) +
+             ", priority=" + std::to_string(priority) + ", bytes=" + std::to_string(payload.size()));
+    
+    // Only the latest "answer if idle" message is worth sending once the lane frees up
+    ChatPriority chatPriority = static_cast<ChatPriority>(priority);
+    OutboundLane lane = chatPriority == ChatPriority::Interrupt ? OutboundLane::HighChat : OutboundLane::Chat;
+    std::string coalesceKey = chatPriority == ChatPriority::Ignore ? "chat.ignore:" + std::string(agentUserId) : "";
+    Send(lane, agentUserId, std::move(payload), kChatCustomType, std::move(coalesceKey), std::move(completion));
+}
+
+void ConversationalAIAPI::Send(OutboundLane lane, std::string_view agentUserId, std::string&& payload,
+                               const char* customType, std::string coalesceKey, SendCompletion completion) {
+    OutboundScheduler::Message message;
+    message.channel.assign(agentUserId.data(), agentUserId.size());
+    message.payload = std::move(payload);
+    message.customType = customType;
+    message.coalesceKey = std::move(coalesceKey);
+    message.completion = std::move(completion);
+    
+    EnqueueResult result = m_outbound.Enqueue(lane, std::move(message));
+    if (result == EnqueueResult::Rejected) {
+        LOG_ERROR("[ConversationalAIAPI] send: outbound lane " + std::to_string(static_cast<int>(lane)) +
+                  " full, dropped " + customType);
+    }
+}
+
+bool ConversationalAIAPI::Publish(std::string_view agentUserId, const std::string& payload, const char* customType,
+                                  SendCompletion completion) {
+    agora::rtm::IRtmClient* client = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        client = m_rtmClient;
+    }
+    if (!client || agentUserId.empty()) {
+        LOG_ERROR("[ConversationalAIAPI] publish: RTM client or agent user id not set");
+        if (completion) {
+            completion(false, -1);
+        }
+        return false;
+    }
+    
+    agora::rtm::PublishOptions options;
+    options.channelType = agora::rtm::RTM_CHANNEL_TYPE_USER;
+    options.messageType = agora::rtm::RTM_MESSAGE_TYPE_STRING;
+    options.customType = customType;
+    
+    // The SDK copies the payload before publish() returns, so the buffer can be reused right after
+    std::string channelName(agentUserId);
+    uint64_t requestId = 0;
+    client->publish(channelName.c_str(), payload.data(), payload.size(), options, requestId);
+    if (requestId == 0) {
+        // publish() returns nothing in RTM 2.2; a request it rejects outright never gets an id,
+        // and no onPublishResult will ever arrive for it
+        LOG_ERROR("[ConversationalAIAPI] publish rejected: " + std::string(customType));
+        if (completion) {
+            completion(false, -1);
+        }
+        return false;
+    }
+    
+    std::unique_lock<std::mutex> lock(m_sendMutex);
+    auto early = m_earlyResults.find(requestId);
+    if (early == m_earlyResults.end()) {
+        if (!m_pendingSends.emplace(requestId, completion).second) {
+            // An id still awaiting its ack: this request's result can't be told apart from it
+            lock.unlock();
+            LOG_ERROR("[ConversationalAIAPI] publish: duplicate requestId=" + std::to_string(requestId));
+            if (completion) {
+                completion(false, -1);
+            }
+            return false;
+        }
+        return true;
+    }
+    
+    int errorCode = early->second;
+    m_earlyResults.erase(early);
+    lock.unlock();
+    if (completion) {
+        completion(errorCode == 0, errorCode);
+    }
+    return errorCode == 0;
+}
+
+void ConversationalAIAPI::Interrupt(std::string_view agentUserId, SendCompletion completion) {
+    static const std::string kInterruptPayload = "{\"customType\":\"message.interrupt\"}";
+    
+    // Send first: the truncation below can wait, the agent's audio can't
+    int64_t startMs = NowMs();
+    LOG_INFO("[ConversationalAIAPI] interrupt: agent=" + std::string(agentUserId));
+    Send(OutboundLane::Interrupt, agentUserId, std::string(kInterruptPayload), "message.interrupt",
+        "interrupt:" + std::string(agentUserId), [this, startMs, completion](bool success, int errorCode) {
+            if (success) {
+                int64_t rttMs = NowMs() - startMs;
+                m_lastInterruptRttMs = rttMs;
+                LOG_INFO("[ConversationalAIAPI] interrupt acked in " + std::to_string(rttMs) + " ms");
+            }
+            if (completion) {
+                completion(success, errorCode);
+            }
+        });
+    
+    std::unique_lock<std::mutex> lock(m_inboundMutex);
+    TruncateCurrentAgentTurn(PublisherId(agentUserId));
+    DispatchNotifications(lock);
+}
+
+void ConversationalAIAPI::TruncateCurrentAgentTurn(const std::string& agentUserId) {
+    // The turn being rendered is the agent's newest turn still in progress; when the agent's
+    // messages come from another publisher id, the newest of any (a session has one agent)
+    auto tracked = m_currentAgentTurn.find(agentUserId);
+    if (tracked == m_currentAgentTurn.end()) {
+        for (auto it = m_currentAgentTurn.begin(); it != m_currentAgentTurn.end(); ++it) {
+            if (tracked == m_currentAgentTurn.end() || it->second > tracked->second) {
+                tracked = it;
+            }
+        }
+    }
+    if (tracked == m_currentAgentTurn.end()) {
+        return;
+    }
+    auto current = m_transcriptCache.find(GenerateCacheKey(tracked->second, TranscriptType::Agent));
+    m_currentAgentTurn.erase(tracked);
+    if (current == m_transcriptCache.end() || current->second.status != TranscriptStatus::InProgress) {
+        return;
+    }
+    
+    // Same bookkeeping as a message.interrupt from the agent: later updates of the turn are dropped
+    int turnId = current->second.turnId;
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    m_lastInterruptEvent = InterruptEvent(turnId, std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+    m_hasInterruptEvent = true;
+    current->second.status = TranscriptStatus::Interrupted;
+    
+    LOG_INFO("[ConversationalAIAPI] interrupt: truncated agent turn " + std::to_string(turnId));
+    PublishTranscript(agentUserId, current->first);
+}
+
+void ConversationalAIAPI::HandlePublishResult(uint64_t requestId, int errorCode) {
+    SendCompletion completion;
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        auto it = m_pendingSends.find(requestId);
+        if (it == m_pendingSends.end()) {
+            // The ack raced ahead of publish() returning; Publish() picks it up
+            if (m_earlyResults.size() >= kMaxEarlyResults) {
+                m_earlyResults.clear();
+            }
+            m_earlyResults[requestId] = errorCode;
+            return;
+        }
+        completion = std::move(it->second);
+        m_pendingSends.erase(it);
+    }
+    
+    if (errorCode != 0) {
+        LOG_ERROR("[ConversationalAIAPI] publish failed: requestId=" + std::to_string(requestId) +
+                  ", error=" + std::to_string(errorCode));
+    }
+    if (completion) {
+        completion(errorCode == 0, errorCode);
+    }
+}
+
+std::string ConversationalAIAPI::AcquireBuffer() {
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        if (!m_bufferPool.empty()) {
+            std::string buffer = std::move(m_bufferPool.back());
+            m_bufferPool.pop_back();
+            buffer.clear();
+            return buffer;
+        }
+    }
+    std::string buffer;
+    buffer.reserve(kBufferReserve);
+    return buffer;
+}
+
+void ConversationalAIAPI::ReleaseBuffer(std::string&& buffer) {
+    if (buffer.capacity() > kMaxPooledCapacity) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    if (m_bufferPool.size() < kMaxPooledBuffers) {
+        m_bufferPool.push_back(std::move(buffer));
+    }
+}
+
+// ============================================================================
+// Image Upload
+// ============================================================================
+
+namespace {
+
+const char* const kImageCustomType = "image.upload";
+const size_t kMaxImageUuidLength = 64;
+const size_t kMaxSentImages = 64;
+
+// Framed parts: "<uuid>|<part>|<total>|" followed by base64 of kPartJsonBytes payload bytes
+const size_t kPartHeaderReserve = kMaxImageUuidLength + 32;
+const size_t kPartJsonBytes = (ConversationalAIAPI::MAX_MESSAGE_BYTES - kPartHeaderReserve) / 4 * 3;
+const size_t kSourceBlockBytes = 12 * 1024;  // Multiple of 3 so blocks encode without padding
+
+const std::string_view kImageSuffix = "\"}";
+
+bool IsValidImageUuid(const std::string& uuid) {
+    return !uuid.empty() && uuid.size() <= kMaxImageUuidLength && uuid.find('|') == std::string::npos;
+}
+
+}  // namespace
+
+/// One image being sent: the {"uuid":..,"image_base64":..} payload is produced on demand,
+/// a part at a time, from the raw image held in memory or read from the file
+struct ConversationalAIAPI::ImageUpload {
+    std::string agentUserId;
+    std::string uuid;
+    SendCompletion completion;
+    int64_t startMs = 0;
+    
+    // Source image
+    std::vector<uint8_t> data;
+    FILE* file = nullptr;
+    size_t sourceSize = 0;
+    size_t sourceRead = 0;
+    std::vector<uint8_t> readBuffer;
+    
+    // Payload stream: prefix, base64(source), suffix
+    std::string prefix;
+    size_t encodedSize = 0;
+    size_t payloadSize = 0;
+    size_t payloadProduced = 0;
+    std::string encoded;      // Encoded source block being consumed
+    size_t encodedPos = 0;
+    std::string payloadChunk; // Scratch for one framed part before the outer encoding
+    
+    // Parts (guarded by mutex)
+    std::mutex mutex;
+    bool framed = false;
+    int totalParts = 0;
+    int nextPart = 1;
+    int acked = 0;
+    int inFlight = 0;
+    bool pumping = false;
+    bool finished = false;
+    
+    ~ImageUpload() {
+        if (file) {
+            fclose(file);
+        }
+    }
+    
+    bool RefillEncoded() {
+        size_t block = (std::min)(kSourceBlockBytes, sourceSize - sourceRead);
+        if (block == 0) {
+            return false;
+        }
+        const unsigned char* in = nullptr;
+        if (file) {
+            readBuffer.resize(block);
+            if (fread(readBuffer.data(), 1, block, file) != block) {
+                return false;
+            }
+            in = readBuffer.data();
+        } else {
+            in = data.data() + sourceRead;
+        }
+        sourceRead += block;
+        encoded.resize(Base64::EncodedLength(block));
+        Base64::Encode(in, block, &encoded[0]);
+        encodedPos = 0;
+        return true;
+    }
+    
+    /// Copy the next bytes of the payload to out; false if the source could not be read
+    bool ReadPayload(char* out, size_t count) {
+        while (count > 0) {
+            size_t n = 0;
+            if (payloadProduced < prefix.size()) {
+                n = (std::min)(count, prefix.size() - payloadProduced);
+                memcpy(out, prefix.data() + payloadProduced, n);
+            } else if (payloadProduced < prefix.size() + encodedSize) {
+                if (encodedPos == encoded.size() && !RefillEncoded()) {
+                    return false;
+                }
+                n = (std::min)(count, encoded.size() - encodedPos);
+                memcpy(out, encoded.data() + encodedPos, n);
+                encodedPos += n;
+            } else {
+                size_t offset = payloadProduced - prefix.size() - encodedSize;
+                n = (std::min)(count, kImageSuffix.size() - offset);
+                memcpy(out, kImageSuffix.data() + offset, n);
+            }
+            out += n;
+            count -= n;
+            payloadProduced += n;
+        }
+        return true;
+    }
+};
+
+void ConversationalAIAPI::SendImage(std::string_view agentUserId, const std::string& uuid, std::vector<uint8_t> imageData,
+                                    SendCompletion completion) {
+    auto upload = std::make_shared<ImageUpload>();
+    upload->agentUserId.assign(agentUserId.data(), agentUserId.size());
+    upload->uuid = uuid;
+    upload->completion = std::move(completion);
+    upload->sourceSize = imageData.size();
+    upload->data = std::move(imageData);
+    StartImageUpload(std::move(upload));
+}
+
+void ConversationalAIAPI::SendImageFile(std::string_view agentUserId, const std::string& uuid, const std::string& filePath,
+                                        SendCompletion completion) {
+    FILE* file = nullptr;
+#ifdef _WIN32
+    if (fopen_s(&file, filePath.c_str(), "rb") != 0) {
+        file = nullptr;
+    }
+#else
+    file = std::fopen(filePath.c_str(), "rb");
+#endif
+    long size = -1;
+    if (file && fseek(file, 0, SEEK_END) == 0) {
+        size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+    }
+    if (size <= 0) {
+        LOG_ERROR("[ConversationalAIAPI] sendImage: cannot read " + filePath);
+        if (file) {
+            fclose(file);
+        }
+        if (completion) {
+            completion(false, -1);
+        }
+        return;
+    }
+    
+    auto upload = std::make_shared<ImageUpload>();
+    upload->agentUserId.assign(agentUserId.data(), agentUserId.size());
+    upload->uuid = uuid;
+    upload->completion = std::move(completion);
+    upload->file = file;
+    upload->sourceSize = static_cast<size_t>(size);
+    StartImageUpload(std::move(upload));
+}
+
+void ConversationalAIAPI::SendImageUrl(std::string_view agentUserId, const std::string& uuid, std::string_view imageUrl,
+                                       SendCompletion completion) {
+    if (!IsValidImageUuid(uuid) || imageUrl.empty()) {
+        LOG_ERROR("[ConversationalAIAPI] sendImage: invalid uuid or empty url");
+        if (completion) {
+            completion(false, -1);
+        }
+        return;
+    }
+    
+    std::string payload = AcquireBuffer();
+    payload.append("{\"uuid\":\"");
+    AppendJsonEscaped(payload, uuid);
+    payload.append("\",\"image_url\":\"");
+    AppendJsonEscaped(payload, imageUrl);
+    payload.append(kImageSuffix.data(), kImageSuffix.size());
+    
+    LOG_INFO("[ConversationalAIAPI] sendImage: agent=" + std::string(agentUserId) + ", uuid=" + uuid + ", url");
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        if (m_sentImages.size() >= kMaxSentImages) {
+            m_sentImages.clear();  // The agent stopped answering; don't keep stale uuids forever
+        }
+        m_sentImages[uuid] = NowMs();
+    }
+    Send(OutboundLane::Chat, agentUserId, std::move(payload), kImageCustomType, "", std::move(completion));
+}
+
+void ConversationalAIAPI::StartImageUpload(std::shared_ptr<ImageUpload> upload) {
+    if (!IsValidImageUuid(upload->uuid) || upload->sourceSize == 0 || upload->sourceSize > MAX_IMAGE_BYTES) {
+        LOG_ERROR("[ConversationalAIAPI] sendImage: invalid uuid or image size " + std::to_string(upload->sourceSize));
+        if (upload->completion) {
+            upload->completion(false, -1);
+        }
+        return;
+    }
+    
+    upload->prefix = "{\"uuid\":\"";
+    AppendJsonEscaped(upload->prefix, upload->uuid);
+    upload->prefix += "\",\"image_base64\":\"";
+    upload->encodedSize = Base64::EncodedLength(upload->sourceSize);
+    upload->payloadSize = upload->prefix.size() + upload->encodedSize + kImageSuffix.size();
+    upload->framed = upload->payloadSize > MAX_MESSAGE_BYTES;
+    upload->totalParts = upload->framed ? static_cast<int>((upload->payloadSize + kPartJsonBytes - 1) / kPartJsonBytes) : 1;
+    upload->startMs = NowMs();
+    
+    LOG_INFO("[ConversationalAIAPI] sendImage: agent=" + upload->agentUserId + ", uuid=" + upload->uuid +
+             ", bytes=" + std::to_string(upload->sourceSize) + ", parts=" + std::to_string(upload->totalParts));
+    {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        if (m_sentImages.size() >= kMaxSentImages) {
+            m_sentImages.clear();
+        }
+        m_sentImages[upload->uuid] = upload->startMs;
+    }
+    PumpImageUpload(upload);
+}
+
+void ConversationalAIAPI::PumpImageUpload(const std::shared_ptr<ImageUpload>& upload) {
+    std::unique_lock<std::mutex> lock(upload->mutex);
+    // A completion arriving while another thread (or an outer frame of this one) is publishing
+    // leaves the work to that loop, which rechecks the window after every part
+    if (upload->pumping) {
+        return;
+    }
+    upload->pumping = true;
+    
+    while (!upload->finished && upload->nextPart <= upload->totalParts && upload->inFlight < IMAGE_PARTS_IN_FLIGHT) {
+        int part = upload->nextPart++;
+        std::string message = AcquireBuffer();
+        bool ok = true;
+        if (!upload->framed) {
+            message.resize(upload->payloadSize);
+            ok = upload->ReadPayload(&message[0], upload->payloadSize);
+        } else {
+            size_t chunk = (std::min)(kPartJsonBytes, upload->payloadSize - upload->payloadProduced);
+            upload->payloadChunk.resize(chunk);
+            ok = upload->ReadPayload(&upload->payloadChunk[0], chunk);
+            
+            message += upload->uuid;
+            message += '|';
+            message += std::to_string(part);
+            message += '|';
+            message += std::to_string(upload->totalParts);
+            message += '|';
+            size_t header = message.size();
+            message.resize(header + Base64::EncodedLength(chunk));
+            Base64::Encode(upload->payloadChunk.data(), chunk, &message[header]);
+        }
+        
+        if (!ok) {
+            ReleaseBuffer(std::move(message));
+            upload->finished = true;
+            upload->pumping = false;
+            lock.unlock();
+            LOG_ERROR("[ConversationalAIAPI] sendImage: read failed, uuid=" + upload->uuid);
+            if (upload->completion) {
+                upload->completion(false, -1);
+            }
+            return;
+        }
+        ++upload->inFlight;
+        
+        lock.unlock();
+        std::shared_ptr<ImageUpload> self = upload;
+        Send(OutboundLane::Bulk, upload->agentUserId, std::move(message), kImageCustomType, "",
+            [this, self](bool success, int errorCode) {
+                OnImagePartResult(self, success, errorCode);
+            });
+        lock.lock();
+    }
+    upload->pumping = false;
+}
+
+void ConversationalAIAPI::OnImagePartResult(const std::shared_ptr<ImageUpload>& upload, bool success, int errorCode) {
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lock(upload->mutex);
+        --upload->inFlight;
+        if (upload->finished) {
+            return;  // Already failed; later acks don't matter
+        }
+        if (!success) {
+            upload->finished = true;
+            done = true;
+        } else if (++upload->acked == upload->totalParts) {
+            upload->finished = true;
+            done = true;
+        }
+    }
+    
+    if (!done) {
+        PumpImageUpload(upload);
+        return;
+    }
+    
+    if (!success) {
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        m_sentImages.erase(upload->uuid);
+    }
+    if (success) {
+        LOG_INFO("[ConversationalAIAPI] sendImage: uuid=" + upload->uuid + " published in " +
+                 std::to_string(NowMs() - upload->startMs) + " ms");
+    } else {
+        LOG_ERROR("[ConversationalAIAPI] sendImage: uuid=" + upload->uuid + " failed, error=" + std::to_string(errorCode));
+    }
+    if (upload->completion) {
+        upload->completion(success, errorCode);
     }
 }
@@ -4,11 +4,23 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <functional>
 #include <map>
+#include <set>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <atomic>
 #include <cstdint>
 
+#include "OutboundScheduler.h"
+
+namespace agora { namespace rtm { class IRtmClient; } }
+
 // Enums
 
 enum class TranscriptStatus {
@@ -34,16 +46,30 @@ enum class AgentState {
 
 // Data Models
 
+struct TranscriptWord {
+    std::string word;
+    int64_t startMs;     // Offset in the agent session, 0 if not provided
+    int64_t durationMs;
+    bool stable;
+    
+    TranscriptWord() : startMs(0), durationMs(0), stable(false) {}
+    TranscriptWord(const std::string& w, int64_t start, int64_t duration, bool st)
+        : word(w), startMs(start), durationMs(duration), stable(st) {}
+};
+
 struct Transcript {
     int turnId;
     std::string userId;
     std::string text;
     TranscriptStatus status;
     TranscriptType type;
+    int64_t startMs;                    // Turn start offset (start_ms), 0 if not provided
+    int64_t durationMs;                 // Turn duration (duration_ms), 0 if not provided
+    std::vector<TranscriptWord> words;  // Word timings, empty if not provided
     
-    Transcript() : turnId(0), status(TranscriptStatus::InProgress), type(TranscriptType::Agent) {}
+    Transcript() : turnId(0), status(TranscriptStatus::InProgress), type(TranscriptType::Agent), startMs(0), durationMs(0) {}
     Transcript(int tid, const std::string& uid, const std::string& txt, TranscriptStatus st, TranscriptType tp)
-        : turnId(tid), userId(uid), text(txt), status(st), type(tp) {}
+        : turnId(tid), userId(uid), text(txt), status(st), type(tp), startMs(0), durationMs(0) {}
 };
 
 struct StateChangeEvent {
@@ -64,6 +90,64 @@ struct InterruptEvent {
     InterruptEvent(int tid, int64_t ts) : turnId(tid), timestamp(ts) {}
 };
 
+/// How the agent treats an outbound chat message relative to the current interaction
+enum class ChatPriority {
+    Interrupt = 0,  // Interrupt the current response and handle this message now (default)
+    Append = 1,     // Handle after the current response completes
+    Ignore = 2      // Handle only if the agent is idle, otherwise drop
+};
+
+struct TextMessage {
+    ChatPriority priority;
+    bool responseInterruptable;  // Whether the reply to this message may itself be interrupted
+    std::string text;
+    
+    TextMessage() : priority(ChatPriority::Interrupt), responseInterruptable(true) {}
+    TextMessage(const std::string& txt, ChatPriority p = ChatPriority::Interrupt, bool interruptable = true)
+        : priority(p), responseInterruptable(interruptable), text(txt) {}
+};
+
+/// Kind of resource an upload receipt or error refers to
+enum class ChatMessageType {
+    Text = 0,
+    Image = 1,     // resource_type "picture"
+    Unknown = 2
+};
+
+/// message.info from the agent, e.g. confirmation that an uploaded image was accepted
+struct MessageReceipt {
+    std::string module;      // e.g. "context"
+    ChatMessageType type;
+    std::string uuid;        // uuid given to SendImage(), empty if the receipt has none
+    int turnId;
+    std::string message;     // Raw JSON details (resource_type, uuid, width, height, size_bytes, ...)
+    
+    MessageReceipt() : type(ChatMessageType::Unknown), turnId(0) {}
+};
+
+/// message.error from the agent for something the client sent
+struct MessageError {
+    std::string module;
+    ChatMessageType type;
+    std::string uuid;        // uuid given to SendImage(), empty if the error has none
+    int code;
+    std::string message;     // Raw JSON details (resource_type, uuid, success, error{code, message})
+    int64_t timestamp;
+    
+    MessageError() : type(ChatMessageType::Unknown), code(0), timestamp(0) {}
+};
+
+/// Outbound message completion: success once RTM acknowledged the publish, errorCode is the RTM error otherwise
+using SendCompletion = std::function<void(bool success, int errorCode)>;
+
+struct RawMessage {
+    std::string message;    // Complete JSON payload
+    std::string publisher;  // RTM publisher (agent user id)
+    
+    RawMessage() = default;
+    RawMessage(const std::string& msg, const std::string& pub) : message(msg), publisher(pub) {}
+};
+
 // Event Handler Protocol
 
 class IConversationalAIAPIEventHandler {
@@ -71,6 +155,20 @@ public:
     virtual ~IConversationalAIAPIEventHandler() = default;
     virtual void OnAgentStateChanged(const std::string& agentUserId, const StateChangeEvent& event) = 0;
     virtual void OnTranscriptUpdated(const std::string& agentUserId, const Transcript& transcript) = 0;
+    
+    /// Called once per HandleMessages() batch with the final state of every turn the batch touched
+    /// Default implementation forwards each transcript to OnTranscriptUpdated
+    virtual void OnTranscriptsBatchUpdated(const std::string& agentUserId, const std::vector<Transcript>& transcripts) {
+        for (const auto& transcript : transcripts) {
+            OnTranscriptUpdated(agentUserId, transcript);
+        }
+    }
+    
+    /// Called when the agent acknowledges a sent message (message.info)
+    virtual void OnMessageReceiptUpdated(const std::string&, const MessageReceipt&) {}
+    
+    /// Called when the agent rejects a sent message (message.error)
+    virtual void OnMessageError(const std::string&, const MessageError&) {}
 };
 
 // Message Parser - handles split messages
@@ -83,7 +181,7 @@ public:
     /// Parse stream message that may be split into multiple parts
     /// Message format: messageId|partIndex|totalParts|base64Content
     /// @return Parsed JSON string or empty if message is incomplete
-    std::string ParseStreamMessage(const std::string& message);
+    std::string ParseStreamMessage(std::string_view message);
     
     /// Clear expired messages
     void CleanExpiredMessages();
@@ -102,37 +200,146 @@ private:
 
 class ConversationalAIAPI {
 public:
-    ConversationalAIAPI();
+    /// @param rtmClient Logged-in RTM client used for outbound messages (may be set later)
+    explicit ConversationalAIAPI(agora::rtm::IRtmClient* rtmClient = nullptr);
     ~ConversationalAIAPI();
     
+    void SetRtmClient(agora::rtm::IRtmClient* rtmClient);
+    
+    /// Handlers are called on the thread that fed the message in (or called Interrupt()), after
+    /// the API's own locks are released. Once RemoveHandler() returns the handler is not called again.
     void AddHandler(IConversationalAIAPIEventHandler* handler);
     void RemoveHandler(IConversationalAIAPIEventHandler* handler);
     
     /// Handle RTM message that may be split into parts (format: messageId|partIndex|totalParts|base64Content)
     /// Use this when RTM messages are split due to size limits
-    void HandleSplitMessage(const std::string& message, const std::string& fromUserId);
+    void HandleSplitMessage(std::string_view message, std::string_view fromUserId);
     
     /// Handle RTM message that is already complete JSON
     /// Use this when RTM messages are not split
-    void HandleMessage(const std::string& jsonString, const std::string& fromUserId);
+    /// The buffer is parsed in place and only needs to stay valid for the duration of the call
+    void HandleMessage(std::string_view jsonString, std::string_view fromUserId);
+    
+    /// Same as above, taking the RTM SDK buffer (not necessarily NUL-terminated) directly
+    void HandleMessage(const char* data, size_t length, const char* fromUserId);
+    
+    /// Handle a batch of complete JSON messages (e.g. after a reconnect or during replay)
+    /// All cache updates are applied first, then handlers get one OnTranscriptsBatchUpdated
+    /// per publisher carrying only the final state of each turn, plus the final agent state
+    void HandleMessages(const RawMessage* messages, size_t count);
+    void HandleMessages(const std::vector<RawMessage>& messages);
+    
+    /// Handle an agent state change carried by RTM presence state items
+    /// Typed fast path: no JSON is built or parsed, the state is applied directly
+    void HandlePresenceState(std::string_view publisher, std::string_view state, int turnId, int64_t timestamp);
+    
+    /// Send a text message to the agent as an RTM user-channel message
+    /// Completion runs on the RTM callback thread once HandlePublishResult() sees the ack.
+    /// Interrupt-priority messages use the high chat lane of Outbound(), the others the normal
+    /// one; a queued Ignore-priority message is superseded by the next one.
+    void Chat(std::string_view agentUserId, const TextMessage& message, SendCompletion completion = nullptr);
+    
+    /// Send an image to the agent (customType "image.upload", same payload as the mobile toolkits)
+    /// The image is base64 encoded while it is sent: payloads that don't fit one RTM message are
+    /// split into messageId|partIndex|totalParts|base64Content parts, at most IMAGE_PARTS_IN_FLIGHT
+    /// published at a time, and the next part is only encoded when an earlier one is acknowledged.
+    /// Parts go through the bulk lane of Outbound(), behind any chat or interrupt.
+    /// Completion reports the publish of the last part; the agent's verdict arrives later through
+    /// OnMessageReceiptUpdated / OnMessageError carrying the same uuid.
+    void SendImage(std::string_view agentUserId, const std::string& uuid, std::vector<uint8_t> imageData,
+                   SendCompletion completion = nullptr);
+    void SendImageFile(std::string_view agentUserId, const std::string& uuid, const std::string& filePath,
+                       SendCompletion completion = nullptr);
+    void SendImageUrl(std::string_view agentUserId, const std::string& uuid, std::string_view imageUrl,
+                      SendCompletion completion = nullptr);
+    
+    static const size_t MAX_MESSAGE_BYTES = 30 * 1024;       // Largest single RTM payload we publish
+    static const size_t MAX_IMAGE_BYTES = 8 * 1024 * 1024;
+    static const int IMAGE_PARTS_IN_FLIGHT = 4;
+    
+    /// Ask the agent to stop its current response (customType "message.interrupt")
+    /// The payload is a constant published straight away on the interrupt lane, ahead of chat
+    /// and image parts still waiting to be sent. The agent turn being rendered is marked Interrupted locally at once, so
+    /// handlers see the truncation before the agent confirms it. Completion reports the RTM ack;
+    /// the time from the call to the ack is logged and kept in LastInterruptRttMs().
+    void Interrupt(std::string_view agentUserId, SendCompletion completion = nullptr);
+    
+    /// Round trip of the most recent acknowledged Interrupt(), -1 before the first one
+    int64_t LastInterruptRttMs() const { return m_lastInterruptRttMs.load(); }
+    
+    /// Pacing and per-lane depth/latency of outbound messages; callers can watch IsCongested()
+    /// or set a backpressure handler to hold back work the scheduler can't keep up with
+    OutboundScheduler& Outbound() { return m_outbound; }
+    
+    /// Forward IRtmEventHandler::onPublishResult here so pending sends complete
+    void HandlePublishResult(uint64_t requestId, int errorCode);
     
     /// Clear all cached data
     void ClearCache();
     
 private:
-    void ParseAndDispatchMessage(const std::string& jsonString, const std::string& userId);
-    void HandleAssistantMessage(const std::string& userId, const std::map<std::string, std::string>& messageData);
-    void HandleUserMessage(const std::string& userId, const std::map<std::string, std::string>& messageData);
+    void ParseAndDispatchMessage(std::string_view jsonString, std::string_view publisher);
+    const std::string& PublisherId(std::string_view publisher);
+    void HandleAssistantMessage(const std::string& userId, const std::map<std::string, std::string>& messageData,
+                                std::vector<TranscriptWord>& words);
+    void HandleUserMessage(const std::string& userId, const std::map<std::string, std::string>& messageData,
+                           std::vector<TranscriptWord>& words);
+    void ApplyTiming(Transcript& transcript, const std::map<std::string, std::string>& messageData,
+                     std::vector<TranscriptWord>& words);
     void HandleInterruptMessage(const std::string& userId, const std::map<std::string, std::string>& messageData);
     void HandleStateMessage(const std::string& userId, const std::map<std::string, std::string>& messageData);
+    void HandleReceiptMessage(const std::string& userId, const std::map<std::string, std::string>& messageData,
+                              bool isError);
+    void ApplyStateChange(const std::string& userId, AgentState state, int turnId, int64_t timestamp);
+    void TruncateCurrentAgentTurn(const std::string& agentUserId);
+    static AgentState ParseAgentState(std::string_view state);
+    void PublishTranscript(const std::string& agentUserId, const std::string& cacheKey);
+    void FlushBatch();
     void NotifyTranscriptUpdated(const std::string& agentUserId, const Transcript& transcript);
+    void NotifyTranscriptsBatchUpdated(const std::string& agentUserId, const std::vector<Transcript>& transcripts);
     void NotifyStateChanged(const std::string& agentUserId, const StateChangeEvent& event);
+    void NotifyMessageReceipt(const std::string& agentUserId, const MessageReceipt& receipt);
+    void NotifyMessageError(const std::string& agentUserId, const MessageError& error);
+    // Hand the notifications queued under lock to the handlers, after releasing it
+    void DispatchNotifications(std::unique_lock<std::mutex>& lock);
     
     // Generate cache key using turnId + type
     std::string GenerateCacheKey(int turnId, TranscriptType type);
     
+    // Outbound: queue a serialized payload (the buffer goes back to the pool once published)
+    void Send(OutboundLane lane, std::string_view agentUserId, std::string&& payload, const char* customType,
+              std::string coalesceKey, SendCompletion completion);
+    // Publish a payload right away and track its completion by requestId
+    bool Publish(std::string_view agentUserId, const std::string& payload, const char* customType,
+                 SendCompletion completion);
+    std::string AcquireBuffer();
+    void ReleaseBuffer(std::string&& buffer);
+    
+    struct ImageUpload;
+    void StartImageUpload(std::shared_ptr<ImageUpload> upload);
+    void PumpImageUpload(const std::shared_ptr<ImageUpload>& upload);
+    void OnImagePartResult(const std::shared_ptr<ImageUpload>& upload, bool success, int errorCode);
+    
+    // Inbound messages arrive on the RTM thread while Interrupt() runs on the caller's;
+    // guards the handlers and everything the parsing path touches
+    std::mutex m_inboundMutex;
+    
     std::vector<IConversationalAIAPIEventHandler*> m_handlers;
+    
+    // Notify* only queue here; handlers run without m_inboundMutex, so a handler blocking on
+    // the UI thread can't deadlock with the UI thread calling Interrupt() or RemoveHandler().
+    // One thread at a time delivers the queue, in order; others only add to it.
+    using Notification = std::function<void(IConversationalAIAPIEventHandler* handler)>;
+    std::vector<Notification> m_notifications;
+    bool m_dispatching = false;
+    std::thread::id m_dispatchThread;
+    std::condition_variable m_dispatchDone;     // RemoveHandler() waits here for a running dispatch
+    
+    // Last publisher as a std::string: a session has one agent, so this is almost never reassigned
+    std::string m_publisher;
     std::map<std::string, Transcript> m_transcriptCache;
+    // Per publisher, the newest agent turn still in progress: what an interrupt truncates
+    std::unordered_map<std::string, int> m_currentAgentTurn;
     
     // Message parser for split messages
     MessageParser m_messageParser;
@@ -144,4 +351,23 @@ private:
     // Last state change event (for filtering outdated state updates)
     StateChangeEvent m_lastStateChangeEvent;
     bool m_hasStateChangeEvent;
+    
+    // Batch mode: notifications are deferred until the whole batch is applied
+    bool m_inBatch;
+    std::vector<std::pair<std::string, std::string>> m_batchUpdates;  // (agentUserId, cacheKey) in first-touch order
+    std::set<std::string> m_batchKeys;
+    std::string m_batchStateUserId;
+    bool m_hasBatchState;
+    
+    // Outbound messages (may be sent from any thread; guarded by m_sendMutex)
+    agora::rtm::IRtmClient* m_rtmClient;
+    std::mutex m_sendMutex;
+    std::unordered_map<uint64_t, SendCompletion> m_pendingSends;
+    std::unordered_map<uint64_t, int> m_earlyResults;  // Acks that arrived before publish() returned
+    std::vector<std::string> m_bufferPool;             // Reused serialization buffers
+    std::unordered_map<std::string, int64_t> m_sentImages;  // uuid -> send start (ms), until the agent answers
+    std::atomic<int64_t> m_lastInterruptRttMs;
+    
+    // Last member: destroyed (and drained) before everything its publish function uses
+    OutboundScheduler m_outbound;
 };
@@ -0,0 +1,504 @@
+//
+// ImagePreparer.cpp: Downscale and JPEG re-encode images to fit the image message budget
+//
+
+#include "../general/pch.h"
+#include "ImagePreparer.h"
+#include "../tools/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#include <atlbase.h>
+#include <wincodec.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGE_PREPARER_SSE2 1
+#endif
+
+namespace {
+
+const int kMaxShrinkRounds = 4;  // Extra 3/4 reductions when minQuality still doesn't fit
+
+// Sources up to this many pixels are decoded at full size (a 4K screenshot is 8.3M, 33 MB).
+// Larger ones are scaled down while decoding, to twice the target size so the box reductions
+// still do the final 2x.
+const uint64_t kMaxDecodedPixels = 4096ull * 4096;
+
+// Larger sources are refused outright, without decoding: no real screenshot or photo comes
+// close, and scaling one this size would keep the worker busy for seconds
+const uint64_t kMaxSourcePixels = 256ull * 1024 * 1024;
+
+// Size to decode a width x height source at so that it can still be shrunk to fit
+// maxWidth x maxHeight by a final 2x box reduction, and stays within kMaxDecodedPixels
+void DecodeSize(int width, int height, int maxWidth, int maxHeight, int& outWidth, int& outHeight) {
+    outWidth = width;
+    outHeight = height;
+    const uint64_t pixels = static_cast<uint64_t>(width) * height;
+    if (pixels <= kMaxDecodedPixels) {
+        return;
+    }
+    // Largest scale that keeps the pixel count under the cap, and no more than 2x the target
+    double scale = std::sqrt(static_cast<double>(kMaxDecodedPixels) / pixels);
+    scale = (std::min)(scale, 2.0 * (std::max)(maxWidth, 1) / width);
+    scale = (std::min)(scale, 2.0 * (std::max)(maxHeight, 1) / height);
+    outWidth = (std::max)(1, static_cast<int>(width * scale));
+    outHeight = (std::max)(1, static_cast<int>(height * scale));
+}
+
+int64_t NowMs() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+}  // namespace
+
+// =============================================================================
+// ImageFrame
+// =============================================================================
+
+void ImageFrame::Allocate(int w, int h) {
+    width = w;
+    height = h;
+    stride = w * 4;
+    pixels.resize(static_cast<size_t>(stride) * h);
+}
+
+// =============================================================================
+// Codec (WIC)
+// =============================================================================
+
+#ifdef _WIN32
+
+struct ImagePreparer::Codec {
+    CComPtr<IWICImagingFactory> factory;
+    bool comInitialized = false;
+
+    Codec() {
+        comInitialized = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+        if (FAILED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory)))) {
+            LOG_ERROR("[ImagePreparer] WIC factory unavailable");
+        }
+    }
+
+    ~Codec() {
+        factory.Release();
+        if (comInitialized) {
+            CoUninitialize();
+        }
+    }
+
+    /// Decode into frame, scaled down as DecodeSize says for sources too large to hold in full;
+    /// sourceWidth x sourceHeight is the image's own size
+    bool Decode(const uint8_t* data, size_t size, int maxWidth, int maxHeight, ImageFrame& frame,
+                int& sourceWidth, int& sourceHeight) {
+        if (!factory || size > MAXDWORD) return false;
+
+        CComPtr<IWICStream> stream;
+        CComPtr<IWICBitmapDecoder> decoder;
+        CComPtr<IWICBitmapFrameDecode> source;
+        UINT width = 0, height = 0;
+        if (FAILED(factory->CreateStream(&stream)) ||
+            FAILED(stream->InitializeFromMemory(const_cast<BYTE*>(data), static_cast<DWORD>(size))) ||
+            FAILED(factory->CreateDecoderFromStream(stream, nullptr, WICDecodeMetadataCacheOnDemand, &decoder)) ||
+            FAILED(decoder->GetFrame(0, &source)) ||
+            FAILED(source->GetSize(&width, &height)) || width == 0 || height == 0) {
+            return false;
+        }
+        if (static_cast<uint64_t>(width) * height > kMaxSourcePixels) {
+            LOG_ERROR("[ImagePreparer] Refusing " + std::to_string(width) + "x" + std::to_string(height) + " image");
+            return false;
+        }
+        sourceWidth = static_cast<int>(width);
+        sourceHeight = static_cast<int>(height);
+
+        // Too large to hold: the scaler pulls source rows as it needs them, so the full-size
+        // 32-bit bitmap is never allocated here
+        int decodeWidth = 0;
+        int decodeHeight = 0;
+        DecodeSize(sourceWidth, sourceHeight, maxWidth, maxHeight, decodeWidth, decodeHeight);
+        CComPtr<IWICBitmapSource> input(source.p);
+        if (decodeWidth != sourceWidth || decodeHeight != sourceHeight) {
+            CComPtr<IWICBitmapScaler> scaler;
+            if (FAILED(factory->CreateBitmapScaler(&scaler)) ||
+                FAILED(scaler->Initialize(source, decodeWidth, decodeHeight, WICBitmapInterpolationModeFant))) {
+                return false;
+            }
+            input = scaler;
+        }
+
+        CComPtr<IWICFormatConverter> converter;
+        if (FAILED(factory->CreateFormatConverter(&converter)) ||
+            FAILED(converter->Initialize(input, GUID_WICPixelFormat32bppBGR, WICBitmapDitherTypeNone, nullptr, 0.0,
+                                         WICBitmapPaletteTypeCustom)) ||
+            FAILED(converter->GetSize(&width, &height)) || width == 0 || height == 0) {
+            return false;
+        }
+
+        frame.Allocate(static_cast<int>(width), static_cast<int>(height));
+        return SUCCEEDED(converter->CopyPixels(nullptr, frame.stride, static_cast<UINT>(frame.pixels.size()),
+                                               frame.pixels.data()));
+    }
+
+    bool EncodeJpeg(const ImageFrame& frame, int quality, std::vector<uint8_t>& out) {
+        if (!factory) return false;
+
+        CComPtr<IStream> memory;
+        CComPtr<IWICBitmapEncoder> encoder;
+        CComPtr<IWICBitmapFrameEncode> target;
+        CComPtr<IPropertyBag2> properties;
+        CComPtr<IWICBitmap> bitmap;
+        CComPtr<IWICFormatConverter> converter;
+        if (FAILED(CreateStreamOnHGlobal(nullptr, TRUE, &memory)) ||
+            FAILED(factory->CreateEncoder(GUID_ContainerFormatJpeg, nullptr, &encoder)) ||
+            FAILED(encoder->Initialize(memory, WICBitmapEncoderNoCache)) ||
+            FAILED(encoder->CreateNewFrame(&target, &properties))) {
+            return false;
+        }
+
+        PROPBAG2 option = {};
+        option.pstrName = const_cast<LPOLESTR>(L"ImageQuality");
+        VARIANT value;
+        VariantInit(&value);
+        value.vt = VT_R4;
+        value.fltVal = quality / 100.0f;
+        WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+        if (FAILED(properties->Write(1, &option, &value)) ||
+            FAILED(target->Initialize(properties)) ||
+            FAILED(target->SetSize(frame.width, frame.height)) ||
+            FAILED(target->SetPixelFormat(&format)) ||
+            FAILED(factory->CreateBitmapFromMemory(frame.width, frame.height, GUID_WICPixelFormat32bppBGR, frame.stride,
+                                                   static_cast<UINT>(frame.pixels.size()),
+                                                   const_cast<BYTE*>(frame.pixels.data()), &bitmap)) ||
+            FAILED(factory->CreateFormatConverter(&converter)) ||
+            FAILED(converter->Initialize(bitmap, format, WICBitmapDitherTypeNone, nullptr, 0.0,
+                                         WICBitmapPaletteTypeCustom)) ||
+            FAILED(target->WriteSource(converter, nullptr)) ||
+            FAILED(target->Commit()) ||
+            FAILED(encoder->Commit())) {
+            return false;
+        }
+
+        HGLOBAL global = nullptr;
+        if (FAILED(GetHGlobalFromStream(memory, &global))) return false;
+        ULARGE_INTEGER length = {};
+        LARGE_INTEGER zero = {};
+        if (FAILED(memory->Seek(zero, STREAM_SEEK_CUR, &length))) return false;
+
+        const void* bytes = GlobalLock(global);
+        if (!bytes) return false;
+        out.assign(static_cast<const uint8_t*>(bytes), static_cast<const uint8_t*>(bytes) + length.QuadPart);
+        GlobalUnlock(global);
+        return true;
+    }
+};
+
+#else
+
+struct ImagePreparer::Codec {
+    bool Decode(const uint8_t*, size_t, int, int, ImageFrame&, int&, int&) { return false; }
+    bool EncodeJpeg(const ImageFrame&, int, std::vector<uint8_t>&) { return false; }
+};
+
+#endif
+
+// =============================================================================
+// Resampling
+// =============================================================================
+
+void ImagePreparer::FitWithin(int width, int height, int maxWidth, int maxHeight, int& outWidth, int& outHeight) {
+    outWidth = width;
+    outHeight = height;
+    if (width <= 0 || height <= 0) return;
+
+    if (outWidth > maxWidth) {
+        outHeight = static_cast<int>(static_cast<int64_t>(outHeight) * maxWidth / outWidth);
+        outWidth = maxWidth;
+    }
+    if (outHeight > maxHeight) {
+        outWidth = static_cast<int>(static_cast<int64_t>(outWidth) * maxHeight / outHeight);
+        outHeight = maxHeight;
+    }
+    outWidth = (std::max)(outWidth, 1);
+    outHeight = (std::max)(outHeight, 1);
+}
+
+void ImagePreparer::HalveBox(const ImageFrame& src, ImageFrame& dst) {
+    dst.Allocate(src.width / 2, src.height / 2);
+
+    for (int y = 0; y < dst.height; ++y) {
+        const uint8_t* r0 = src.Row(2 * y);
+        const uint8_t* r1 = src.Row(2 * y + 1);
+        uint8_t* out = dst.Row(y);
+        int x = 0;
+
+#ifdef IMAGE_PREPARER_SSE2
+        // 8 source pixels -> 4 output pixels: average the two rows, then even and odd pixels
+        for (; x + 4 <= dst.width; x += 4) {
+            const int i = x * 8;
+            __m128i a = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + i)),
+                                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + i)));
+            __m128i b = _mm_avg_epu8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + i + 16)),
+                                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + i + 16)));
+            __m128 af = _mm_castsi128_ps(a);
+            __m128 bf = _mm_castsi128_ps(b);
+            __m128i even = _mm_castps_si128(_mm_shuffle_ps(af, bf, _MM_SHUFFLE(2, 0, 2, 0)));
+            __m128i odd = _mm_castps_si128(_mm_shuffle_ps(af, bf, _MM_SHUFFLE(3, 1, 3, 1)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), _mm_avg_epu8(even, odd));
+        }
+#endif
+
+        for (; x < dst.width; ++x) {
+            const int i = x * 8;
+            for (int c = 0; c < 4; ++c) {
+                out[x * 4 + c] = static_cast<uint8_t>((r0[i + c] + r0[i + 4 + c] + r1[i + c] + r1[i + 4 + c] + 2) >> 2);
+            }
+        }
+    }
+}
+
+void ImagePreparer::ResizeBilinear(const ImageFrame& src, ImageFrame& dst, int width, int height, ResizeBuffers& buffers) {
+    dst.Allocate(width, height);
+
+    // Column tables: source x and the left/right weights (256 - w, w) laid out for one
+    // 16-bit multiply, pixel centres aligned. The last column is clamped to
+    // (width - 2, w = 255) so two pixels can always be read.
+    std::vector<int32_t>& xTable = buffers.xTable;
+    std::vector<uint16_t>& xWeights = buffers.xWeights;
+    xTable.resize(width);
+    xWeights.resize(static_cast<size_t>(width) * 8);
+    const int64_t xStep = (static_cast<int64_t>(src.width) << 16) / width;
+    for (int x = 0; x < width; ++x) {
+        int64_t fx = (std::max)(int64_t(0), x * xStep + xStep / 2 - 0x8000);
+        int x0 = static_cast<int>(fx >> 16);
+        int w = static_cast<int>((fx >> 8) & 0xFF);
+        if (x0 >= src.width - 1) {
+            x0 = (std::max)(src.width - 2, 0);
+            w = src.width > 1 ? 255 : 0;
+        }
+        xTable[x] = x0;
+        for (int c = 0; c < 4; ++c) {
+            xWeights[8 * x + c] = static_cast<uint16_t>(256 - w);
+            xWeights[8 * x + 4 + c] = static_cast<uint16_t>(w);
+        }
+    }
+
+    std::vector<uint8_t>& row = buffers.row;
+    const int rowBytes = src.width * 4;
+    row.resize(static_cast<size_t>(rowBytes) + 4);  // Room for the second pixel when src.width == 1
+    const int64_t yStep = (static_cast<int64_t>(src.height) << 16) / height;
+
+    for (int y = 0; y < height; ++y) {
+        int64_t fy = (std::max)(int64_t(0), y * yStep + yStep / 2 - 0x8000);
+        int y0 = (std::min)(static_cast<int>(fy >> 16), src.height - 1);
+        int y1 = (std::min)(y0 + 1, src.height - 1);
+        int wy = static_cast<int>((fy >> 8) & 0xFF);
+        const uint8_t* r0 = src.Row(y0);
+        const uint8_t* r1 = src.Row(y1);
+
+        // Vertical pass into the row buffer
+        int i = 0;
+#ifdef IMAGE_PREPARER_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i w0 = _mm_set1_epi16(static_cast<short>(256 - wy));
+        const __m128i w1 = _mm_set1_epi16(static_cast<short>(wy));
+        for (; i + 16 <= rowBytes; i += 16) {
+            __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + i));
+            __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + i));
+            __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0),
+                                       _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+            __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0),
+                                       _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(row.data() + i),
+                             _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+        }
+#endif
+        for (; i < rowBytes; ++i) {
+            row[i] = static_cast<uint8_t>((r0[i] * (256 - wy) + r1[i] * wy) >> 8);
+        }
+        if (src.width == 1) {
+            memcpy(row.data() + 4, row.data(), 4);
+        }
+
+        // Horizontal pass
+        uint8_t* out = dst.Row(y);
+        for (int x = 0; x < width; ++x) {
+            const uint8_t* p = row.data() + xTable[x] * 4;
+            const uint16_t* w = xWeights.data() + 8 * x;
+#ifdef IMAGE_PREPARER_SSE2
+            __m128i px = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), zero);
+            __m128i m = _mm_mullo_epi16(px, _mm_loadu_si128(reinterpret_cast<const __m128i*>(w)));
+            m = _mm_srli_epi16(_mm_add_epi16(m, _mm_srli_si128(m, 8)), 8);
+            int32_t pixel = _mm_cvtsi128_si32(_mm_packus_epi16(m, m));
+            memcpy(out + x * 4, &pixel, 4);
+#else
+            for (int c = 0; c < 4; ++c) {
+                out[x * 4 + c] = static_cast<uint8_t>((p[c] * w[0] + p[4 + c] * w[4]) >> 8);
+            }
+#endif
+        }
+    }
+}
+
+void ImagePreparer::Resize(const ImageFrame& src, ImageFrame& dst, int width, int height, ResizeBuffers& buffers) {
+    // Box reductions are exact area averages, so they are used for as long as they don't overshoot
+    const ImageFrame* current = &src;
+    int next = 0;
+    while (current->width >= 2 * width && current->height >= 2 * height) {
+        HalveBox(*current, buffers.halves[next]);
+        current = &buffers.halves[next];
+        next ^= 1;
+    }
+    if (current->width == width && current->height == height) {
+        dst.Allocate(width, height);
+        memcpy(dst.pixels.data(), current->pixels.data(), dst.pixels.size());
+        return;
+    }
+    ResizeBilinear(*current, dst, width, height, buffers);
+}
+
+// =============================================================================
+// ImagePreparer
+// =============================================================================
+
+ImagePreparer::ImagePreparer()
+    : m_stopRequested(false)
+    , m_codec(nullptr) {
+}
+
+ImagePreparer::~ImagePreparer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = true;
+    }
+    m_cv.notify_one();
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+}
+
+void ImagePreparer::Prepare(std::vector<uint8_t> encoded, const Options& options, Completion completion) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopRequested) {
+            return;
+        }
+        m_jobs.push_back(Job{ std::move(encoded), options, std::move(completion) });
+        if (!m_worker.joinable()) {
+            m_worker = std::thread(&ImagePreparer::WorkerLoop, this);
+        }
+    }
+    m_cv.notify_one();
+}
+
+void ImagePreparer::WorkerLoop() {
+    // The codec lives on this thread (COM apartment, WIC factory)
+    Codec codec;
+    m_codec = &codec;
+
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return m_stopRequested || !m_jobs.empty(); });
+            if (m_stopRequested) {
+                break;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+        }
+
+        std::vector<uint8_t> jpeg;
+        Result result;
+        int64_t startMs = NowMs();
+        bool ok = false;
+        try {
+            ok = Process(job, jpeg, result);
+        } catch (const std::bad_alloc&) {
+            // A buffer for an image this size could not be had; the next image may well fit
+            LOG_ERROR("[ImagePreparer] Out of memory preparing " + std::to_string(result.sourceWidth) + "x" +
+                      std::to_string(result.sourceHeight) + " image");
+        } catch (const std::exception& e) {
+            LOG_ERROR("[ImagePreparer] Exception preparing image: " + std::string(e.what()));
+        }
+        result.elapsedMs = NowMs() - startMs;
+
+        if (ok) {
+            LOG_INFO("[ImagePreparer] " + std::to_string(result.sourceWidth) + "x" + std::to_string(result.sourceHeight) +
+                     " -> " + std::to_string(result.width) + "x" + std::to_string(result.height) +
+                     " q=" + std::to_string(result.quality) + ", " + std::to_string(result.bytes) + " bytes, " +
+                     std::to_string(result.encodes) + " encodes, " + std::to_string(result.elapsedMs) + " ms");
+        } else {
+            jpeg.clear();
+            LOG_ERROR("[ImagePreparer] Cannot prepare image of " + std::to_string(job.encoded.size()) + " bytes");
+        }
+        if (job.completion) {
+            job.completion(ok, std::move(jpeg), result);
+        }
+    }
+
+    m_codec = nullptr;
+}
+
+bool ImagePreparer::Process(const Job& job, std::vector<uint8_t>& jpeg, Result& result) {
+    const Options& options = job.options;
+    if (!m_codec->Decode(job.encoded.data(), job.encoded.size(), options.maxWidth, options.maxHeight, m_decoded,
+                         result.sourceWidth, result.sourceHeight)) {
+        return false;
+    }
+
+    int width = 0;
+    int height = 0;
+    FitWithin(m_decoded.width, m_decoded.height, options.maxWidth, options.maxHeight, width, height);
+    const int minQuality = (std::max)(1, (std::min)(options.minQuality, 100));
+    const int maxQuality = (std::max)(minQuality, (std::min)(options.maxQuality, 100));
+
+    for (int round = 0; round <= kMaxShrinkRounds; ++round) {
+        const ImageFrame* frame = &m_decoded;
+        if (width != m_decoded.width || height != m_decoded.height) {
+            Resize(m_decoded, m_scaled, width, height, m_resizeBuffers);
+            frame = &m_scaled;
+        }
+
+        // Highest quality that fits: try the top first (small images usually fit), then bisect
+        int low = minQuality;
+        int high = maxQuality;
+        int best = 0;
+        while (low <= high) {
+            int quality = (best == 0 && low == minQuality && high == maxQuality) ? maxQuality : (low + high) / 2;
+            if (!m_codec->EncodeJpeg(*frame, quality, m_encoded)) {
+                return false;
+            }
+            ++result.encodes;
+            if (m_encoded.size() <= options.maxBytes) {
+                best = quality;
+                jpeg.swap(m_encoded);
+                low = quality + 1;
+            } else {
+                high = quality - 1;
+            }
+        }
+
+        if (best > 0) {
+            result.width = width;
+            result.height = height;
+            result.quality = best;
+            result.bytes = jpeg.size();
+            return true;
+        }
+
+        // Even the lowest quality is over budget: lose resolution instead
+        if (width <= 16 || height <= 16) {
+            break;
+        }
+        width = width * 3 / 4;
+        height = height * 3 / 4;
+    }
+    return false;
+}
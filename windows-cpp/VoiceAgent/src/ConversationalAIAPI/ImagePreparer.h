@@ -0,0 +1,124 @@
+//
+// ImagePreparer.h: Downscale and JPEG re-encode images to fit the image message budget
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+/// 32-bit BGRX pixels, rows of stride bytes
+struct ImageFrame {
+    std::vector<uint8_t> pixels;
+    int width;
+    int height;
+    int stride;
+
+    ImageFrame() : width(0), height(0), stride(0) {}
+
+    /// Resize the frame, keeping the pixel buffer's capacity for the next image
+    void Allocate(int w, int h);
+    uint8_t* Row(int y) { return pixels.data() + static_cast<size_t>(y) * stride; }
+    const uint8_t* Row(int y) const { return pixels.data() + static_cast<size_t>(y) * stride; }
+};
+
+/// Intermediate buffers for ImagePreparer::Resize, reused across calls
+struct ResizeBuffers {
+    ImageFrame halves[2];         // Ping-pong targets of the 2x box reductions
+    std::vector<uint8_t> row;     // Vertically blended source row
+    std::vector<int32_t> xTable;  // Per output column: source x
+    std::vector<uint16_t> xWeights;  // Per output column: left weight x4, right weight x4
+};
+
+/// Turns an arbitrary image file (screenshot PNG, photo JPEG, ...) into a JPEG that fits a byte budget
+///
+/// The image is decoded, shrunk to fit maxWidth x maxHeight (2x box reductions while the
+/// image is at least twice too large, then one bilinear pass), and encoded at the highest
+/// JPEG quality in [minQuality, maxQuality] whose output fits maxBytes, found by binary
+/// search. If even minQuality is too large the image is shrunk further and searched again.
+///
+/// Work runs on one worker thread that owns the codec and every intermediate buffer, so
+/// after the first image no per-image allocations are made apart from the returned JPEG.
+/// Sources over 16M pixels are scaled down while decoding, and absurdly large ones refused,
+/// so a hostile or huge file fails its completion instead of exhausting memory.
+/// Decoding and encoding use WIC and are only available on Windows.
+class ImagePreparer {
+public:
+    // Raw bytes that still fit one RTM message once base64 encoded inside the image JSON
+    static const size_t DEFAULT_MAX_BYTES = 22 * 1024;
+
+    struct Options {
+        int maxWidth;
+        int maxHeight;
+        size_t maxBytes;
+        int minQuality;  // 1-100
+        int maxQuality;
+
+        Options() : maxWidth(1280), maxHeight(1280), maxBytes(DEFAULT_MAX_BYTES), minQuality(30), maxQuality(90) {}
+    };
+
+    struct Result {
+        int sourceWidth;
+        int sourceHeight;
+        int width;
+        int height;
+        int quality;
+        int encodes;        // JPEG encodes tried
+        size_t bytes;
+        int64_t elapsedMs;
+
+        Result() : sourceWidth(0), sourceHeight(0), width(0), height(0), quality(0), encodes(0), bytes(0), elapsedMs(0) {}
+    };
+
+    /// Runs on the worker thread; jpeg is empty on failure
+    using Completion = std::function<void(bool success, std::vector<uint8_t> jpeg, const Result& result)>;
+
+    ImagePreparer();
+    ~ImagePreparer();
+
+    ImagePreparer(const ImagePreparer&) = delete;
+    ImagePreparer& operator=(const ImagePreparer&) = delete;
+
+    /// Queue an encoded image (any format the platform codec reads) for preparation
+    void Prepare(std::vector<uint8_t> encoded, const Options& options, Completion completion);
+
+    /// Resample src into dst at width x height
+    /// Box filter (repeated 2x2 averaging) while dst is at most half of src, then bilinear
+    static void Resize(const ImageFrame& src, ImageFrame& dst, int width, int height, ResizeBuffers& buffers);
+
+    /// Largest size with src's aspect ratio that fits maxWidth x maxHeight (never upscales)
+    static void FitWithin(int width, int height, int maxWidth, int maxHeight, int& outWidth, int& outHeight);
+
+private:
+    struct Job {
+        std::vector<uint8_t> encoded;
+        Options options;
+        Completion completion;
+    };
+    struct Codec;
+
+    void WorkerLoop();
+    bool Process(const Job& job, std::vector<uint8_t>& jpeg, Result& result);
+
+    static void HalveBox(const ImageFrame& src, ImageFrame& dst);
+    static void ResizeBilinear(const ImageFrame& src, ImageFrame& dst, int width, int height, ResizeBuffers& buffers);
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<Job> m_jobs;
+    bool m_stopRequested;
+    std::thread m_worker;
+
+    // Worker-thread state
+    Codec* m_codec;
+    ImageFrame m_decoded;
+    ImageFrame m_scaled;
+    ResizeBuffers m_resizeBuffers;
+    std::vector<uint8_t> m_encoded;
+};
@@ -0,0 +1,269 @@
+//
+// ImagePreparerBenchmark.cpp: Times ImagePreparer on a 4K screenshot
+//
+
+#include "../general/pch.h"
+#include "ImagePreparerBenchmark.h"
+#include "ImagePreparer.h"
+#include "../tools/BenchmarkUtils.h"
+#include "../tools/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <sstream>
+
+#ifdef _WIN32
+#include <atlbase.h>
+#include <wincodec.h>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+void FillRect(ImageFrame& frame, int x0, int y0, int width, int height, uint8_t b, uint8_t g, uint8_t r) {
+    int x1 = (std::min)(frame.width, x0 + width);
+    int y1 = (std::min)(frame.height, y0 + height);
+    for (int y = (std::max)(0, y0); y < y1; ++y) {
+        uint8_t* row = frame.Row(y);
+        for (int x = (std::max)(0, x0); x < x1; ++x) {
+            row[x * 4] = b;
+            row[x * 4 + 1] = g;
+            row[x * 4 + 2] = r;
+            row[x * 4 + 3] = 0xFF;
+        }
+    }
+}
+
+/// Something that compresses like a real desktop capture: flat chrome, lots of small text
+/// (the hard part for JPEG) and one photo
+void PaintScreenshot(ImageFrame& frame, int width, int height) {
+    std::mt19937 rng(42);
+    frame.Allocate(width, height);
+
+    // Wallpaper gradient and taskbar
+    for (int y = 0; y < height; ++y) {
+        uint8_t* row = frame.Row(y);
+        uint8_t shade = static_cast<uint8_t>(90 + y * 80 / height);
+        for (int x = 0; x < width; ++x) {
+            row[x * 4] = shade;
+            row[x * 4 + 1] = static_cast<uint8_t>(60 + x * 40 / width);
+            row[x * 4 + 2] = 40;
+            row[x * 4 + 3] = 0xFF;
+        }
+    }
+    int taskbar = (std::max)(8, height / 45);
+    FillRect(frame, 0, height - taskbar, width, taskbar, 40, 32, 32);
+
+    // Overlapping windows: title bar, white client area, lines of "words"
+    const int scale = (std::max)(1, height / 1080);
+    const int lineHeight = 22 * scale;
+    const int glyphHeight = 12 * scale;
+    for (int window = 0; window < 5; ++window) {
+        int w = width * (35 + (int)(rng() % 30)) / 100;
+        int h = height * (35 + (int)(rng() % 30)) / 100;
+        int x0 = (int)(rng() % (unsigned)(std::max)(1, width - w));
+        int y0 = (int)(rng() % (unsigned)(std::max)(1, height - taskbar - h));
+        int title = 32 * scale;
+        FillRect(frame, x0, y0, w, title, 200, 150, 90);
+        FillRect(frame, x0, y0 + title, w, h - title, 250, 250, 250);
+
+        for (int line = y0 + title + lineHeight; line + glyphHeight < y0 + h; line += lineHeight) {
+            int x = x0 + 16 * scale;
+            int end = x0 + w - 16 * scale - (int)(rng() % (unsigned)(std::max)(1, w / 3));
+            while (x < end) {
+                int word = (int)(10 + rng() % 60) * scale;
+                for (int y = line; y < line + glyphHeight; ++y) {
+                    uint8_t* row = frame.Row(y);
+                    for (int gx = x; gx < (std::min)(x + word, end); ++gx) {
+                        // Glyph strokes: dark pixels in a dense, irregular pattern
+                        if ((rng() & 3) != 0) continue;
+                        row[gx * 4] = row[gx * 4 + 1] = row[gx * 4 + 2] = static_cast<uint8_t>(rng() % 80);
+                    }
+                }
+                x += word + 6 * scale;
+            }
+        }
+
+        if (window == 2) {
+            // A photo in the window: smooth gradients plus sensor noise
+            int pw = w / 2;
+            int ph = (h - title) / 2;
+            for (int y = 0; y < ph && y0 + title + 8 + y < height; ++y) {
+                uint8_t* row = frame.Row(y0 + title + 8 + y);
+                for (int x = 0; x < pw && x0 + 8 + x < width; ++x) {
+                    int noise = (int)(rng() % 17) - 8;
+                    int px = (x0 + 8 + x) * 4;
+                    row[px] = static_cast<uint8_t>((std::max)(0, (std::min)(255, 60 + x * 120 / pw + noise)));
+                    row[px + 1] = static_cast<uint8_t>((std::max)(0, (std::min)(255, 140 + y * 80 / ph + noise)));
+                    row[px + 2] = static_cast<uint8_t>((std::max)(0, (std::min)(255, 200 - (x + y) * 100 / (pw + ph) + noise)));
+                }
+            }
+        }
+    }
+}
+
+#ifdef _WIN32
+
+/// The screenshot as the PNG a screen capture would produce
+bool EncodePng(const ImageFrame& frame, std::vector<uint8_t>& out) {
+    bool comInitialized = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+    bool ok = false;
+    {
+        CComPtr<IWICImagingFactory> factory;
+        CComPtr<IStream> memory;
+        CComPtr<IWICBitmapEncoder> encoder;
+        CComPtr<IWICBitmapFrameEncode> target;
+        CComPtr<IWICBitmap> bitmap;
+        CComPtr<IWICFormatConverter> converter;
+        WICPixelFormatGUID format = GUID_WICPixelFormat24bppBGR;
+        HGLOBAL global = nullptr;
+        ULARGE_INTEGER length = {};
+        LARGE_INTEGER zero = {};
+        if (SUCCEEDED(CoCreateInstance(CLSID_WICImagingFactory, nullptr, CLSCTX_INPROC_SERVER, IID_PPV_ARGS(&factory))) &&
+            SUCCEEDED(CreateStreamOnHGlobal(nullptr, TRUE, &memory)) &&
+            SUCCEEDED(factory->CreateEncoder(GUID_ContainerFormatPng, nullptr, &encoder)) &&
+            SUCCEEDED(encoder->Initialize(memory, WICBitmapEncoderNoCache)) &&
+            SUCCEEDED(encoder->CreateNewFrame(&target, nullptr)) &&
+            SUCCEEDED(target->Initialize(nullptr)) &&
+            SUCCEEDED(target->SetSize(frame.width, frame.height)) &&
+            SUCCEEDED(target->SetPixelFormat(&format)) &&
+            SUCCEEDED(factory->CreateBitmapFromMemory(frame.width, frame.height, GUID_WICPixelFormat32bppBGR, frame.stride,
+                                                      static_cast<UINT>(frame.pixels.size()),
+                                                      const_cast<BYTE*>(frame.pixels.data()), &bitmap)) &&
+            SUCCEEDED(factory->CreateFormatConverter(&converter)) &&
+            SUCCEEDED(converter->Initialize(bitmap, format, WICBitmapDitherTypeNone, nullptr, 0.0,
+                                            WICBitmapPaletteTypeCustom)) &&
+            SUCCEEDED(target->WriteSource(converter, nullptr)) &&
+            SUCCEEDED(target->Commit()) &&
+            SUCCEEDED(encoder->Commit()) &&
+            SUCCEEDED(GetHGlobalFromStream(memory, &global)) &&
+            SUCCEEDED(memory->Seek(zero, STREAM_SEEK_CUR, &length))) {
+            const void* bytes = GlobalLock(global);
+            if (bytes) {
+                out.assign(static_cast<const uint8_t*>(bytes), static_cast<const uint8_t*>(bytes) + length.QuadPart);
+                GlobalUnlock(global);
+                ok = true;
+            }
+        }
+    }
+    if (comInitialized) {
+        CoUninitialize();
+    }
+    return ok;
+}
+
+#else
+
+bool EncodePng(const ImageFrame&, std::vector<uint8_t>&) {
+    return false;
+}
+
+#endif
+
+struct PrepareRun {
+    bool success = false;
+    ImagePreparer::Result result;
+    double ms = 0;
+};
+
+}  // namespace
+
+bool ImagePreparerBenchmark::RunFromCommandLine(const std::string& commandLine) {
+    CommandLineArgs args(commandLine);
+    if (!args.Has("/benchimage")) {
+        return false;
+    }
+    int runs = (std::max)(1, (int)args.Number("runs", 20));
+    int width = (std::max)(16, (std::min)(16384, (int)args.Number("width", 3840)));
+    int height = (std::max)(16, (std::min)(16384, (int)args.Number("height", 2160)));
+    std::string file = args.Text("file");
+
+    ImageFrame screenshot;
+    PaintScreenshot(screenshot, width, height);
+    ImagePreparer::Options options;
+    int targetWidth = 0;
+    int targetHeight = 0;
+    ImagePreparer::FitWithin(width, height, options.maxWidth, options.maxHeight, targetWidth, targetHeight);
+
+    // Resize alone, buffers reused as on the preparer's worker; the first run only warms them up
+    ImageFrame scaled;
+    ResizeBuffers buffers;
+    std::vector<double> resize;
+    for (int run = 0; run <= runs; ++run) {
+        Clock::time_point start = Clock::now();
+        ImagePreparer::Resize(screenshot, scaled, targetWidth, targetHeight, buffers);
+        if (run > 0) {
+            resize.push_back(MillisecondsSince(start));
+        }
+    }
+    LatencySummary resizeLatency = LatencySummary::Of(resize);
+    std::ostringstream line;
+    line.setf(std::ios::fixed);
+    line.precision(0);
+    line << "[ImagePreparerBenchmark] " << width << "x" << height << " -> " << targetWidth << "x" << targetHeight << ", "
+         << resizeLatency.Format("resize", 2) << ", "
+         << (resizeLatency.p50 > 0 ? width * (double)height / 1000.0 / resizeLatency.p50 : 0) << " Mpixel/s";
+    LOG_INFO(line.str());
+
+    std::vector<uint8_t> encoded;
+    if (!file.empty()) {
+        std::ifstream in(file, std::ios::binary);
+        encoded.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        if (encoded.empty()) {
+            LOG_ERROR("[ImagePreparerBenchmark] Cannot read " + file);
+            return true;
+        }
+    } else if (!EncodePng(screenshot, encoded)) {
+        LOG_WARN("[ImagePreparerBenchmark] No image codec on this platform: only resize was timed");
+        return true;
+    }
+
+    // The whole pipeline, one image at a time as the app submits them
+    ImagePreparer preparer;
+    std::vector<double> prepare;
+    PrepareRun last;
+    ImagePreparer::Result result;
+    int failures = 0;
+    for (int run = 0; run <= runs; ++run) {
+        auto promise = std::make_shared<std::promise<PrepareRun>>();
+        std::future<PrepareRun> future = promise->get_future();
+        Clock::time_point start = Clock::now();
+        preparer.Prepare(encoded, options,
+            [promise, start](bool success, std::vector<uint8_t>, const ImagePreparer::Result& result) {
+                PrepareRun done;
+                done.success = success;
+                done.result = result;
+                done.ms = MillisecondsSince(start);
+                promise->set_value(done);
+            });
+        last = future.get();
+        if (!last.success) {
+            ++failures;
+            continue;
+        }
+        result = last.result;
+        if (run > 0) {
+            prepare.push_back(last.ms);
+        }
+    }
+    if (prepare.empty()) {
+        LOG_ERROR("[ImagePreparerBenchmark] Prepare failed on every run (" + std::to_string(encoded.size()) +
+                  " byte input)");
+        return true;
+    }
+
+    LatencySummary prepareLatency = LatencySummary::Of(prepare);
+    LOG_INFO("[ImagePreparerBenchmark] " + std::string(file.empty() ? "PNG " : file + ", ") +
+             std::to_string(encoded.size()) + " bytes -> " + std::to_string(result.width) + "x" +
+             std::to_string(result.height) + " q=" + std::to_string(result.quality) + ", " +
+             std::to_string(result.bytes) + " bytes, " + std::to_string(result.encodes) + " encodes");
+    LOG_INFO("[ImagePreparerBenchmark] " + prepareLatency.Format("prepare", 1) + ", failures=" +
+             std::to_string(failures));
+    return true;
+}
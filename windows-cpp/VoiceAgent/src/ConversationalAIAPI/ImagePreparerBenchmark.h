@@ -0,0 +1,19 @@
+//
+// ImagePreparerBenchmark.h: Times ImagePreparer on a 4K screenshot
+//
+#pragma once
+
+#include <string>
+
+/// Runs "/benchimage [runs=N] [width=W] [height=H] [file=PATH]" and logs the report
+///
+/// A synthetic screenshot (desktop, windows with text, a photo) of width x height, 3840x2160 by
+/// default, is resized to the default Options bounds runs times; that stage is timed on every
+/// platform. The whole Prepare() pipeline (decode, resize, JPEG quality search) is then timed on
+/// the same screenshot encoded as PNG, or on the image in file. Decoding and encoding need WIC,
+/// so off Windows only the resize stage is reported.
+class ImagePreparerBenchmark {
+public:
+    /// Returns false, doing nothing, for other command lines
+    static bool RunFromCommandLine(const std::string& commandLine);
+};
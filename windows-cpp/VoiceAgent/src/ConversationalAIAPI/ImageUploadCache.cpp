@@ -0,0 +1,278 @@
+//
+// ImageUploadCache.cpp: Content-addressed cache of recently sent images
+//
+
+#include "../general/pch.h"
+#include "ImageUploadCache.h"
+#include "../tools/Logger.h"
+
+#include <nlohmann/json.hpp>
+#include <cstring>
+#include <iterator>
+#include <sstream>
+
+namespace {
+
+// XXH64 (https://github.com/Cyan4973/xxHash), reference algorithm
+const uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+inline uint64_t Rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t Read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;  // Little-endian targets only
+}
+
+inline uint32_t Read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline uint64_t Round(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    acc = Rotl(acc, 31);
+    return acc * kPrime1;
+}
+
+inline uint64_t MergeRound(uint64_t acc, uint64_t value) {
+    acc ^= Round(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+
+uint64_t Xxh64(const uint8_t* p, size_t len, uint64_t seed) {
+    const uint8_t* const end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        const uint8_t* const limit = end - 32;
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+        do {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+        h = MergeRound(h, v1);
+        h = MergeRound(h, v2);
+        h = MergeRound(h, v3);
+        h = MergeRound(h, v4);
+    } else {
+        h = seed + kPrime5;
+    }
+
+    h += static_cast<uint64_t>(len);
+    while (p + 8 <= end) {
+        h ^= Round(0, Read64(p));
+        h = Rotl(h, 27) * kPrime1 + kPrime4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= static_cast<uint64_t>(Read32(p)) * kPrime1;
+        h = Rotl(h, 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * kPrime5;
+        h = Rotl(h, 11) * kPrime1;
+        ++p;
+    }
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+/// URL the agent reports for a stored image, if any
+std::string ReceiptImageUrl(const std::string& message) {
+    nlohmann::json details = nlohmann::json::parse(message, nullptr, false);
+    if (!details.is_object()) {
+        return "";
+    }
+    for (const char* key : { "image_url", "url" }) {
+        auto it = details.find(key);
+        if (it != details.end() && it->is_string()) {
+            return it->get<std::string>();
+        }
+    }
+    if (details.value("source_type", std::string()) == "url") {
+        return details.value("source_value", std::string());
+    }
+    return "";
+}
+
+}  // namespace
+
+ImageUploadCache::ImageUploadCache(size_t maxEntries, size_t maxBytes)
+    : m_maxEntries(maxEntries)
+    , m_maxBytes(maxBytes)
+    , m_cachedBytes(0)
+    , m_lookups(0)
+    , m_urlHits(0)
+    , m_preparedHits(0)
+    , m_urlBytesSaved(0) {
+}
+
+uint64_t ImageUploadCache::Hash(const void* data, size_t size) {
+    return Xxh64(static_cast<const uint8_t*>(data), size, 0);
+}
+
+ImageUploadCache::Hit ImageUploadCache::Lookup(uint64_t hash) {
+    Hit hit;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_lookups;
+
+    auto it = m_byHash.find(hash);
+    if (it == m_byHash.end()) {
+        return hit;
+    }
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    const Entry& entry = *it->second;
+
+    if (!entry.imageUrl.empty()) {
+        hit.kind = HitKind::Url;
+        hit.imageUrl = entry.imageUrl;
+        ++m_urlHits;
+        // Base64 of the JPEG that doesn't have to go out again
+        m_urlBytesSaved += (entry.prepared.size() + 2) / 3 * 4;
+    } else if (!entry.prepared.empty()) {
+        hit.kind = HitKind::Prepared;
+        hit.prepared = entry.prepared;
+        ++m_preparedHits;
+    }
+    return hit;
+}
+
+void ImageUploadCache::Store(uint64_t hash, const std::string& uuid, const std::vector<uint8_t>& prepared) {
+    if (prepared.size() > m_maxBytes) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_byHash.find(hash);
+    if (it != m_byHash.end()) {
+        EraseLocked(it->second);
+    }
+
+    m_entries.push_front(Entry{ hash, uuid, std::string(), prepared });
+    m_byHash[hash] = m_entries.begin();
+    m_byUuid[uuid] = hash;
+    m_cachedBytes += prepared.size();
+    EvictLocked();
+}
+
+void ImageUploadCache::Alias(uint64_t hash, const std::string& uuid) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_byHash.count(hash)) {
+        m_byUuid[uuid] = hash;
+    }
+}
+
+void ImageUploadCache::OnMessageReceiptUpdated(const std::string&, const MessageReceipt& receipt) {
+    if (receipt.type != ChatMessageType::Image || receipt.uuid.empty()) {
+        return;
+    }
+    std::string url = ReceiptImageUrl(receipt.message);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto uuidIt = m_byUuid.find(receipt.uuid);
+    if (uuidIt == m_byUuid.end()) {
+        return;
+    }
+    auto it = m_byHash.find(uuidIt->second);
+    m_byUuid.erase(uuidIt);
+    if (it == m_byHash.end()) {
+        return;
+    }
+
+    if (!url.empty()) {
+        it->second->imageUrl = url;
+    }
+}
+
+void ImageUploadCache::OnMessageError(const std::string&, const MessageError& error) {
+    if (error.type != ChatMessageType::Image || error.uuid.empty()) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto uuidIt = m_byUuid.find(error.uuid);
+    if (uuidIt == m_byUuid.end()) {
+        return;
+    }
+    auto it = m_byHash.find(uuidIt->second);
+    m_byUuid.erase(uuidIt);
+    if (it != m_byHash.end()) {
+        // Whatever was sent didn't work; the next send starts from scratch
+        LOG_INFO("[ImageUploadCache] Dropping rejected image " + error.uuid);
+        EraseLocked(it->second);
+    }
+}
+
+void ImageUploadCache::EvictLocked() {
+    while (!m_entries.empty() && (m_entries.size() > m_maxEntries || m_cachedBytes > m_maxBytes)) {
+        EraseLocked(std::prev(m_entries.end()));
+    }
+}
+
+void ImageUploadCache::EraseLocked(EntryList::iterator it) {
+    m_cachedBytes -= it->prepared.size();
+    m_byHash.erase(it->hash);
+    // Receipts still in flight for this image have nothing left to update
+    for (auto uuidIt = m_byUuid.begin(); uuidIt != m_byUuid.end();) {
+        if (uuidIt->second == it->hash) {
+            uuidIt = m_byUuid.erase(uuidIt);
+        } else {
+            ++uuidIt;
+        }
+    }
+    m_entries.erase(it);
+}
+
+ImageUploadCache::Stats ImageUploadCache::GetStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats;
+    stats.lookups = m_lookups;
+    stats.urlHits = m_urlHits;
+    stats.preparedHits = m_preparedHits;
+    stats.urlBytesSaved = m_urlBytesSaved;
+    stats.entries = m_entries.size();
+    stats.cachedBytes = m_cachedBytes;
+    return stats;
+}
+
+void ImageUploadCache::LogStats() const {
+    Stats stats = GetStats();
+    std::ostringstream oss;
+    oss << "[ImageUploadCache] lookups=" << stats.lookups << " hitRate=" << static_cast<int>(stats.HitRate() * 100)
+        << "% urlHits=" << stats.urlHits << " preparedHits=" << stats.preparedHits
+        << " urlBytesSaved=" << stats.urlBytesSaved << " entries=" << stats.entries << " cachedBytes=" << stats.cachedBytes;
+    LOG_INFO(oss.str());
+}
+
+void ImageUploadCache::Clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.clear();
+    m_byHash.clear();
+    m_byUuid.clear();
+    m_cachedBytes = 0;
+    m_lookups = 0;
+    m_urlHits = 0;
+    m_preparedHits = 0;
+    m_urlBytesSaved = 0;
+}
@@ -0,0 +1,104 @@
+//
+// ImageUploadCache.h: Content-addressed cache of recently sent images
+//
+#pragma once
+
+#include "ConversationalAIAPI.h"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+/// Remembers recently sent images by a hash of their source bytes
+///
+/// For each image it keeps the uuid of the last upload, the prepared JPEG that was sent,
+/// and whatever the agent's message.info receipt said about it. A repeat send can then:
+///  - go out as a small image_url message, when the receipt gave a URL for the image
+///  - reuse the prepared JPEG, skipping decode, resize and re-encode, otherwise
+/// The prepared JPEG is reused before any receipt arrives, since it only saves local work; an
+/// upload the agent rejected (message.error) is forgotten.
+///
+/// Register it with ConversationalAIAPI::AddHandler() so it sees receipts.
+class ImageUploadCache : public IConversationalAIAPIEventHandler {
+public:
+    static const size_t DEFAULT_MAX_ENTRIES = 32;
+    static const size_t DEFAULT_MAX_BYTES = 4 * 1024 * 1024;  // Prepared JPEGs kept in memory
+
+    enum class HitKind {
+        Miss,
+        Url,       // Send imageUrl instead of the image
+        Prepared   // Send the cached JPEG as is
+    };
+
+    struct Hit {
+        HitKind kind;
+        std::string imageUrl;
+        std::vector<uint8_t> prepared;
+
+        Hit() : kind(HitKind::Miss) {}
+    };
+
+    struct Stats {
+        uint64_t lookups;
+        uint64_t urlHits;
+        uint64_t preparedHits;
+        uint64_t urlBytesSaved;   // Image payload bytes not sent thanks to URL hits (prepared hits still send theirs)
+        size_t entries;
+        size_t cachedBytes;
+
+        double HitRate() const { return lookups ? double(urlHits + preparedHits) / lookups : 0.0; }
+    };
+
+    explicit ImageUploadCache(size_t maxEntries = DEFAULT_MAX_ENTRIES, size_t maxBytes = DEFAULT_MAX_BYTES);
+
+    /// 64-bit content hash (XXH64, seed 0)
+    static uint64_t Hash(const void* data, size_t size);
+
+    /// Look up an image by content hash; counts towards the hit rate
+    Hit Lookup(uint64_t hash);
+
+    /// Remember an upload of the image with this hash (prepared is what SendImage() got)
+    void Store(uint64_t hash, const std::string& uuid, const std::vector<uint8_t>& prepared);
+
+    /// Tie a URL resend to the cached image so its receipt is recognised too
+    void Alias(uint64_t hash, const std::string& uuid);
+
+    Stats GetStats() const;
+    void LogStats() const;
+    void Clear();
+
+    // IConversationalAIAPIEventHandler
+    void OnAgentStateChanged(const std::string&, const StateChangeEvent&) override {}
+    void OnTranscriptUpdated(const std::string&, const Transcript&) override {}
+    void OnMessageReceiptUpdated(const std::string& agentUserId, const MessageReceipt& receipt) override;
+    void OnMessageError(const std::string& agentUserId, const MessageError& error) override;
+
+private:
+    struct Entry {
+        uint64_t hash;
+        std::string uuid;
+        std::string imageUrl;           // From the receipt, empty until one with a URL arrives
+        std::vector<uint8_t> prepared;
+    };
+    using EntryList = std::list<Entry>;
+
+    void EvictLocked();
+    void EraseLocked(EntryList::iterator it);
+
+    mutable std::mutex m_mutex;
+    EntryList m_entries;  // Most recently used first
+    std::unordered_map<uint64_t, EntryList::iterator> m_byHash;
+    std::unordered_map<std::string, uint64_t> m_byUuid;
+    size_t m_maxEntries;
+    size_t m_maxBytes;
+    size_t m_cachedBytes;
+
+    uint64_t m_lookups;
+    uint64_t m_urlHits;
+    uint64_t m_preparedHits;
+    uint64_t m_urlBytesSaved;
+};
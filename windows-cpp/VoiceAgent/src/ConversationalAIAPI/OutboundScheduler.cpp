@@ -0,0 +1,284 @@
+//
+// OutboundScheduler.cpp: Priority lanes, rate limiting and coalescing for outbound RTM messages
+//
+
+#include "../general/pch.h"
+#include "OutboundScheduler.h"
+#include "../tools/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+int64_t NowUs() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::microseconds>(now).count();
+}
+
+const char* LaneName(int lane) {
+    static const char* const names[OutboundScheduler::LANE_COUNT] = { "interrupt", "high", "chat", "bulk" };
+    return names[lane];
+}
+
+}  // namespace
+
+OutboundScheduler::OutboundScheduler(PublishFunction publish, const Config& config)
+    : m_publish(std::move(publish))
+    , m_config(config)
+    , m_tokens(config.burst)
+    , m_lastRefillUs(NowUs())
+    , m_stopRequested(false) {
+}
+
+OutboundScheduler::~OutboundScheduler() {
+    Shutdown();
+}
+
+void OutboundScheduler::RefillLocked(int64_t nowUs) {
+    double elapsed = (nowUs - m_lastRefillUs) / 1e6;
+    m_lastRefillUs = nowUs;
+    m_tokens = (std::min)(m_config.burst, m_tokens + elapsed * m_config.messagesPerSecond);
+}
+
+bool OutboundScheduler::TakeTokenLocked(int lane) {
+    // Interrupts overdraw the bucket rather than wait; everything after them pays it back
+    if (m_tokens < 1.0 && lane != static_cast<int>(OutboundLane::Interrupt)) {
+        return false;
+    }
+    m_tokens -= 1.0;
+    return true;
+}
+
+bool OutboundScheduler::UpdateCongestionLocked(int lane) {
+    Lane& state = m_lanes[lane];
+    size_t capacity = m_config.laneCapacity[lane];
+    size_t depth = state.queue.size();
+    if (!state.congested && depth >= capacity * 3 / 4 && depth > 0) {
+        state.congested = true;
+        return true;
+    }
+    if (state.congested && depth <= capacity / 4) {
+        state.congested = false;
+        return true;
+    }
+    return false;
+}
+
+void OutboundScheduler::NotifyCongestion(int lane, bool congested) {
+    LOG_INFO(std::string("[OutboundScheduler] lane ") + LaneName(lane) + (congested ? " congested" : " drained"));
+    BackpressureHandler handler;
+    {
+        std::lock_guard<std::mutex> lock(m_handlerMutex);
+        handler = m_backpressureHandler;
+    }
+    if (handler) {
+        handler(static_cast<OutboundLane>(lane), congested);
+    }
+}
+
+EnqueueResult OutboundScheduler::Enqueue(OutboundLane laneId, Message message) {
+    const int lane = static_cast<int>(laneId);
+    Completion dropped;
+    int droppedError = 0;
+    EnqueueResult result = EnqueueResult::Queued;
+    bool congestionChanged = false;
+    bool congested = false;
+    Pending inline_;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Lane& state = m_lanes[lane];
+        int64_t nowUs = NowUs();
+
+        if (m_stopRequested) {
+            dropped = std::move(message.completion);
+            droppedError = ERROR_SHUTDOWN;
+            result = EnqueueResult::Rejected;
+        } else {
+            ++state.enqueued;
+            RefillLocked(nowUs);
+
+            // Idle from this lane up and a token to spend: publish right here
+            bool idle = true;
+            for (int i = 0; i <= lane && idle; ++i) {
+                idle = m_lanes[i].queue.empty();
+            }
+            if (idle && TakeTokenLocked(lane)) {
+                ++state.sent;
+                inline_.message = std::move(message);
+                inline_.enqueuedMs = nowUs / 1000;
+                result = EnqueueResult::Sent;
+            } else {
+                auto same = state.queue.end();
+                if (!message.coalesceKey.empty()) {
+                    same = std::find_if(state.queue.begin(), state.queue.end(), [&](const Pending& pending) {
+                        return pending.message.coalesceKey == message.coalesceKey;
+                    });
+                }
+                if (same != state.queue.end()) {
+                    // Keep the queue position (and wait time) of the message being replaced
+                    dropped = std::move(same->message.completion);
+                    droppedError = ERROR_SUPERSEDED;
+                    same->message = std::move(message);
+                    ++state.coalesced;
+                    result = EnqueueResult::Coalesced;
+                } else if (state.queue.size() >= m_config.laneCapacity[lane]) {
+                    dropped = std::move(message.completion);
+                    droppedError = ERROR_QUEUE_FULL;
+                    ++state.rejected;
+                    result = EnqueueResult::Rejected;
+                } else {
+                    state.queue.push_back(Pending{ std::move(message), nowUs / 1000 });
+                    state.peakDepth = (std::max)(state.peakDepth, state.queue.size());
+                    if (!m_dispatcher.joinable()) {
+                        m_dispatcher = std::thread(&OutboundScheduler::DispatcherLoop, this);
+                    }
+                }
+                congestionChanged = UpdateCongestionLocked(lane);
+                congested = state.congested;
+            }
+        }
+    }
+
+    if (result == EnqueueResult::Sent) {
+        Dispatch(lane, inline_);
+        return result;
+    }
+    if (result == EnqueueResult::Queued || result == EnqueueResult::Coalesced) {
+        m_cv.notify_one();
+    }
+    if (congestionChanged) {
+        NotifyCongestion(lane, congested);
+    }
+    if (dropped) {
+        dropped(false, droppedError);
+    }
+    return result;
+}
+
+void OutboundScheduler::DispatcherLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopRequested) {
+        int lane = 0;
+        while (lane < LANE_COUNT && m_lanes[lane].queue.empty()) {
+            ++lane;
+        }
+        if (lane == LANE_COUNT) {
+            m_cv.wait(lock);
+            continue;
+        }
+
+        int64_t nowUs = NowUs();
+        RefillLocked(nowUs);
+        if (!TakeTokenLocked(lane)) {
+            // Sleep until one token has accumulated (or a new message changes the picture)
+            double missing = 1.0 - m_tokens;
+            auto waitUs = static_cast<int64_t>(missing / m_config.messagesPerSecond * 1e6) + 1;
+            m_cv.wait_for(lock, std::chrono::microseconds(waitUs));
+            continue;
+        }
+
+        Lane& state = m_lanes[lane];
+        Pending pending = std::move(state.queue.front());
+        state.queue.pop_front();
+        ++state.sent;
+        int64_t waitMs = nowUs / 1000 - pending.enqueuedMs;
+        state.waitSumMs += waitMs;
+        state.maxWaitMs = (std::max)(state.maxWaitMs, waitMs);
+        bool congestionChanged = UpdateCongestionLocked(lane);
+        bool congested = state.congested;
+
+        lock.unlock();
+        if (congestionChanged) {
+            NotifyCongestion(lane, congested);
+        }
+        Dispatch(lane, pending);
+        lock.lock();
+    }
+}
+
+void OutboundScheduler::Dispatch(int lane, Pending& pending) {
+    Completion completion = std::move(pending.message.completion);
+    int64_t enqueuedMs = pending.enqueuedMs;
+    m_publish(pending.message, [this, lane, enqueuedMs, completion](bool success, int errorCode) {
+        RecordAck(lane, NowUs() / 1000 - enqueuedMs);
+        if (completion) {
+            completion(success, errorCode);
+        }
+    });
+}
+
+void OutboundScheduler::RecordAck(int lane, int64_t latencyMs) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_lanes[lane].acked;
+    m_lanes[lane].ackSumMs += latencyMs;
+}
+
+void OutboundScheduler::SetBackpressureHandler(BackpressureHandler handler) {
+    std::lock_guard<std::mutex> lock(m_handlerMutex);
+    m_backpressureHandler = std::move(handler);
+}
+
+bool OutboundScheduler::IsCongested(OutboundLane lane) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_lanes[static_cast<int>(lane)].congested;
+}
+
+OutboundLaneStats OutboundScheduler::GetStats(OutboundLane laneId) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const Lane& state = m_lanes[static_cast<int>(laneId)];
+    OutboundLaneStats stats = {};
+    stats.depth = state.queue.size();
+    stats.peakDepth = state.peakDepth;
+    stats.enqueued = state.enqueued;
+    stats.sent = state.sent;
+    stats.coalesced = state.coalesced;
+    stats.rejected = state.rejected;
+    stats.avgWaitMs = state.sent ? state.waitSumMs / static_cast<int64_t>(state.sent) : 0;
+    stats.maxWaitMs = state.maxWaitMs;
+    stats.avgAckMs = state.acked ? state.ackSumMs / static_cast<int64_t>(state.acked) : 0;
+    stats.congested = state.congested;
+    return stats;
+}
+
+void OutboundScheduler::LogStats() const {
+    std::ostringstream oss;
+    oss << "[OutboundScheduler]";
+    for (int lane = 0; lane < LANE_COUNT; ++lane) {
+        OutboundLaneStats stats = GetStats(static_cast<OutboundLane>(lane));
+        if (stats.enqueued == 0) continue;
+        oss << " " << LaneName(lane) << ": sent=" << stats.sent << " depth=" << stats.depth
+            << " peak=" << stats.peakDepth << " coalesced=" << stats.coalesced << " rejected=" << stats.rejected
+            << " wait avg/max=" << stats.avgWaitMs << "/" << stats.maxWaitMs << "ms ack avg=" << stats.avgAckMs << "ms;";
+    }
+    LOG_INFO(oss.str());
+}
+
+void OutboundScheduler::Shutdown() {
+    std::vector<Completion> dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopRequested) {
+            return;
+        }
+        m_stopRequested = true;
+        for (Lane& state : m_lanes) {
+            for (Pending& pending : state.queue) {
+                if (pending.message.completion) {
+                    dropped.push_back(std::move(pending.message.completion));
+                }
+            }
+            state.queue.clear();
+        }
+    }
+    m_cv.notify_one();
+    if (m_dispatcher.joinable()) {
+        m_dispatcher.join();
+    }
+    for (auto& completion : dropped) {
+        completion(false, ERROR_SHUTDOWN);
+    }
+}
@@ -0,0 +1,145 @@
+//
+// OutboundScheduler.h: Priority lanes, rate limiting and coalescing for outbound RTM messages
+//
+#pragma once
+
+#include <string>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+/// Outbound traffic classes, highest priority first
+enum class OutboundLane {
+    Interrupt = 0,  // Never waits for rate tokens
+    HighChat = 1,   // Chat that interrupts the agent
+    Chat = 2,       // Other chat and small image (URL) messages
+    Bulk = 3        // Image parts
+};
+
+enum class EnqueueResult {
+    Sent,       // Published on the calling thread
+    Queued,
+    Coalesced,  // Replaced a queued message with the same coalesce key (whose completion got ERROR_SUPERSEDED)
+    Rejected    // Lane full; completion got ERROR_QUEUE_FULL
+};
+
+struct OutboundLaneStats {
+    size_t depth;
+    size_t peakDepth;
+    uint64_t enqueued;
+    uint64_t sent;
+    uint64_t coalesced;
+    uint64_t rejected;
+    int64_t avgWaitMs;  // Enqueue -> publish
+    int64_t maxWaitMs;
+    int64_t avgAckMs;   // Enqueue -> RTM ack
+    bool congested;
+};
+
+/// Decides when each outbound message may be published
+///
+/// Every lane is a FIFO; the highest non-empty lane always goes first. Publishes are
+/// paced by a token bucket kept below RTM's per-client publish rate limit; the interrupt
+/// lane may overdraw it. A message enqueued while its lane and every lane above it are
+/// idle and a token is available is published inline, so the common case costs no thread
+/// hop. Otherwise a dispatcher thread (started on first use) drains the queues.
+///
+/// Messages with a coalesce key replace a queued, not yet published message with the same
+/// key in their lane. Each lane has a capacity; above 3/4 of it the lane reports congestion
+/// through the backpressure handler until it drains below 1/4.
+class OutboundScheduler {
+public:
+    static const int LANE_COUNT = 4;
+    static const int ERROR_SUPERSEDED = -2;
+    static const int ERROR_QUEUE_FULL = -3;
+    static const int ERROR_SHUTDOWN = -4;
+
+    using Completion = std::function<void(bool success, int errorCode)>;
+
+    struct Message {
+        std::string channel;      // Agent user id (RTM user channel)
+        std::string payload;
+        const char* customType;   // Static string
+        std::string coalesceKey;  // Empty: never coalesced
+        Completion completion;
+
+        Message() : customType("") {}
+    };
+
+    /// Publishes one message; called with no scheduler lock held. The function may take the
+    /// payload (e.g. to recycle the buffer) and must eventually call completion exactly once.
+    using PublishFunction = std::function<void(Message& message, Completion completion)>;
+    using BackpressureHandler = std::function<void(OutboundLane lane, bool congested)>;
+
+    struct Config {
+        double messagesPerSecond;
+        double burst;
+        size_t laneCapacity[LANE_COUNT];
+
+        Config() : messagesPerSecond(40.0), burst(20.0), laneCapacity{ 8, 64, 64, 256 } {}
+    };
+
+    explicit OutboundScheduler(PublishFunction publish, const Config& config = Config());
+    ~OutboundScheduler();
+
+    OutboundScheduler(const OutboundScheduler&) = delete;
+    OutboundScheduler& operator=(const OutboundScheduler&) = delete;
+
+    EnqueueResult Enqueue(OutboundLane lane, Message message);
+
+    /// Called on the thread whose enqueue or dispatch changed the lane's state
+    void SetBackpressureHandler(BackpressureHandler handler);
+    bool IsCongested(OutboundLane lane) const;
+
+    OutboundLaneStats GetStats(OutboundLane lane) const;
+    void LogStats() const;
+
+    /// Fail everything still queued with ERROR_SHUTDOWN and stop the dispatcher
+    void Shutdown();
+
+private:
+    struct Pending {
+        Message message;
+        int64_t enqueuedMs;
+    };
+
+    struct Lane {
+        std::deque<Pending> queue;
+        size_t peakDepth = 0;
+        uint64_t enqueued = 0;
+        uint64_t sent = 0;
+        uint64_t coalesced = 0;
+        uint64_t rejected = 0;
+        int64_t waitSumMs = 0;
+        int64_t maxWaitMs = 0;
+        uint64_t acked = 0;
+        int64_t ackSumMs = 0;
+        bool congested = false;
+    };
+
+    void DispatcherLoop();
+    void Dispatch(int lane, Pending& pending);
+    void RecordAck(int lane, int64_t latencyMs);
+    void RefillLocked(int64_t nowUs);
+    bool TakeTokenLocked(int lane);
+    bool UpdateCongestionLocked(int lane);
+    void NotifyCongestion(int lane, bool congested);
+
+    PublishFunction m_publish;
+    Config m_config;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cv;
+    Lane m_lanes[LANE_COUNT];
+    double m_tokens;
+    int64_t m_lastRefillUs;
+    bool m_stopRequested;
+    std::thread m_dispatcher;
+
+    std::mutex m_handlerMutex;
+    BackpressureHandler m_backpressureHandler;
+};
@@ -0,0 +1,105 @@
+//
+// PresenceStateBenchmark.cpp: Times agent state updates from RTM presence
+//
+
+#include "../general/pch.h"
+#include "PresenceStateBenchmark.h"
+#include "ConversationalAIAPI.h"
+#include "../tools/BenchmarkUtils.h"
+#include "../tools/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <sstream>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+const char* const kPublisher = "agent_1001";
+const char* const kStates[] = { "listening", "thinking", "speaking" };
+const int64_t kFirstTimestamp = 1700000000000;
+
+class CountingHandler : public IConversationalAIAPIEventHandler {
+public:
+    void OnAgentStateChanged(const std::string&, const StateChangeEvent&) override { ++states; }
+    void OnTranscriptUpdated(const std::string&, const Transcript&) override {}
+
+    uint64_t states = 0;
+};
+
+struct PathRun {
+    double ms = 0;
+    uint64_t delivered = 0;
+};
+
+/// Best of runs, each on a fresh instance so no state carries over between runs
+PathRun TimePath(int runs, int events, const std::function<void(ConversationalAIAPI&, int)>& feed) {
+    PathRun best;
+    for (int run = 0; run < runs; ++run) {
+        ConversationalAIAPI api;
+        CountingHandler handler;
+        api.AddHandler(&handler);
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < events; ++i) {
+            feed(api, i);
+        }
+        double ms = MillisecondsSince(start);
+        api.RemoveHandler(&handler);
+        if (run == 0 || ms < best.ms) {
+            best.ms = ms;
+            best.delivered = handler.states;
+        }
+    }
+    return best;
+}
+
+std::string Describe(const char* name, const PathRun& run, int events) {
+    std::ostringstream line;
+    line.setf(std::ios::fixed);
+    line.precision(1);
+    line << "[PresenceStateBenchmark] " << name << ": " << run.ms << " ms, "
+         << (run.ms > 0 ? events * 1000.0 / run.ms : 0) << " events/s, "
+         << (events > 0 ? run.ms * 1e6 / events : 0) << " ns/event, delivered " << run.delivered << "/" << events;
+    return line.str();
+}
+
+}  // namespace
+
+bool PresenceStateBenchmark::RunFromCommandLine(const std::string& commandLine) {
+    CommandLineArgs args(commandLine);
+    if (!args.Has("/benchpresence")) {
+        return false;
+    }
+    int events = (std::max)(1, (int)args.Number("events", 200000));
+    int runs = (std::max)(1, (int)args.Number("runs", 3));
+    if (args.Number("verbose", 0) == 0) {
+        // Every applied state is logged at info level; keep that out of the numbers
+        Logger::instance().setLogLevel(LogLevel::Warn);
+    }
+
+    // What onPresenceEvent does now: state items handed over as they are
+    PathRun typed = TimePath(runs, events, [](ConversationalAIAPI& api, int i) {
+        api.HandlePresenceState(kPublisher, kStates[i % 3], i / 3 + 1, kFirstTimestamp + i);
+    });
+
+    // What it used to do: build message.state JSON from the items and parse it back
+    PathRun json = TimePath(runs, events, [](ConversationalAIAPI& api, int i) {
+        std::string message = "{\"object\":\"message.state\",\"state\":\"" + std::string(kStates[i % 3]) +
+            "\",\"turn_id\":" + std::to_string(i / 3 + 1) +
+            ",\"timestamp\":" + std::to_string(kFirstTimestamp + i) + ",\"reason\":\"\"}";
+        api.HandleMessage(message, kPublisher);
+    });
+
+    Logger::instance().setLogLevel(LogLevel::Info);
+    LOG_INFO(Describe("HandlePresenceState", typed, events));
+    LOG_INFO(Describe("message.state JSON", json, events));
+    std::ostringstream ratio;
+    ratio.setf(std::ios::fixed);
+    ratio.precision(1);
+    ratio << "[PresenceStateBenchmark] typed path is " << (typed.ms > 0 ? json.ms / typed.ms : 0)
+          << "x faster (best of " << runs << " runs)";
+    LOG_INFO(ratio.str());
+    return true;
+}
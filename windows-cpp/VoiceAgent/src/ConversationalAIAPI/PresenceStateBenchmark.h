@@ -0,0 +1,20 @@
+//
+// PresenceStateBenchmark.h: Times agent state updates from RTM presence
+//
+#pragma once
+
+#include <string>
+
+/// Runs "/benchpresence [events=N] [runs=N] [verbose=1]" and logs the report
+///
+/// Feeds events agent state changes (listening/thinking/speaking with increasing turn ids and
+/// timestamps, 200000 by default) into a ConversationalAIAPI with one counting handler, twice:
+/// through HandlePresenceState(), as the presence handler does now, and as the message.state JSON
+/// the presence handler used to build and push back through HandleMessage(). Each path runs runs
+/// times on a fresh instance; the best run is reported with the number of events delivered.
+/// Info logging (one line per applied state) is off while timing unless verbose=1.
+class PresenceStateBenchmark {
+public:
+    /// Returns false, doing nothing, for other command lines
+    static bool RunFromCommandLine(const std::string& commandLine);
+};
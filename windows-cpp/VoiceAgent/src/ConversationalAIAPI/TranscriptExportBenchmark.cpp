@@ -0,0 +1,135 @@
+//
+// TranscriptExportBenchmark.cpp: Times TranscriptExporter on a long synthetic session
+//
+
+#include "../general/pch.h"
+#include "TranscriptExportBenchmark.h"
+#include "TranscriptExporter.h"
+#include "../tools/BenchmarkUtils.h"
+#include "../tools/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <sstream>
+#include <utility>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Distinct turns cycled through the run; enough variety that lengths and escapes don't repeat in lockstep
+const int kTurnPool = 512;
+const int64_t kTurnGapMs = 600;
+
+const char* const kVocabulary[] = {
+    "the", "agent", "said", "that", "weather", "tomorrow", "looks", "sunny", "but", "bring", "an", "umbrella",
+    "just", "in", "case", "could", "you", "book", "a", "table", "for", "two", "at", "seven", "o'clock",
+    "\"quoted\"", "<tag>", "&", "price", "is", "42.50", "dollars", "please", "confirm", "order", "number",
+    "你好", "谢谢", "明天", "见", "okay", "sure", "let", "me", "check", "that", "for", "you"
+};
+
+/// One finished turn of a plausible conversation: users speak briefly, agents at length
+Transcript MakeTurn(std::mt19937& rng, int index, bool withWords) {
+    bool agent = (index % 2) == 1;
+    Transcript turn(index / 2 + 1, agent ? "agent" : "user", "", TranscriptStatus::End,
+                    agent ? TranscriptType::Agent : TranscriptType::User);
+    size_t vocabulary = sizeof(kVocabulary) / sizeof(kVocabulary[0]);
+    int words = agent ? 12 + (int)(rng() % 50) : 3 + (int)(rng() % 12);
+    int64_t ms = 0;
+    for (int i = 0; i < words; ++i) {
+        const char* word = kVocabulary[rng() % vocabulary];
+        if (!turn.text.empty()) {
+            turn.text += ' ';
+        }
+        turn.text += word;
+        int64_t duration = 180 + (int64_t)(rng() % 320);
+        if (agent && withWords) {
+            turn.words.emplace_back(word, ms, duration, true);
+        }
+        ms += duration + 40;
+    }
+    turn.durationMs = ms;
+    return turn;
+}
+
+}  // namespace
+
+bool TranscriptExportBenchmark::RunFromCommandLine(const std::string& commandLine) {
+    CommandLineArgs args(commandLine);
+    if (!args.Has("/benchexport")) {
+        return false;
+    }
+    int turns = (std::max)(1, (int)args.Number("turns", 100000));
+    bool withWords = args.Number("words", 1) != 0;
+    std::string path = args.Text("path", "logs/bench/export");
+    std::string formatList = args.Text("formats", "jsonl,srt,vtt");
+    unsigned formats = 0;
+    if (formatList.find("jsonl") != std::string::npos) formats |= ExportJsonl;
+    if (formatList.find("srt") != std::string::npos) formats |= ExportSrt;
+    if (formatList.find("vtt") != std::string::npos) formats |= ExportVtt;
+    if (formats == 0) {
+        formats = ExportAll;
+    }
+
+    std::mt19937 rng(7);
+    std::vector<Transcript> pool;
+    pool.reserve(kTurnPool);
+    for (int i = 0; i < kTurnPool; ++i) {
+        pool.push_back(MakeTurn(rng, i, withWords));
+    }
+
+    TranscriptExporter exporter;
+    if (!exporter.Open(path, formats)) {
+        LOG_ERROR("[TranscriptExportBenchmark] Cannot open " + path);
+        return true;
+    }
+
+    std::vector<double> perTurn;
+    perTurn.reserve(turns);
+    int64_t sessionMs = 0;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < turns; ++i) {
+        // Move the pooled turn to its place in the session (not timed)
+        Transcript& turn = pool[i % kTurnPool];
+        int64_t shift = sessionMs - turn.startMs;
+        turn.turnId = i / 2 + 1;
+        turn.startMs = sessionMs;
+        for (auto& word : turn.words) {
+            word.startMs += shift;
+        }
+        sessionMs += turn.durationMs + kTurnGapMs;
+
+        Clock::time_point exportStart = Clock::now();
+        exporter.Export(turn);
+        perTurn.push_back(MillisecondsSince(exportStart) * 1000.0);
+    }
+    double exportMs = MillisecondsSince(start);
+    Clock::time_point closeStart = Clock::now();
+    uint64_t exported = exporter.ExportedTurns();
+    exporter.Close();
+    double closeMs = MillisecondsSince(closeStart);
+
+    uint64_t bytes = 0;
+    const std::pair<unsigned, const char*> outputs[] = { { ExportJsonl, ".jsonl" }, { ExportSrt, ".srt" }, { ExportVtt, ".vtt" } };
+    for (const auto& output : outputs) {
+        std::error_code ec;
+        uintmax_t size = std::filesystem::file_size(path + output.second, ec);
+        if ((formats & output.first) && !ec) {
+            bytes += size;
+        }
+    }
+
+    LatencySummary latency = LatencySummary::Of(perTurn);
+    std::ostringstream summary;
+    summary.setf(std::ios::fixed);
+    summary.precision(1);
+    summary << "[TranscriptExportBenchmark] " << exported << " turns in " << exportMs << " ms ("
+            << (exportMs > 0 ? exported * 1000.0 / exportMs : 0) << " turns/s), close " << closeMs << " ms, "
+            << bytes / 1024 << " KB (" << (exportMs + closeMs > 0 ? bytes / 1000.0 / (exportMs + closeMs) : 0)
+            << " MB/s), formats=" << formatList << ", words=" << (withWords ? 1 : 0);
+    LOG_INFO(summary.str());
+    LOG_INFO("[TranscriptExportBenchmark] " + latency.Format("export", 2, "us"));
+    return true;
+}
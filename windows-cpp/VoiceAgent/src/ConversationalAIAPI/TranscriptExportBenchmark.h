@@ -0,0 +1,19 @@
+//
+// TranscriptExportBenchmark.h: Times TranscriptExporter on a long synthetic session
+//
+#pragma once
+
+#include <string>
+
+/// Runs "/benchexport [turns=N] [words=0|1] [formats=jsonl,srt,vtt] [path=BASE]" and logs the report
+///
+/// Exports turns finished turns (100000 by default), alternating user and agent, with sentence-like
+/// text of varying length. Agent turns carry word timings unless words=0, so the subtitle writers
+/// split them into cues as they would for a real session. Turns are built before the clock starts;
+/// what is timed is each Export() call (throughput and per-turn percentiles) and the final Close().
+/// The files go to path + ".jsonl"/".srt"/".vtt" (logs/bench/export by default).
+class TranscriptExportBenchmark {
+public:
+    /// Returns false, doing nothing, for other command lines
+    static bool RunFromCommandLine(const std::string& commandLine);
+};
@@ -0,0 +1,413 @@
+//
+// TranscriptExporter.cpp: Streaming transcript export to JSONL, SRT and WebVTT
+//
+
+#include "../general/pch.h"
+#include "TranscriptExporter.h"
+#include "../tools/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <filesystem>
+
+namespace {
+
+const int64_t kFlushIntervalMs = 1000;     // Finished turns reach disk within about a second
+const int64_t kMinCueMs = 800;             // Keep very short turns readable
+const int64_t kMsPerByteEstimate = 60;     // Reading-speed guess when a turn has no timing
+const int64_t kMaxCueMs = 6000;            // Split word-timed turns into cues of at most 6 s...
+const size_t kMaxCueChars = 84;            // ...or two 42-character subtitle lines
+const size_t kExportedTurnsKept = 256;     // Per type; a turn finishing this far behind is dropped
+
+int64_t SteadyNowMs() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now).count();
+}
+
+bool IsFinished(TranscriptStatus status) {
+    return status == TranscriptStatus::End || status == TranscriptStatus::Interrupted;
+}
+
+const char* StateName(AgentState state) {
+    switch (state) {
+        case AgentState::Idle: return "idle";
+        case AgentState::Silent: return "silent";
+        case AgentState::Listening: return "listening";
+        case AgentState::Thinking: return "thinking";
+        case AgentState::Speaking: return "speaking";
+        default: return "unknown";
+    }
+}
+
+/// Words are joined with a space unless either side is non-ASCII (CJK words carry no spaces)
+bool NeedsSpace(std::string_view left, std::string_view right) {
+    if (left.empty() || right.empty()) return false;
+    unsigned char l = static_cast<unsigned char>(left.back());
+    unsigned char r = static_cast<unsigned char>(right.front());
+    return l < 0x80 && r < 0x80 && l != ' ' && r != ' ';
+}
+
+}  // namespace
+
+TranscriptExporter::TranscriptExporter()
+    : m_formats(0)
+    , m_openTimeMs(0)
+    , m_lastFlushMs(0)
+    , m_cueCount(0)
+    , m_turnCount(0) {
+    m_exportedFloor[0] = INT_MIN;
+    m_exportedFloor[1] = INT_MIN;
+}
+
+TranscriptExporter::~TranscriptExporter() {
+    Close();
+}
+
+bool TranscriptExporter::Open(const std::string& basePath, unsigned formats) {
+    Close();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    std::error_code ec;
+    std::filesystem::path dir = std::filesystem::path(basePath).parent_path();
+    if (!dir.empty()) {
+        std::filesystem::create_directories(dir, ec);
+    }
+
+    bool ok = true;
+    if ((formats & ExportJsonl) && !m_jsonl.Open(basePath + ".jsonl")) ok = false;
+    if ((formats & ExportSrt) && !m_srt.Open(basePath + ".srt")) ok = false;
+    if ((formats & ExportVtt) && !m_vtt.Open(basePath + ".vtt")) ok = false;
+    if (!ok) {
+        m_jsonl.Close();
+        m_srt.Close();
+        m_vtt.Close();
+        return false;
+    }
+
+    if (formats & ExportVtt) {
+        m_vtt.Write("WEBVTT\n\n");
+    }
+
+    m_formats = formats;
+    for (int type = 0; type < 2; ++type) {
+        m_exportedTurns[type].clear();
+        m_exportedFloor[type] = INT_MIN;
+    }
+    m_liveStartMs.clear();
+    m_openTimeMs = SteadyNowMs();
+    m_lastFlushMs = 0;
+    m_cueCount = 0;
+    m_turnCount = 0;
+
+    LOG_INFO("[TranscriptExporter] Exporting to " + basePath);
+    return true;
+}
+
+void TranscriptExporter::Close() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_formats == 0) {
+        return;
+    }
+
+    uint64_t bytes = m_jsonl.BytesWritten() + m_srt.BytesWritten() + m_vtt.BytesWritten();
+    m_jsonl.Close();
+    m_srt.Close();
+    m_vtt.Close();
+    m_formats = 0;
+    m_liveStartMs.clear();
+
+    LOG_INFO("[TranscriptExporter] Closed, turns=" + std::to_string(m_turnCount) +
+             ", bytes=" + std::to_string(bytes));
+}
+
+bool TranscriptExporter::IsOpen() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_formats != 0;
+}
+
+uint64_t TranscriptExporter::ExportedTurns() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_turnCount;
+}
+
+int64_t TranscriptExporter::ElapsedMs() const {
+    return SteadyNowMs() - m_openTimeMs;
+}
+
+// =============================================================================
+// Event Handler
+// =============================================================================
+
+void TranscriptExporter::OnAgentStateChanged(const std::string& agentUserId, const StateChangeEvent& event) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!(m_formats & ExportJsonl)) {
+        return;
+    }
+
+    m_jsonl.Write("{\"record\":\"state\",\"agent_user_id\":");
+    WriteJsonString(m_jsonl, agentUserId);
+    m_jsonl.Write(",\"state\":\"");
+    m_jsonl.Write(StateName(event.state));
+    m_jsonl.Write("\",\"turn_id\":");
+    m_jsonl.WriteInt(event.turnId);
+    m_jsonl.Write(",\"timestamp\":");
+    m_jsonl.WriteInt(event.timestamp);
+    m_jsonl.Write("}\n");
+}
+
+void TranscriptExporter::OnTranscriptUpdated(const std::string&, const Transcript& transcript) {
+    Export(transcript);
+}
+
+void TranscriptExporter::Export(const Transcript& transcript) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_formats == 0) {
+        return;
+    }
+
+    int typeIndex = (transcript.type == TranscriptType::Agent) ? 0 : 1;
+    if (IsExported(typeIndex, transcript.turnId)) {
+        return;  // Late update of a turn that is already on disk
+    }
+
+    int64_t now = ElapsedMs();
+    auto key = std::make_pair(typeIndex, transcript.turnId);
+    if (transcript.type == TranscriptType::Agent) {
+        // An agent turn cut off without a final update never finishes: once the agent is on a
+        // later turn, the earlier ones are over
+        RetireLiveTurns(typeIndex, transcript.turnId);
+    }
+    if (!IsFinished(transcript.status)) {
+        m_liveStartMs.emplace(key, now);
+        return;
+    }
+
+    // Local timing fallback: first time the turn was seen until now
+    int64_t startMs = now;
+    auto live = m_liveStartMs.find(key);
+    if (live != m_liveStartMs.end()) {
+        startMs = live->second;
+        m_liveStartMs.erase(live);
+    }
+    int64_t durationMs = now - startMs;
+
+    if (!transcript.words.empty()) {
+        const TranscriptWord& first = transcript.words.front();
+        const TranscriptWord& last = transcript.words.back();
+        startMs = first.startMs;
+        durationMs = last.startMs + last.durationMs - first.startMs;
+    } else if (transcript.startMs > 0 || transcript.durationMs > 0) {
+        startMs = transcript.startMs;
+        durationMs = transcript.durationMs;
+    }
+    if (durationMs <= 0) {
+        durationMs = static_cast<int64_t>(transcript.text.size()) * kMsPerByteEstimate;
+    }
+    if (durationMs < kMinCueMs) {
+        durationMs = kMinCueMs;
+    }
+
+    if (m_formats & ExportJsonl) {
+        WriteJsonl(transcript, startMs, durationMs);
+    }
+    if (m_formats & (ExportSrt | ExportVtt)) {
+        WriteCues(transcript, startMs, startMs + durationMs);
+    }
+
+    MarkExported(typeIndex, transcript.turnId);
+    ++m_turnCount;
+    MaybeFlush(now);
+}
+
+bool TranscriptExporter::IsExported(int typeIndex, int turnId) const {
+    return turnId <= m_exportedFloor[typeIndex] || m_exportedTurns[typeIndex].count(turnId) != 0;
+}
+
+void TranscriptExporter::MarkExported(int typeIndex, int turnId) {
+    std::set<int>& exported = m_exportedTurns[typeIndex];
+    exported.insert(turnId);
+    if (exported.size() <= kExportedTurnsKept) {
+        return;
+    }
+    // Let the oldest id go; the floor now covers it, and any turn still live below it
+    m_exportedFloor[typeIndex] = *exported.begin();
+    exported.erase(exported.begin());
+    RetireLiveTurns(typeIndex, m_exportedFloor[typeIndex] + 1);
+}
+
+void TranscriptExporter::RetireLiveTurns(int typeIndex, int belowTurnId) {
+    auto first = m_liveStartMs.lower_bound(std::make_pair(typeIndex, INT_MIN));
+    auto last = m_liveStartMs.lower_bound(std::make_pair(typeIndex, belowTurnId));
+    m_liveStartMs.erase(first, last);
+}
+
+void TranscriptExporter::MaybeFlush(int64_t nowMs) {
+    if (nowMs - m_lastFlushMs < kFlushIntervalMs) {
+        return;
+    }
+    m_lastFlushMs = nowMs;
+    if (m_formats & ExportJsonl) m_jsonl.Flush();
+    if (m_formats & ExportSrt) m_srt.Flush();
+    if (m_formats & ExportVtt) m_vtt.Flush();
+}
+
+// =============================================================================
+// Writers
+// =============================================================================
+
+void TranscriptExporter::WriteJsonl(const Transcript& transcript, int64_t startMs, int64_t durationMs) {
+    BufferedFileWriter& w = m_jsonl;
+    w.Write("{\"record\":\"turn\",\"turn_id\":");
+    w.WriteInt(transcript.turnId);
+    w.Write(transcript.type == TranscriptType::Agent ? ",\"type\":\"agent\"" : ",\"type\":\"user\"");
+    w.Write(",\"user_id\":");
+    WriteJsonString(w, transcript.userId);
+    w.Write(transcript.status == TranscriptStatus::Interrupted ? ",\"status\":\"interrupted\"" : ",\"status\":\"end\"");
+    w.Write(",\"start_ms\":");
+    w.WriteInt(startMs);
+    w.Write(",\"duration_ms\":");
+    w.WriteInt(durationMs);
+    w.Write(",\"text\":");
+    WriteJsonString(w, transcript.text);
+
+    if (!transcript.words.empty()) {
+        w.Write(",\"words\":[");
+        for (size_t i = 0; i < transcript.words.size(); ++i) {
+            const TranscriptWord& word = transcript.words[i];
+            w.Write(i == 0 ? "{\"word\":" : ",{\"word\":");
+            WriteJsonString(w, word.word);
+            w.Write(",\"start_ms\":");
+            w.WriteInt(word.startMs);
+            w.Write(",\"duration_ms\":");
+            w.WriteInt(word.durationMs);
+            w.Write(word.stable ? ",\"stable\":true}" : ",\"stable\":false}");
+        }
+        w.Put(']');
+    }
+    w.Write("}\n");
+}
+
+void TranscriptExporter::WriteCues(const Transcript& transcript, int64_t startMs, int64_t endMs) {
+    bool agent = transcript.type == TranscriptType::Agent;
+    const std::vector<TranscriptWord>& words = transcript.words;
+    if (words.empty()) {
+        WriteCue(startMs, endMs, agent, transcript.text);
+        return;
+    }
+
+    // Group words into subtitle-sized cues using their own timestamps
+    std::string text;
+    int64_t cueStart = words.front().startMs;
+    int64_t cueEnd = cueStart;
+    for (const TranscriptWord& word : words) {
+        int64_t wordEnd = word.startMs + word.durationMs;
+        if (!text.empty() && (text.size() + word.word.size() >= kMaxCueChars || wordEnd - cueStart > kMaxCueMs)) {
+            WriteCue(cueStart, (std::max)(cueEnd, cueStart + kMinCueMs), agent, text);
+            text.clear();
+            cueStart = word.startMs;
+        }
+        if (NeedsSpace(text, word.word)) {
+            text.push_back(' ');
+        }
+        text += word.word;
+        cueEnd = wordEnd;
+    }
+    if (!text.empty()) {
+        WriteCue(cueStart, (std::max)(cueEnd, cueStart + kMinCueMs), agent, text);
+    }
+}
+
+void TranscriptExporter::WriteCue(int64_t startMs, int64_t endMs, bool agent, std::string_view text) {
+    ++m_cueCount;
+
+    if (m_formats & ExportSrt) {
+        m_srt.WriteInt(static_cast<int64_t>(m_cueCount));
+        m_srt.Put('\n');
+        WriteTimestamp(m_srt, startMs, ',');
+        m_srt.Write(" --> ");
+        WriteTimestamp(m_srt, endMs, ',');
+        m_srt.Write(agent ? "\nAgent: " : "\nUser: ");
+        WriteCueText(m_srt, text, false);
+        m_srt.Write("\n\n");
+    }
+
+    if (m_formats & ExportVtt) {
+        WriteTimestamp(m_vtt, startMs, '.');
+        m_vtt.Write(" --> ");
+        WriteTimestamp(m_vtt, endMs, '.');
+        m_vtt.Write(agent ? "\n<v Agent>" : "\n<v User>");
+        WriteCueText(m_vtt, text, true);
+        m_vtt.Write("\n\n");
+    }
+}
+
+void TranscriptExporter::WriteCueText(BufferedFileWriter& writer, std::string_view text, bool escapeMarkup) {
+    // A blank line would end the cue early, so line breaks become spaces
+    size_t runStart = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        const char* replacement = nullptr;
+        switch (text[i]) {
+            case '\r':
+            case '\n': replacement = " "; break;
+            case '&': replacement = escapeMarkup ? "&amp;" : nullptr; break;
+            case '<': replacement = escapeMarkup ? "&lt;" : nullptr; break;
+            case '>': replacement = escapeMarkup ? "&gt;" : nullptr; break;
+            default: break;
+        }
+        if (replacement) {
+            writer.Write(text.substr(runStart, i - runStart));
+            writer.Write(replacement);
+            runStart = i + 1;
+        }
+    }
+    writer.Write(text.substr(runStart));
+}
+
+void TranscriptExporter::WriteTimestamp(BufferedFileWriter& writer, int64_t ms, char fractionSeparator) {
+    if (ms < 0) ms = 0;
+    int64_t hours = ms / 3600000;
+    int minutes = static_cast<int>(ms / 60000 % 60);
+    int seconds = static_cast<int>(ms / 1000 % 60);
+    int millis = static_cast<int>(ms % 1000);
+
+    if (hours < 10) writer.Put('0');
+    writer.WriteInt(hours);
+    char tail[10] = {
+        ':', static_cast<char>('0' + minutes / 10), static_cast<char>('0' + minutes % 10),
+        ':', static_cast<char>('0' + seconds / 10), static_cast<char>('0' + seconds % 10),
+        fractionSeparator,
+        static_cast<char>('0' + millis / 100), static_cast<char>('0' + millis / 10 % 10), static_cast<char>('0' + millis % 10)
+    };
+    writer.Write(std::string_view(tail, sizeof(tail)));
+}
+
+void TranscriptExporter::WriteJsonString(BufferedFileWriter& writer, std::string_view text) {
+    static const char kHex[] = "0123456789abcdef";
+
+    writer.Put('"');
+    size_t runStart = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        writer.Write(text.substr(runStart, i - runStart));
+        runStart = i + 1;
+        switch (c) {
+            case '"': writer.Write("\\\""); break;
+            case '\\': writer.Write("\\\\"); break;
+            case '\n': writer.Write("\\n"); break;
+            case '\r': writer.Write("\\r"); break;
+            case '\t': writer.Write("\\t"); break;
+            default: {
+                char escaped[6] = { '\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xF] };
+                writer.Write(std::string_view(escaped, sizeof(escaped)));
+                break;
+            }
+        }
+    }
+    writer.Write(text.substr(runStart));
+    writer.Put('"');
+}
@@ -0,0 +1,84 @@
+//
+// TranscriptExporter.h: Streaming transcript export to JSONL, SRT and WebVTT
+//
+#pragma once
+
+#include "ConversationalAIAPI.h"
+#include "../tools/BufferedFileWriter.h"
+
+#include <string>
+#include <string_view>
+#include <map>
+#include <set>
+#include <mutex>
+#include <cstdint>
+
+enum ExportFormat : unsigned {
+    ExportJsonl = 1 << 0,  // One typed JSON record per line (turns and agent state changes)
+    ExportSrt   = 1 << 1,  // SubRip subtitles
+    ExportVtt   = 1 << 2,  // WebVTT subtitles with speaker voice tags
+    ExportAll   = ExportJsonl | ExportSrt | ExportVtt
+};
+
+/// Event handler that appends every finished turn to the selected export files
+///
+/// Only the turn being exported is touched, and what is kept per turn is bounded (the ids of
+/// recently exported turns, start times of turns in progress), so memory stays flat however
+/// long the session runs. Turns may finish in any order. Cue times come from the
+/// turn's word timings when present, then from start_ms/duration_ms, and finally
+/// from the local time the turn was first seen and finished.
+class TranscriptExporter : public IConversationalAIAPIEventHandler {
+public:
+    TranscriptExporter();
+    ~TranscriptExporter() override;
+
+    TranscriptExporter(const TranscriptExporter&) = delete;
+    TranscriptExporter& operator=(const TranscriptExporter&) = delete;
+
+    /// Create basePath + ".jsonl" / ".srt" / ".vtt" for the requested formats
+    bool Open(const std::string& basePath, unsigned formats = ExportAll);
+    void Close();
+    bool IsOpen() const;
+
+    /// Write one finished turn; in-progress updates are only used to note the turn start
+    void Export(const Transcript& transcript);
+
+    uint64_t ExportedTurns() const;
+
+    // IConversationalAIAPIEventHandler
+    void OnAgentStateChanged(const std::string& agentUserId, const StateChangeEvent& event) override;
+    void OnTranscriptUpdated(const std::string& agentUserId, const Transcript& transcript) override;
+
+private:
+    void WriteJsonl(const Transcript& transcript, int64_t startMs, int64_t durationMs);
+    void WriteCues(const Transcript& transcript, int64_t startMs, int64_t endMs);
+    void WriteCue(int64_t startMs, int64_t endMs, bool agent, std::string_view text);
+    void WriteCueText(BufferedFileWriter& writer, std::string_view text, bool escapeMarkup);
+    bool IsExported(int typeIndex, int turnId) const;
+    void MarkExported(int typeIndex, int turnId);
+    void RetireLiveTurns(int typeIndex, int belowTurnId);
+    void MaybeFlush(int64_t nowMs);
+    int64_t ElapsedMs() const;
+
+    static void WriteTimestamp(BufferedFileWriter& writer, int64_t ms, char fractionSeparator);
+    static void WriteJsonString(BufferedFileWriter& writer, std::string_view text);
+
+    mutable std::mutex m_mutex;
+    BufferedFileWriter m_jsonl;
+    BufferedFileWriter m_srt;
+    BufferedFileWriter m_vtt;
+    unsigned m_formats;
+
+    // Recently exported turn ids per type, so late updates of a turn on disk are dropped even
+    // when turns finish out of order; ids at or below the floor were let go and count as exported
+    std::set<int> m_exportedTurns[2];
+    int m_exportedFloor[2];
+    // Local first-seen time of in-progress turns, keyed by (type, turnId); erased on export, or
+    // once the agent has moved on to a later turn
+    std::map<std::pair<int, int>, int64_t> m_liveStartMs;
+
+    int64_t m_openTimeMs;
+    int64_t m_lastFlushMs;
+    uint64_t m_cueCount;
+    uint64_t m_turnCount;
+};
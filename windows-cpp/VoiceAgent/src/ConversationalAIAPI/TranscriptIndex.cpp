@@ -0,0 +1,244 @@
+//
+// TranscriptIndex.cpp: Incremental inverted index over finished transcript turns
+//
+
+#include "../general/pch.h"
+#include "TranscriptIndex.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace {
+
+enum class CharClass {
+    Separator,
+    Word,
+    Cjk
+};
+
+/// Decode one UTF-8 code point starting at text[pos]; invalid bytes decode as U+FFFD
+uint32_t DecodeUtf8(std::string_view text, size_t& pos) {
+    unsigned char c = static_cast<unsigned char>(text[pos]);
+    uint32_t cp;
+    size_t extra;
+    if (c < 0x80) { pos += 1; return c; }
+    else if ((c & 0xE0) == 0xC0) { cp = c & 0x1F; extra = 1; }
+    else if ((c & 0xF0) == 0xE0) { cp = c & 0x0F; extra = 2; }
+    else if ((c & 0xF8) == 0xF0) { cp = c & 0x07; extra = 3; }
+    else { pos += 1; return 0xFFFD; }
+
+    if (pos + extra >= text.size()) {
+        pos = text.size();
+        return 0xFFFD;
+    }
+    for (size_t i = 1; i <= extra; ++i) {
+        unsigned char cc = static_cast<unsigned char>(text[pos + i]);
+        if ((cc & 0xC0) != 0x80) {
+            pos += i;
+            return 0xFFFD;
+        }
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+    pos += extra + 1;
+    return cp;
+}
+
+CharClass Classify(uint32_t cp) {
+    if (cp < 0x80) {
+        if ((cp >= '0' && cp <= '9') || (cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z')) {
+            return CharClass::Word;
+        }
+        return CharClass::Separator;
+    }
+    if ((cp >= 0x4E00 && cp <= 0x9FFF) ||   // CJK Unified Ideographs
+        (cp >= 0x3400 && cp <= 0x4DBF) ||   // CJK Extension A
+        (cp >= 0xF900 && cp <= 0xFAFF) ||   // CJK Compatibility Ideographs
+        (cp >= 0x3040 && cp <= 0x30FF) ||   // Hiragana, Katakana
+        (cp >= 0xAC00 && cp <= 0xD7AF) ||   // Hangul Syllables
+        (cp >= 0x20000 && cp <= 0x2FFFF)) { // CJK Extensions B+
+        return CharClass::Cjk;
+    }
+    if ((cp >= 0x0080 && cp <= 0x00BF) ||   // Latin-1 punctuation and symbols
+        (cp >= 0x2000 && cp <= 0x206F) ||   // General Punctuation
+        (cp >= 0x3000 && cp <= 0x303F) ||   // CJK Symbols and Punctuation
+        (cp >= 0xFF00 && cp <= 0xFF0F) ||   // Fullwidth punctuation
+        (cp >= 0xFF1A && cp <= 0xFF20) ||
+        (cp >= 0xFF3B && cp <= 0xFF40) ||
+        (cp >= 0xFF5B && cp <= 0xFF65) ||
+        cp == 0xFFFD) {
+        return CharClass::Separator;
+    }
+    // Other scripts (accented Latin, Cyrillic, ...) are word characters
+    return CharClass::Word;
+}
+
+/// A term of exactly one CJK character: indexed on its own only where it ends a run
+bool IsCjkCharacter(std::string_view term) {
+    size_t pos = 0;
+    return !term.empty() && Classify(DecodeUtf8(term, pos)) == CharClass::Cjk && pos == term.size();
+}
+
+}  // namespace
+
+void TranscriptIndex::Tokenize(std::string_view text, std::vector<std::string>& tokens) {
+    std::string word;
+    // Start offsets of the current run of CJK characters (plus its end)
+    std::vector<size_t> cjk;
+
+    auto flushWord = [&]() {
+        if (!word.empty()) {
+            tokens.push_back(word);
+            word.clear();
+        }
+    };
+    auto flushCjk = [&](size_t end) {
+        for (size_t i = 0; i + 1 < cjk.size(); ++i) {
+            size_t bigramEnd = (i + 2 < cjk.size()) ? cjk[i + 2] : end;
+            tokens.emplace_back(text.substr(cjk[i], bigramEnd - cjk[i]));
+        }
+        // The last character starts no bigram; without it a one-character query misses it
+        tokens.emplace_back(text.substr(cjk.back(), end - cjk.back()));
+        cjk.clear();
+    };
+
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t start = pos;
+        uint32_t cp = DecodeUtf8(text, pos);
+        CharClass cls = Classify(cp);
+
+        if (cls != CharClass::Cjk && !cjk.empty()) {
+            flushCjk(start);
+        }
+
+        switch (cls) {
+            case CharClass::Word:
+                if (cp < 0x80) {
+                    word.push_back(static_cast<char>((cp >= 'A' && cp <= 'Z') ? cp + ('a' - 'A') : cp));
+                } else {
+                    word.append(text.data() + start, pos - start);
+                }
+                break;
+            case CharClass::Cjk:
+                flushWord();
+                cjk.push_back(start);
+                break;
+            case CharClass::Separator:
+                flushWord();
+                break;
+        }
+    }
+    flushWord();
+    if (!cjk.empty()) {
+        flushCjk(text.size());
+    }
+}
+
+void TranscriptIndex::Add(uint32_t turnIndex, std::string_view text) {
+    std::vector<std::string> tokens;
+    Tokenize(text, tokens);
+
+    for (auto& token : tokens) {
+        auto it = m_postings.find(token);
+        if (it == m_postings.end()) {
+            it = m_postings.emplace(std::move(token), std::vector<uint32_t>()).first;
+        }
+        std::vector<uint32_t>& list = it->second;
+
+        // Turns usually finish in display order, so this is almost always a push_back
+        if (list.empty() || list.back() < turnIndex) {
+            list.push_back(turnIndex);
+            ++m_postingCount;
+        } else {
+            auto pos = std::lower_bound(list.begin(), list.end(), turnIndex);
+            if (pos == list.end() || *pos != turnIndex) {
+                list.insert(pos, turnIndex);
+                ++m_postingCount;
+            }
+        }
+    }
+}
+
+const std::vector<uint32_t>* TranscriptIndex::Lookup(const std::string& term, bool prefix,
+                                                     std::vector<uint32_t>& merged) const {
+    if (!prefix) {
+        auto it = m_postings.find(term);
+        return it != m_postings.end() ? &it->second : nullptr;
+    }
+
+    // Ordered map: every term with this prefix sits in one contiguous range
+    auto first = m_postings.lower_bound(term);
+    auto last = first;
+    size_t matches = 0;
+    while (last != m_postings.end() && last->first.compare(0, term.size(), term) == 0) {
+        ++last;
+        ++matches;
+    }
+    if (matches == 0) {
+        return nullptr;
+    }
+    if (matches == 1) {
+        return &first->second;
+    }
+    // Concatenate then sort once: linear merging would be quadratic for short prefixes
+    for (auto it = first; it != last; ++it) {
+        merged.insert(merged.end(), it->second.begin(), it->second.end());
+    }
+    std::sort(merged.begin(), merged.end());
+    merged.erase(std::unique(merged.begin(), merged.end()), merged.end());
+    return &merged;
+}
+
+std::vector<uint32_t> TranscriptIndex::Search(std::string_view query, size_t maxResults) const {
+    std::vector<std::string> terms;
+    Tokenize(query, terms);
+    if (terms.empty()) {
+        return {};
+    }
+
+    // Search-as-you-type: the last term is a prefix unless the query ends with a separator
+    bool lastIsPrefix = !std::isspace(static_cast<unsigned char>(query.back()));
+
+    std::vector<uint32_t> merged;
+    std::vector<const std::vector<uint32_t>*> lists;
+    lists.reserve(terms.size());
+    for (size_t i = 0; i < terms.size(); ++i) {
+        bool prefix = ((i + 1 == terms.size()) && lastIsPrefix) || IsCjkCharacter(terms[i]);
+        const std::vector<uint32_t>* postings = Lookup(terms[i], prefix, merged);
+        if (!postings) {
+            return {};
+        }
+        lists.push_back(postings);
+    }
+
+    // Start from the rarest term and probe the others, so common words cost a few binary searches
+    std::sort(lists.begin(), lists.end(),
+              [](const std::vector<uint32_t>* a, const std::vector<uint32_t>* b) { return a->size() < b->size(); });
+
+    std::vector<uint32_t> result(*lists[0]);
+    for (size_t i = 1; i < lists.size() && !result.empty(); ++i) {
+        const std::vector<uint32_t>& other = *lists[i];
+        auto from = other.begin();
+        size_t kept = 0;
+        for (uint32_t turn : result) {
+            from = std::lower_bound(from, other.end(), turn);
+            if (from == other.end()) {
+                break;
+            }
+            if (*from == turn) {
+                result[kept++] = turn;
+            }
+        }
+        result.resize(kept);
+    }
+
+    if (result.size() > maxResults) {
+        result.resize(maxResults);
+    }
+    return result;
+}
+
+void TranscriptIndex::Clear() {
+    m_postings.clear();
+    m_postingCount = 0;
+}
@@ -0,0 +1,46 @@
+//
+// TranscriptIndex.h: Incremental inverted index over finished transcript turns
+//
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <cstddef>
+
+/// Full-text index keyed by turn position in the TranscriptStore
+///
+/// Tokenization is UTF-8 aware: runs of letters/digits become lower-cased words,
+/// runs of CJK characters become overlapping bigrams plus the run's last character
+/// as a unigram, punctuation and whitespace separate tokens.
+///
+/// Queries AND all their terms; the last term is matched as a prefix so results
+/// update while the user is still typing. A single CJK character is always matched
+/// as a prefix: every occurrence starts a bigram or ends a run. Not thread-safe:
+/// callers serialize access.
+class TranscriptIndex {
+public:
+    /// Index the text of one finished turn (cost proportional to its token count)
+    void Add(uint32_t turnIndex, std::string_view text);
+
+    /// Turn indices matching every query term, in ascending order
+    std::vector<uint32_t> Search(std::string_view query, size_t maxResults = SIZE_MAX) const;
+
+    size_t TermCount() const { return m_postings.size(); }
+    size_t PostingCount() const { return m_postingCount; }
+
+    void Clear();
+
+    /// Split text into index terms (exposed so queries and documents tokenize identically)
+    static void Tokenize(std::string_view text, std::vector<std::string>& tokens);
+
+private:
+    /// Postings for one term; prefix matches spanning several terms are merged into 'merged'
+    const std::vector<uint32_t>* Lookup(const std::string& term, bool prefix, std::vector<uint32_t>& merged) const;
+
+    // Term -> ascending, de-duplicated turn indices; ordered so prefix queries are a range scan
+    std::map<std::string, std::vector<uint32_t>, std::less<>> m_postings;
+    size_t m_postingCount = 0;
+};
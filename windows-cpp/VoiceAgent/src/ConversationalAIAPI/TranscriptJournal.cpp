@@ -0,0 +1,433 @@
+//
+// TranscriptJournal.cpp: Crash-safe, memory-mapped journal of finished transcript turns
+//
+
+#include "../general/pch.h"
+#include "TranscriptJournal.h"
+#include "../tools/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+#include <map>
+#include <tuple>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const char kJournalMagic[8] = { 'V', 'A', 'J', 'R', 'N', 'L', '0', '1' };
+const uint32_t kJournalVersion = 1;
+
+const uint64_t kInitialFileSize = 1024 * 1024;        // 1 MB
+const uint64_t kMaxGrowthStep = 16 * 1024 * 1024;     // Grow by doubling, at most 16 MB at a time
+const uint64_t kMapGranularity = 64 * 1024;           // Windows allocation granularity
+const uint64_t kSyncBytes = 256 * 1024;               // Flush early after this many unsynced bytes
+const auto kWriteInterval = std::chrono::milliseconds(250);
+const auto kSyncInterval = std::chrono::seconds(2);
+
+struct JournalHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t committedBytes;  // End offset of the last complete record
+    uint64_t recordCount;
+    int64_t createdMs;
+    char sessionName[24];
+};
+static_assert(sizeof(JournalHeader) == 64, "JournalHeader must stay 64 bytes");
+
+struct JournalRecordHeader {
+    uint32_t totalSize;       // Header + userId + text
+    uint32_t checksum;        // FNV-1a over userId + text
+    int32_t turnId;
+    uint32_t textLength;
+    uint16_t userIdLength;
+    uint8_t type;
+    uint8_t status;
+};
+static_assert(sizeof(JournalRecordHeader) == 20, "JournalRecordHeader must stay 20 bytes");
+
+uint32_t Fnv1a(const char* data, size_t length, uint32_t hash = 2166136261u) {
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+int64_t GetCurrentTimeMs() {
+    auto now = std::chrono::system_clock::now();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count();
+}
+
+}  // namespace
+
+// ============================================================================
+// MappedFile: minimal read-write file mapping
+// ============================================================================
+
+struct TranscriptJournal::MappedFile {
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+    char* data = nullptr;
+    uint64_t size = 0;
+
+    bool Create(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+                           CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        return file != INVALID_HANDLE_VALUE;
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        return fd >= 0;
+#endif
+    }
+
+    void Unmap() {
+#ifdef _WIN32
+        if (data) UnmapViewOfFile(data);
+        if (mapping) CloseHandle(mapping);
+        mapping = nullptr;
+#else
+        if (data) munmap(data, size);
+#endif
+        data = nullptr;
+    }
+
+    /// Resize the file and map the whole of it
+    /// The old view is released only once the new one exists, so on failure the current
+    /// mapping (and everything written through it) stays valid.
+    bool Map(uint64_t newSize) {
+#ifdef _WIN32
+        // A mapping larger than the file extends the file
+        HANDLE newMapping = CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+                                               static_cast<DWORD>(newSize >> 32), static_cast<DWORD>(newSize), nullptr);
+        if (!newMapping) return false;
+        char* newData = static_cast<char*>(MapViewOfFile(newMapping, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(newSize)));
+        if (!newData) {
+            CloseHandle(newMapping);
+            return false;
+        }
+#else
+        if (ftruncate(fd, static_cast<off_t>(newSize)) != 0) return false;
+        void* p = mmap(nullptr, newSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return false;
+        char* newData = static_cast<char*>(p);
+#endif
+        Unmap();
+#ifdef _WIN32
+        mapping = newMapping;
+#endif
+        data = newData;
+        size = newSize;
+        return true;
+    }
+
+    void Flush(uint64_t bytes) {
+        if (!data || bytes == 0) return;
+#ifdef _WIN32
+        FlushViewOfFile(data, static_cast<SIZE_T>(bytes));
+        FlushFileBuffers(file);
+#else
+        msync(data, bytes, MS_SYNC);
+#endif
+    }
+
+    /// Unmap and trim the file to the bytes actually written
+    void Close(uint64_t finalSize) {
+        Unmap();
+#ifdef _WIN32
+        if (file != INVALID_HANDLE_VALUE) {
+            LARGE_INTEGER pos;
+            pos.QuadPart = static_cast<LONGLONG>(finalSize);
+            if (SetFilePointerEx(file, pos, nullptr, FILE_BEGIN)) {
+                SetEndOfFile(file);
+            }
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (fd >= 0) {
+            if (ftruncate(fd, static_cast<off_t>(finalSize)) != 0) {
+                // Keep the zero-padded tail; recovery stops at committedBytes anyway
+            }
+            ::close(fd);
+            fd = -1;
+        }
+#endif
+        size = 0;
+    }
+};
+
+// ============================================================================
+// TranscriptJournal Implementation
+// ============================================================================
+
+TranscriptJournal::TranscriptJournal()
+    : m_file(nullptr)
+    , m_writeOffset(0)
+    , m_recordCount(0)
+    , m_unsyncedBytes(0)
+    , m_full(false)
+    , m_running(false)
+    , m_stopRequested(false) {
+}
+
+TranscriptJournal::~TranscriptJournal() {
+    Close();
+}
+
+bool TranscriptJournal::Recover(const std::string& path, std::vector<Transcript>& transcripts, std::string& sessionName) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in.is_open()) {
+        return false;
+    }
+
+    std::streamsize fileSize = in.tellg();
+    if (fileSize < static_cast<std::streamsize>(sizeof(JournalHeader))) {
+        return false;
+    }
+
+    std::vector<char> buffer(static_cast<size_t>(fileSize));
+    in.seekg(0);
+    if (!in.read(buffer.data(), fileSize)) {
+        return false;
+    }
+
+    JournalHeader header;
+    memcpy(&header, buffer.data(), sizeof(header));
+    if (memcmp(header.magic, kJournalMagic, sizeof(kJournalMagic)) != 0 || header.version != kJournalVersion) {
+        LOG_ERROR("[TranscriptJournal] Not a journal file: " + path);
+        return false;
+    }
+
+    uint64_t end = header.committedBytes;
+    if (end > buffer.size()) {
+        end = buffer.size();
+    }
+    sessionName.assign(header.sessionName, strnlen(header.sessionName, sizeof(header.sessionName)));
+
+    // Walk committed records, stopping at the first one that fails validation. A turn recorded
+    // again replaces its earlier record in place.
+    std::map<std::tuple<int32_t, uint8_t, std::string>, size_t> positions;
+    uint64_t offset = header.headerSize;
+    size_t recovered = 0;
+    while (offset + sizeof(JournalRecordHeader) <= end) {
+        JournalRecordHeader record;
+        memcpy(&record, buffer.data() + offset, sizeof(record));
+
+        uint64_t payload = static_cast<uint64_t>(record.userIdLength) + record.textLength;
+        if (record.totalSize != sizeof(JournalRecordHeader) + payload || offset + record.totalSize > end ||
+            record.type > static_cast<uint8_t>(TranscriptType::User) ||
+            record.status > static_cast<uint8_t>(TranscriptStatus::Unknown)) {
+            LOG_ERROR("[TranscriptJournal] Corrupt record at offset " + std::to_string(offset));
+            break;
+        }
+
+        const char* userId = buffer.data() + offset + sizeof(JournalRecordHeader);
+        const char* text = userId + record.userIdLength;
+        if (Fnv1a(userId, static_cast<size_t>(payload)) != record.checksum) {
+            LOG_ERROR("[TranscriptJournal] Checksum mismatch at offset " + std::to_string(offset));
+            break;
+        }
+
+        Transcript transcript(record.turnId, std::string(userId, record.userIdLength),
+                              std::string(text, record.textLength),
+                              static_cast<TranscriptStatus>(record.status),
+                              static_cast<TranscriptType>(record.type));
+        auto key = std::make_tuple(record.turnId, record.type, transcript.userId);
+        auto position = positions.find(key);
+        if (position != positions.end()) {
+            transcripts[position->second] = std::move(transcript);
+        } else {
+            positions.emplace(std::move(key), transcripts.size());
+            transcripts.push_back(std::move(transcript));
+        }
+        offset += record.totalSize;
+        ++recovered;
+    }
+
+    LOG_INFO("[TranscriptJournal] Recovered " + std::to_string(positions.size()) + " turns (" +
+             std::to_string(recovered) + " records) from session " + sessionName);
+    return true;
+}
+
+bool TranscriptJournal::Open(const std::string& path, const std::string& sessionName) {
+    Close();
+
+    std::error_code ec;
+    std::filesystem::path dir = std::filesystem::path(path).parent_path();
+    if (!dir.empty()) {
+        std::filesystem::create_directories(dir, ec);
+    }
+
+    m_file = new MappedFile();
+    if (!m_file->Create(path) || !m_file->Map(kInitialFileSize)) {
+        LOG_ERROR("[TranscriptJournal] Failed to open " + path);
+        m_file->Close(0);
+        delete m_file;
+        m_file = nullptr;
+        return false;
+    }
+
+    JournalHeader header = {};
+    memcpy(header.magic, kJournalMagic, sizeof(kJournalMagic));
+    header.version = kJournalVersion;
+    header.headerSize = sizeof(JournalHeader);
+    header.committedBytes = sizeof(JournalHeader);
+    header.recordCount = 0;
+    header.createdMs = GetCurrentTimeMs();
+    strncpy(header.sessionName, sessionName.c_str(), sizeof(header.sessionName) - 1);
+    memcpy(m_file->data, &header, sizeof(header));
+
+    m_path = path;
+    m_writeOffset = sizeof(JournalHeader);
+    m_recordCount = 0;
+    m_unsyncedBytes = sizeof(JournalHeader);
+    m_full = false;
+    m_stopRequested = false;
+    m_running = true;
+    m_writer = std::thread(&TranscriptJournal::WriterLoop, this);
+
+    LOG_INFO("[TranscriptJournal] Journaling session " + sessionName + " to " + path);
+    return true;
+}
+
+void TranscriptJournal::Append(const Transcript& transcript) {
+    if (!m_running.load()) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_pending.push_back(transcript);
+}
+
+void TranscriptJournal::Close() {
+    if (!m_running.exchange(false)) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stopRequested = true;
+    }
+    m_cv.notify_one();
+    if (m_writer.joinable()) {
+        m_writer.join();
+    }
+
+    m_file->Close(m_writeOffset);
+    delete m_file;
+    m_file = nullptr;
+
+    LOG_INFO("[TranscriptJournal] Closed " + m_path + ", records=" + std::to_string(m_recordCount) +
+             ", bytes=" + std::to_string(m_writeOffset));
+}
+
+void TranscriptJournal::WriterLoop() {
+    std::vector<Transcript> batch;
+    auto lastSync = std::chrono::steady_clock::now();
+
+    for (;;) {
+        bool stop = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait_for(lock, kWriteInterval, [this] { return m_stopRequested; });
+            batch.swap(m_pending);
+            stop = m_stopRequested;
+        }
+
+        if (!batch.empty()) {
+            WritePending(batch);
+            batch.clear();
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (m_unsyncedBytes > 0 && (stop || m_unsyncedBytes >= kSyncBytes || now - lastSync >= kSyncInterval)) {
+            m_file->Flush(m_writeOffset);
+            m_unsyncedBytes = 0;
+            lastSync = now;
+        }
+
+        if (stop) {
+            break;
+        }
+    }
+}
+
+bool TranscriptJournal::EnsureCapacity(uint64_t required) {
+    if (required <= m_file->size) {
+        return true;
+    }
+
+    uint64_t newSize = (std::max)(m_file->size, kInitialFileSize);
+    while (newSize < required) {
+        newSize += (newSize < kMaxGrowthStep) ? newSize : kMaxGrowthStep;
+    }
+    newSize = (newSize + kMapGranularity - 1) / kMapGranularity * kMapGranularity;
+
+    // Persist what is already written before the mapping moves
+    m_file->Flush(m_writeOffset);
+    m_unsyncedBytes = 0;
+    if (!m_file->Map(newSize)) {
+        // The old mapping is still in place: keep what is committed, drop later turns
+        LOG_ERROR("[TranscriptJournal] Failed to grow journal to " + std::to_string(newSize) +
+                  " bytes, journaling stopped");
+        m_full = true;
+        return false;
+    }
+    return true;
+}
+
+void TranscriptJournal::WritePending(std::vector<Transcript>& batch) {
+    if (m_full || !m_file->data) {
+        return;
+    }
+    uint64_t startOffset = m_writeOffset;
+
+    for (const auto& transcript : batch) {
+        uint16_t userIdLength = static_cast<uint16_t>(std::min<size_t>(transcript.userId.size(), UINT16_MAX));
+        uint32_t textLength = static_cast<uint32_t>(transcript.text.size());
+
+        JournalRecordHeader record;
+        record.totalSize = static_cast<uint32_t>(sizeof(JournalRecordHeader) + userIdLength + textLength);
+        record.turnId = transcript.turnId;
+        record.textLength = textLength;
+        record.userIdLength = userIdLength;
+        record.type = static_cast<uint8_t>(transcript.type);
+        record.status = static_cast<uint8_t>(transcript.status);
+        record.checksum = Fnv1a(transcript.text.data(), textLength,
+                                Fnv1a(transcript.userId.data(), userIdLength));
+
+        if (!EnsureCapacity(m_writeOffset + record.totalSize)) {
+            break;
+        }
+
+        char* dst = m_file->data + m_writeOffset;
+        memcpy(dst, &record, sizeof(record));
+        memcpy(dst + sizeof(record), transcript.userId.data(), userIdLength);
+        memcpy(dst + sizeof(record) + userIdLength, transcript.text.data(), textLength);
+        m_writeOffset += record.totalSize;
+        ++m_recordCount;
+    }
+
+    // Publish the new records only after their bytes are in place
+    std::atomic_thread_fence(std::memory_order_release);
+    JournalHeader* header = reinterpret_cast<JournalHeader*>(m_file->data);
+    header->committedBytes = m_writeOffset;
+    header->recordCount = m_recordCount;
+
+    m_unsyncedBytes += m_writeOffset - startOffset;
+}
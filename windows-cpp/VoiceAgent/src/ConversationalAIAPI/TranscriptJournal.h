@@ -0,0 +1,72 @@
+//
+// TranscriptJournal.h: Crash-safe, memory-mapped journal of finished transcript turns
+//
+#pragma once
+
+#include "ConversationalAIAPI.h"
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+
+/// Streams finished turns into an append-only, memory-mapped session file
+///
+/// File layout: a 64-byte header (magic, committed size, record count, session name)
+/// followed by variable-size records. The header is updated only after a record is
+/// fully written, so a crash never exposes a torn record.
+///
+/// Each record is an upsert keyed by turnId + type + userId: a turn retired or corrected after
+/// it finished is appended again, and Recover() keeps the last record of each turn, in the
+/// position of its first.
+///
+/// Append() only queues the turn under a mutex; a background writer copies queued
+/// turns into the mapping every few hundred milliseconds and flushes it to disk
+/// periodically, so neither the UI nor the RTM thread performs file I/O.
+class TranscriptJournal {
+public:
+    TranscriptJournal();
+    ~TranscriptJournal();
+
+    TranscriptJournal(const TranscriptJournal&) = delete;
+    TranscriptJournal& operator=(const TranscriptJournal&) = delete;
+
+    /// Read all committed turns from an existing journal file, one per turn
+    /// @return false if the file is missing or not a valid journal
+    static bool Recover(const std::string& path, std::vector<Transcript>& transcripts, std::string& sessionName);
+
+    /// Start a new session, replacing any previous journal at path
+    bool Open(const std::string& path, const std::string& sessionName);
+
+    /// Queue a finished turn, or a later state of one, for writing (no I/O on the calling thread)
+    void Append(const Transcript& transcript);
+
+    /// Write everything still queued, flush and close the file
+    void Close();
+
+    bool IsOpen() const { return m_running.load(); }
+
+private:
+    struct MappedFile;
+
+    void WriterLoop();
+    void WritePending(std::vector<Transcript>& batch);
+    bool EnsureCapacity(uint64_t required);
+
+    std::string m_path;
+    MappedFile* m_file;
+    uint64_t m_writeOffset;
+    uint64_t m_recordCount;
+    uint64_t m_unsyncedBytes;
+    bool m_full;                        // The file could not grow; writer thread only
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<Transcript> m_pending;
+    std::atomic<bool> m_running;
+    bool m_stopRequested;
+    std::thread m_writer;
+};
@@ -0,0 +1,147 @@
+//
+// TranscriptSearchBenchmark.cpp: Checks and times TranscriptIndex search on a long synthetic session
+//
+
+#include "../general/pch.h"
+#include "TranscriptSearchBenchmark.h"
+#include "TranscriptIndex.h"
+#include "../tools/BenchmarkUtils.h"
+#include "../tools/Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <sstream>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Chinese text is spelled as UTF-8 escapes so the literals survive any source code page
+#define CJK_WO_YAO_YU_DING "\xe6\x88\x91\xe8\xa6\x81\xe9\xa2\x84\xe8\xae\xa2"   // 我要预订
+#define CJK_DING "\xe8\xae\xa2"                                               // 订
+#define CJK_YU "\xe9\xa2\x84"                                                 // 预
+#define CJK_DING_WRONG "\xe5\xae\x9a"                                         // 定
+#define CJK_NI_HAO "\xe4\xbd\xa0\xe5\xa5\xbd"                                 // 你好
+#define CJK_MING_TIAN "\xe6\x98\x8e\xe5\xa4\xa9"                              // 明天
+#define CJK_XIE_XIE "\xe8\xb0\xa2\xe8\xb0\xa2"                                // 谢谢
+#define CJK_JIAN "\xe8\xa7\x81"                                               // 见
+
+struct SearchCheck {
+    const char* text;
+    const char* query;
+    bool matches;
+};
+
+const SearchCheck kChecks[] = {
+    { CJK_WO_YAO_YU_DING, CJK_DING, true },                 // Last character of a run
+    { CJK_WO_YAO_YU_DING, CJK_DING " ", true },             // ...also when the query is complete
+    { CJK_WO_YAO_YU_DING, CJK_YU, true },                   // Inside a run
+    { CJK_WO_YAO_YU_DING, CJK_YU CJK_DING, true },
+    { CJK_WO_YAO_YU_DING, CJK_WO_YAO_YU_DING, true },
+    { CJK_WO_YAO_YU_DING, CJK_DING_WRONG, false },
+    { CJK_WO_YAO_YU_DING, CJK_DING CJK_YU, false },         // Both characters, wrong order
+    { CJK_WO_YAO_YU_DING CJK_MING_TIAN, CJK_DING, true },   // Followed by more of the run
+    { CJK_JIAN, CJK_JIAN, true },                           // A run of one
+    { "hello " CJK_NI_HAO, "hello " CJK_NI_HAO, true },
+    { "Book a table for two", "TAB", true },                // Prefix of the last term, any case
+    { "Book a table for two", "tab ", false },              // Complete terms match whole words
+    { "Book a table for two", "two book", true },
+};
+
+const char* const kVocabulary[] = {
+    "the", "agent", "said", "that", "weather", "tomorrow", "looks", "sunny", "but", "bring", "an", "umbrella",
+    "could", "you", "book", "a", "table", "for", "two", "at", "seven", "please", "confirm", "order", "number",
+    CJK_NI_HAO, CJK_XIE_XIE, CJK_MING_TIAN, CJK_JIAN, CJK_WO_YAO_YU_DING, CJK_MING_TIAN CJK_JIAN
+};
+
+const char* const kQueries[] = {
+    "table", "tab", "book table", "confirm order num", CJK_DING, CJK_JIAN, CJK_YU CJK_DING, CJK_NI_HAO " sunny"
+};
+
+/// A turn of 3 to 40 words; Chinese words are run together with their neighbours, as ASR emits them
+std::string MakeText(std::mt19937& rng) {
+    size_t vocabulary = sizeof(kVocabulary) / sizeof(kVocabulary[0]);
+    int words = 3 + (int)(rng() % 38);
+    std::string text;
+    for (int i = 0; i < words; ++i) {
+        const char* word = kVocabulary[rng() % vocabulary];
+        if (!text.empty() && (unsigned char)word[0] < 0x80 && (unsigned char)text.back() < 0x80) {
+            text += ' ';
+        }
+        text += word;
+    }
+    return text;
+}
+
+bool IsSingleCjkQuery(const char* query) {
+    return (unsigned char)query[0] >= 0x80 && std::string(query).size() == 3;
+}
+
+}  // namespace
+
+bool TranscriptSearchBenchmark::RunFromCommandLine(const std::string& commandLine) {
+    CommandLineArgs args(commandLine);
+    if (!args.Has("/benchsearch")) {
+        return false;
+    }
+    int turns = (std::max)(1, (int)args.Number("turns", 100000));
+    int runs = (std::max)(1, (int)args.Number("runs", 5));
+
+    size_t passed = 0;
+    for (const SearchCheck& check : kChecks) {
+        TranscriptIndex index;
+        index.Add(0, check.text);
+        bool matches = !index.Search(check.query).empty();
+        if (matches == check.matches) {
+            ++passed;
+        } else {
+            LOG_ERROR(std::string("[TranscriptSearchBenchmark] Check failed: \"") + check.query + "\" in \"" +
+                      check.text + "\" should " + (check.matches ? "match" : "not match"));
+        }
+    }
+    size_t checks = sizeof(kChecks) / sizeof(kChecks[0]);
+    LOG_INFO("[TranscriptSearchBenchmark] " + std::to_string(passed) + "/" + std::to_string(checks) + " checks passed");
+
+    std::mt19937 rng(11);
+    std::vector<std::string> texts;
+    texts.reserve(turns);
+    for (int i = 0; i < turns; ++i) {
+        texts.push_back(MakeText(rng));
+    }
+    TranscriptIndex index;
+    Clock::time_point buildStart = Clock::now();
+    for (int i = 0; i < turns; ++i) {
+        index.Add((uint32_t)i, texts[i]);
+    }
+    double buildMs = MillisecondsSince(buildStart);
+
+    std::ostringstream summary;
+    summary.setf(std::ios::fixed);
+    summary.precision(1);
+    summary << "[TranscriptSearchBenchmark] Indexed " << turns << " turns in " << buildMs << " ms: "
+            << index.TermCount() << " terms, " << index.PostingCount() << " postings";
+    LOG_INFO(summary.str());
+
+    for (const char* query : kQueries) {
+        std::vector<double> samples;
+        size_t matches = 0;
+        for (int run = 0; run < runs; ++run) {
+            Clock::time_point start = Clock::now();
+            matches = index.Search(query).size();
+            samples.push_back(MillisecondsSince(start) * 1000.0);
+        }
+        std::string line = "\"" + std::string(query) + "\" " + std::to_string(matches) + " matches";
+        if (IsSingleCjkQuery(query)) {
+            size_t scanned = std::count_if(texts.begin(), texts.end(), [query](const std::string& text) {
+                return text.find(query) != std::string::npos;
+            });
+            if (scanned != matches) {
+                LOG_ERROR("[TranscriptSearchBenchmark] Check failed: " + line + ", substring scan finds " +
+                          std::to_string(scanned));
+            }
+        }
+        LOG_INFO("[TranscriptSearchBenchmark] " + LatencySummary::Of(samples).Format(line.c_str(), 1, "us"));
+    }
+    return true;
+}
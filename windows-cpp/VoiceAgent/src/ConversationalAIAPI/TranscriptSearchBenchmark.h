@@ -0,0 +1,21 @@
+//
+// TranscriptSearchBenchmark.h: Checks and times TranscriptIndex search on a long synthetic session
+//
+#pragma once
+
+#include <string>
+
+/// Runs "/benchsearch [turns=N] [runs=N]" and logs the report
+///
+/// First runs a table of query checks against one-turn indexes, covering the CJK cases bigram
+/// indexing gets wrong (a single character ending a run, as in "我要预订" searched for "订"),
+/// and logs every mismatch. Then indexes turns synthetic turns (100000 by default) mixing English
+/// words and Chinese phrases, and times Search() for a fixed set of queries, runs times each (5).
+/// For the one-character Chinese queries the results are compared with a substring scan of the
+/// same texts. Reported: checks passed, index build time, terms and postings, per-query search
+/// percentiles in microseconds and match counts.
+class TranscriptSearchBenchmark {
+public:
+    /// Returns false, doing nothing, for other command lines
+    static bool RunFromCommandLine(const std::string& commandLine);
+};
@@ -0,0 +1,210 @@
+//
+// TranscriptStore.cpp: Append-only transcript history for long sessions
+//
+
+#include "../general/pch.h"
+#include "TranscriptStore.h"
+
+#include <climits>
+
+static const size_t kNotFound = SIZE_MAX;
+static const size_t kInitialArenaBytes = 64 * 1024;
+
+TranscriptStore::TranscriptStore()
+    : m_firstDirty(SIZE_MAX) {
+    m_maxTurnId[0] = INT32_MIN;
+    m_maxTurnId[1] = INT32_MIN;
+    m_arena.reserve(kInitialArenaBytes);
+}
+
+uint16_t TranscriptStore::InternUserId(const std::string& userId) {
+    auto it = m_userIdLookup.find(userId);
+    if (it != m_userIdLookup.end()) {
+        return it->second;
+    }
+    uint16_t index = static_cast<uint16_t>(m_userIds.size());
+    m_userIds.push_back(userId);
+    m_userIdLookup.emplace(userId, index);
+    return index;
+}
+
+size_t TranscriptStore::FindRecord(int turnId, uint8_t type, uint16_t userIndex) const {
+    // Live turns are the usual target and there are only a few of them
+    for (const auto& live : m_live) {
+        const TranscriptRecord& r = m_records[live.recordIndex];
+        if (r.turnId == turnId && r.type == type && r.userIndex == userIndex) {
+            return live.recordIndex;
+        }
+    }
+
+    // Turn ids grow monotonically per type, so a larger id is always a new turn
+    if (type < 2 && turnId > m_maxTurnId[type]) {
+        return kNotFound;
+    }
+
+    // Late update for a finished turn: these are recent, so scan from the tail
+    for (size_t i = m_records.size(); i-- > 0;) {
+        const TranscriptRecord& r = m_records[i];
+        if (r.turnId == turnId && r.type == type && r.userIndex == userIndex) {
+            return i;
+        }
+    }
+    return kNotFound;
+}
+
+uint32_t TranscriptStore::AppendToArena(const std::string& text) {
+    uint32_t offset = static_cast<uint32_t>(m_arena.size());
+    m_arena.insert(m_arena.end(), text.begin(), text.end());
+    return offset;
+}
+
+void TranscriptStore::Finish(size_t index) {
+    TranscriptRecord& record = m_records[index];
+    uint32_t slot = record.offset;
+    LiveTurn& live = m_live[slot];
+
+    record.offset = AppendToArena(live.text);
+    record.length = static_cast<uint32_t>(live.text.size());
+    m_index.Add(static_cast<uint32_t>(index), live.text);
+
+    // Swap-remove the live slot and repoint the record that moved into it
+    if (slot != m_live.size() - 1) {
+        m_live[slot] = std::move(m_live.back());
+        m_records[m_live[slot].recordIndex].offset = slot;
+    }
+    m_live.pop_back();
+}
+
+void TranscriptStore::RetireStaleAgentTurns(int32_t turnId, uint16_t userIndex, std::vector<uint32_t>* settled) {
+    // Iterating backwards keeps Finish()'s swap-remove from skipping a slot
+    for (size_t slot = m_live.size(); slot-- > 0;) {
+        uint32_t recordIndex = m_live[slot].recordIndex;
+        TranscriptRecord& record = m_records[recordIndex];
+        if (record.type == static_cast<uint8_t>(TranscriptType::Agent) && record.userIndex == userIndex &&
+            record.turnId < turnId) {
+            record.status = static_cast<uint8_t>(TranscriptStatus::Interrupted);
+            Finish(recordIndex);
+            MarkDirty(recordIndex);
+            if (settled) {
+                settled->push_back(recordIndex);
+            }
+        }
+    }
+}
+
+TranscriptStore::UpsertResult TranscriptStore::Upsert(const Transcript& transcript, std::vector<uint32_t>* settled) {
+    uint8_t type = static_cast<uint8_t>(transcript.type);
+    uint8_t status = static_cast<uint8_t>(transcript.status);
+    uint16_t userIndex = InternUserId(transcript.userId);
+    bool finished = IsFinished(transcript.status);
+
+    size_t index = FindRecord(transcript.turnId, type, userIndex);
+    if (index == kNotFound) {
+        if (type < 2 && transcript.turnId > m_maxTurnId[type]) {
+            m_maxTurnId[type] = transcript.turnId;
+            // An agent turn cut off by message.interrupt never gets a final update: once the agent
+            // moves on, its earlier in-progress turns are over
+            if (transcript.type == TranscriptType::Agent) {
+                RetireStaleAgentTurns(transcript.turnId, userIndex, settled);
+            }
+        }
+        index = m_records.size();
+
+        TranscriptRecord record = {};
+        record.turnId = transcript.turnId;
+        record.userIndex = userIndex;
+        record.type = type;
+        record.status = status;
+        if (finished) {
+            record.offset = AppendToArena(transcript.text);
+            record.length = static_cast<uint32_t>(transcript.text.size());
+            m_index.Add(static_cast<uint32_t>(index), transcript.text);
+        } else {
+            record.offset = static_cast<uint32_t>(m_live.size());
+            m_live.push_back({ static_cast<uint32_t>(index), transcript.text });
+        }
+        m_records.push_back(record);
+        MarkDirty(index);
+        if (finished && settled) {
+            settled->push_back(static_cast<uint32_t>(index));
+        }
+        return { index, finished };
+    }
+
+    TranscriptRecord& record = m_records[index];
+    bool wasFinished = IsFinished(static_cast<TranscriptStatus>(record.status));
+    MarkDirty(index);
+
+    if (wasFinished) {
+        // Rare correction of a finished turn: append the new text, the old bytes become dead space
+        // The index only gains the new terms; stale ones may produce an extra hit, never a miss
+        // A finished turn stays finished (its offset points into the arena, not the live table)
+        bool changed = false;
+        if (finished && record.status != status) {
+            record.status = status;
+            changed = true;
+        }
+        std::string_view current(m_arena.data() + record.offset, record.length);
+        if (current != transcript.text) {
+            record.offset = AppendToArena(transcript.text);
+            record.length = static_cast<uint32_t>(transcript.text.size());
+            m_index.Add(static_cast<uint32_t>(index), transcript.text);
+            changed = true;
+        }
+        if (changed && settled) {
+            settled->push_back(static_cast<uint32_t>(index));
+        }
+        return { index, false };
+    }
+
+    record.status = status;
+    m_live[record.offset].text = transcript.text;
+    if (finished) {
+        Finish(index);
+        if (settled) {
+            settled->push_back(static_cast<uint32_t>(index));
+        }
+    }
+    return { index, finished };
+}
+
+std::string_view TranscriptStore::GetText(size_t index) const {
+    const TranscriptRecord& record = m_records[index];
+    if (IsFinished(static_cast<TranscriptStatus>(record.status))) {
+        return std::string_view(m_arena.data() + record.offset, record.length);
+    }
+    return m_live[record.offset].text;
+}
+
+const std::string& TranscriptStore::GetUserId(size_t index) const {
+    return m_userIds[m_records[index].userIndex];
+}
+
+Transcript TranscriptStore::Get(size_t index) const {
+    std::string_view text = GetText(index);
+    return Transcript(m_records[index].turnId, GetUserId(index), std::string(text.data(), text.size()),
+                      GetStatus(index), GetType(index));
+}
+
+size_t TranscriptStore::MemoryUsage() const {
+    size_t bytes = m_records.capacity() * sizeof(TranscriptRecord) + m_arena.capacity();
+    for (const auto& live : m_live) {
+        bytes += sizeof(LiveTurn) + live.text.capacity();
+    }
+    for (const auto& userId : m_userIds) {
+        bytes += sizeof(std::string) + userId.capacity();
+    }
+    return bytes;
+}
+
+void TranscriptStore::Clear() {
+    m_records.clear();
+    m_arena.clear();
+    m_live.clear();
+    m_userIds.clear();
+    m_userIdLookup.clear();
+    m_maxTurnId[0] = INT32_MIN;
+    m_maxTurnId[1] = INT32_MIN;
+    m_firstDirty = SIZE_MAX;
+    m_index.Clear();
+}
@@ -0,0 +1,105 @@
+//
+// TranscriptStore.h: Append-only transcript history for long sessions
+//
+#pragma once
+
+#include "ConversationalAIAPI.h"
+#include "TranscriptIndex.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+/// Fixed-size index entry for one turn (16 bytes)
+/// Finished turns point into the text arena; in-progress turns point into the live table
+struct TranscriptRecord {
+    int32_t turnId;
+    uint32_t offset;     // Arena offset (finished) or live slot (in progress)
+    uint32_t length;     // Text length in bytes (finished turns only)
+    uint16_t userIndex;  // Interned userId
+    uint8_t type;        // TranscriptType
+    uint8_t status;      // TranscriptStatus
+};
+
+/// Transcript history kept as a contiguous text arena plus a compact turn index
+/// Only in-progress turns own a mutable string; finished turns are immutable slices of the arena
+/// Not thread-safe: callers serialize access
+class TranscriptStore {
+public:
+    struct UpsertResult {
+        size_t index;   // Position of the turn in display order
+        bool finished;  // True when this update moved the turn to End/Interrupted
+    };
+
+    TranscriptStore();
+
+    /// Insert a new turn or update an existing one (matched by turnId + type + userId)
+    /// settled (optional) receives every turn whose final text or status this call set: the turn
+    /// itself when it finishes or a finished turn is corrected, and agent turns it retired
+    UpsertResult Upsert(const Transcript& transcript, std::vector<uint32_t>* settled = nullptr);
+
+    /// Number of turns in display (first-seen) order
+    size_t Size() const { return m_records.size(); }
+    bool Empty() const { return m_records.empty(); }
+
+    /// Zero-copy access; the view is valid until the next Upsert/Clear
+    std::string_view GetText(size_t index) const;
+    const std::string& GetUserId(size_t index) const;
+    const TranscriptRecord& GetRecord(size_t index) const { return m_records[index]; }
+    TranscriptType GetType(size_t index) const { return static_cast<TranscriptType>(m_records[index].type); }
+    TranscriptStatus GetStatus(size_t index) const { return static_cast<TranscriptStatus>(m_records[index].status); }
+
+    /// Materialize a turn as a Transcript (copies text and userId)
+    Transcript Get(size_t index) const;
+
+    /// Lowest index modified since the last ClearDirty(), or Size() when nothing changed
+    size_t FirstDirtyIndex() const { return m_firstDirty < m_records.size() ? m_firstDirty : m_records.size(); }
+    void ClearDirty() { m_firstDirty = SIZE_MAX; }
+
+    /// Finished turns containing every query term (last term matched as a prefix), ascending
+    std::vector<uint32_t> Search(std::string_view query, size_t maxResults = SIZE_MAX) const {
+        return m_index.Search(query, maxResults);
+    }
+    const TranscriptIndex& Index() const { return m_index; }
+
+    size_t LiveCount() const { return m_live.size(); }
+    size_t ArenaBytes() const { return m_arena.size(); }
+    size_t MemoryUsage() const;
+
+    void Clear();
+
+private:
+    struct LiveTurn {
+        uint32_t recordIndex;
+        std::string text;
+    };
+
+    static bool IsFinished(TranscriptStatus status) {
+        return status == TranscriptStatus::End || status == TranscriptStatus::Interrupted;
+    }
+
+    uint16_t InternUserId(const std::string& userId);
+    size_t FindRecord(int turnId, uint8_t type, uint16_t userIndex) const;
+    uint32_t AppendToArena(const std::string& text);
+    void Finish(size_t index);
+    void RetireStaleAgentTurns(int32_t turnId, uint16_t userIndex, std::vector<uint32_t>* settled);
+    void MarkDirty(size_t index) { if (index < m_firstDirty) m_firstDirty = index; }
+
+    std::vector<TranscriptRecord> m_records;
+    std::vector<char> m_arena;
+    std::vector<LiveTurn> m_live;
+
+    // Interned user ids (a session normally has two)
+    std::vector<std::string> m_userIds;
+    std::unordered_map<std::string, uint16_t> m_userIdLookup;
+
+    // Highest turnId seen per type: anything above it is a new turn and needs no lookup
+    int32_t m_maxTurnId[2];
+    size_t m_firstDirty;
+
+    // Search index over finished turns, fed as each turn finalizes
+    TranscriptIndex m_index;
+};
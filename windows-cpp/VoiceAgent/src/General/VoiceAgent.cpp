@@ -8,6 +8,13 @@
 #include "VoiceAgent.h"
 #include "../ui/MainFrm.h"
 #include "../tools/Logger.h"
+#include "../tools/StringUtils.h"
+#include "../api/AgentLoadDriver.h"
+#include "../api/HttpLoadBenchmark.h"
+#include "../ConversationalAIAPI/ImagePreparerBenchmark.h"
+#include "../ConversationalAIAPI/TranscriptExportBenchmark.h"
+#include "../ConversationalAIAPI/PresenceStateBenchmark.h"
+#include "../ConversationalAIAPI/TranscriptSearchBenchmark.h"
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -71,6 +78,24 @@ BOOL CVoiceAgentApp::InitInstance()
 
 	LOG_INFO("VoiceAgent application starting...");
 
+	// VoiceAgent.exe /loadtest [clients=N seconds=N ...]: 用本地模拟服务器压测 AgentManager；
+	// VoiceAgent.exe /benchimage [runs=N ...]: 4K 截图的 ImagePreparer 性能测试；
+	// VoiceAgent.exe /benchexport [turns=N ...]: 10 万轮转录的 TranscriptExporter 导出性能测试；
+	// VoiceAgent.exe /benchpresence [events=N ...]: RTM presence 状态更新吞吐量测试；
+	// VoiceAgent.exe /benchsearch [turns=N ...]: 转录搜索的正确性检查（含中文单字查询）与 10 万轮搜索耗时；
+	// VoiceAgent.exe /benchhttp [requests=N concurrency=N ...]: 本地 HTTP 服务器上的 HttpClient 并发请求测试。
+	// 结果写入日志后直接退出（参数见各 *Benchmark.h 及 AgentLoadDriver.h）
+	std::string commandLine = StringUtils::CStringToUtf8(CString(m_lpCmdLine));
+	if (AgentLoadDriver::RunFromCommandLine(commandLine) ||
+		ImagePreparerBenchmark::RunFromCommandLine(commandLine) ||
+		TranscriptExportBenchmark::RunFromCommandLine(commandLine) ||
+		PresenceStateBenchmark::RunFromCommandLine(commandLine) ||
+		TranscriptSearchBenchmark::RunFromCommandLine(commandLine) ||
+		HttpLoadBenchmark::RunFromCommandLine(commandLine))
+	{
+		return FALSE;
+	}
+
 	// 初始化日志系统
 	LOG_INFO("Application initialization started");
 
@@ -0,0 +1,254 @@
+// AgentLoadDriver.cpp: Load generator for AgentManager start/stop cycles
+//
+
+#include "../general/pch.h"
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <future>
+#include <chrono>
+#include <sstream>
+#include "AgentLoadDriver.h"
+#include "AgentManager.h"
+#include "TokenGenerator.h"
+#include "HttpClient.h"
+#include "../tools/BenchmarkUtils.h"
+#include "../tools/Logger.h"
+#include <algorithm>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// A step whose callback never comes (e.g. the transport was shut down) counts as failed
+const auto kStepTimeout = std::chrono::seconds(120);
+
+struct StepResult {
+    bool success = false;
+    std::string value;              // Token, agent ID or error
+};
+
+// Start one asynchronous step and wait for its callback
+template <typename StartStep>
+StepResult Await(StartStep startStep) {
+    auto promise = std::make_shared<std::promise<StepResult>>();
+    std::future<StepResult> future = promise->get_future();
+    startStep([promise](bool success, const std::string& value) {
+        StepResult result;
+        result.success = success;
+        result.value = value;
+        promise->set_value(result);
+    });
+    if (future.wait_for(kStepTimeout) != std::future_status::ready) {
+        return StepResult{ false, "no callback" };
+    }
+    return future.get();
+}
+
+// Samples and counters of all simulated users
+struct LoadState {
+    std::mutex mutex;
+    std::vector<double> token;
+    std::vector<double> start;
+    std::vector<double> stop;
+    std::vector<double> cycle;
+    std::vector<double> failed;     // Failed steps of any kind, kept out of the per-step samples
+    uint64_t cycles = 0;
+    uint64_t failedTokens = 0;
+    uint64_t failedStarts = 0;
+    uint64_t failedStops = 0;
+};
+
+// One step's time goes into samples if it succeeded, else into the failed samples and counter.
+// Returns success.
+bool RecordStep(LoadState& state, std::vector<double>& samples, uint64_t& failures, double ms, bool success) {
+    std::lock_guard<std::mutex> lock(state.mutex);
+    if (success) {
+        samples.push_back(ms);
+    } else {
+        state.failed.push_back(ms);
+        ++failures;
+    }
+    return success;
+}
+
+// After a failed step, like a user retrying: an error that comes back at once (429, connection
+// refused) would otherwise turn the loop into a flood of requests
+void Backoff(const AgentLoadConfig& config) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(config.failureBackoffMs));
+}
+
+void RunUser(int user, const AgentLoadConfig& config, Clock::time_point end, LoadState& state) {
+    for (int cycle = 0; Clock::now() < end; ++cycle) {
+        // The agent name is the channel name, which the server keeps unique among running agents
+        std::string channel = "load-" + std::to_string(user) + "-" + std::to_string(cycle);
+        std::string userUid = std::to_string(100000 + user);
+        std::string agentUid = std::to_string(200000 + user);
+        Clock::time_point cycleStart = Clock::now();
+        double cycleMs = 0;
+
+        std::string token;
+        if (config.generateToken) {
+            Clock::time_point stepStart = Clock::now();
+            StepResult result = Await([&](AgentCallback done) {
+                TokenGenerator::GenerateToken(channel, userUid, 86400, { AgoraTokenType::RTC, AgoraTokenType::RTM },
+                    [done](bool success, const std::string& token, const std::string& error) {
+                        done(success, success ? token : error);
+                    });
+            });
+            if (!RecordStep(state, state.token, state.failedTokens, MillisecondsSince(stepStart), result.success)) {
+                Backoff(config);
+                continue;
+            }
+            token = result.value;
+        }
+
+        Clock::time_point stepStart = Clock::now();
+        StepResult started = Await([&](AgentCallback done) {
+            AgentManager::StartAgent(channel, agentUid, token, done);
+        });
+        if (!RecordStep(state, state.start, state.failedStarts, MillisecondsSince(stepStart), started.success)) {
+            Backoff(config);
+            continue;
+        }
+        cycleMs = MillisecondsSince(cycleStart);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(config.holdMs));
+
+        stepStart = Clock::now();
+        StepResult stopped = Await([&](AgentCallback done) {
+            AgentManager::StopAgent(started.value, done);
+        });
+        double ms = MillisecondsSince(stepStart);
+        if (!RecordStep(state, state.stop, state.failedStops, ms, stopped.success)) {
+            Backoff(config);
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        ++state.cycles;
+        state.cycle.push_back(cycleMs + ms);
+    }
+}
+
+LoopbackLatency Scaled(LoopbackLatency latency, double scale) {
+    latency.medianMs = (int)(latency.medianMs * scale);
+    latency.p99Ms = (int)(latency.p99Ms * scale);
+    return latency;
+}
+
+}  // namespace
+
+AgentLoadReport AgentLoadDriver::Run(const AgentLoadConfig& config) {
+    LOG_INFO("[AgentLoadDriver] " + std::to_string(config.clients) + " clients for " +
+             std::to_string(config.durationSeconds) + " s, hold " + std::to_string(config.holdMs) + " ms");
+    if (!config.verbose) {
+        Logger::instance().setLogLevel(LogLevel::Warn);
+    }
+
+    StepResult health = Await([](AgentCallback done) { AgentManager::CheckServerHealth(done); });
+    if (!health.success) {
+        LOG_WARN("[AgentLoadDriver] Server health check failed: " + health.value);
+    }
+
+    LoadState state;
+    HttpRetryStats before = HttpClient::GetRetryStats();
+    Clock::time_point start = Clock::now();
+    Clock::time_point end = start + std::chrono::seconds(config.durationSeconds);
+    std::vector<std::thread> users;
+    for (int user = 0; user < config.clients; ++user) {
+        users.emplace_back(RunUser, user, std::cref(config), end, std::ref(state));
+    }
+    for (std::thread& user : users) {
+        user.join();
+    }
+
+    Logger::instance().setLogLevel(LogLevel::Info);
+    AgentLoadReport report;
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    report.cycles = state.cycles;
+    report.failedTokens = state.failedTokens;
+    report.failedStarts = state.failedStarts;
+    report.failedStops = state.failedStops;
+    report.httpRequests = HttpClient::GetRetryStats().requests - before.requests;
+    report.cyclesPerSecond = report.seconds > 0 ? report.cycles / report.seconds : 0;
+    report.requestsPerSecond = report.seconds > 0 ? report.httpRequests / report.seconds : 0;
+    report.token = LatencySummary::Of(state.token);
+    report.start = LatencySummary::Of(state.start);
+    report.stop = LatencySummary::Of(state.stop);
+    report.cycle = LatencySummary::Of(state.cycle);
+    report.failed = LatencySummary::Of(state.failed);
+    return report;
+}
+
+void AgentLoadDriver::LogReport(const AgentLoadReport& report) {
+    std::ostringstream summary;
+    summary.setf(std::ios::fixed);
+    summary.precision(1);
+    summary << "[AgentLoadDriver] " << report.seconds << " s: " << report.cycles << " cycles (" << report.cyclesPerSecond
+            << "/s), " << report.httpRequests << " requests (" << report.requestsPerSecond << "/s), failed: "
+            << report.failedTokens << " tokens, " << report.failedStarts << " starts, " << report.failedStops << " stops";
+    LOG_INFO(summary.str());
+    if (!report.transport.empty()) {
+        LOG_INFO("[AgentLoadDriver] Transport: " + report.transport);
+    }
+    LOG_INFO("[AgentLoadDriver] " + report.token.Format("token", 0));
+    LOG_INFO("[AgentLoadDriver] " + report.start.Format("start", 0));
+    LOG_INFO("[AgentLoadDriver] " + report.stop.Format("stop", 0));
+    LOG_INFO("[AgentLoadDriver] " + report.cycle.Format("cycle", 0));
+    if (report.failed.count > 0) {
+        LOG_INFO("[AgentLoadDriver] " + report.failed.Format("failed steps", 0));
+    }
+    HttpClient::LogStats();
+}
+
+bool AgentLoadDriver::RunFromCommandLine(const std::string& commandLine) {
+    CommandLineArgs args(commandLine);
+    if (!args.Has("/loadtest")) {
+        return false;
+    }
+    auto number = [&args](const char* key, double fallback) { return args.Number(key, fallback); };
+
+    AgentLoadConfig load;
+    load.clients = (std::max)(1, (int)number("clients", load.clients));
+    load.durationSeconds = (std::max)(1, (int)number("seconds", load.durationSeconds));
+    load.holdMs = (std::max)(0, (int)number("hold", load.holdMs));
+    load.failureBackoffMs = (std::max)(0, (int)number("backoff", load.failureBackoffMs));
+    load.generateToken = number("token", 1) != 0;
+    load.verbose = number("verbose", 0) != 0;
+
+    LocalAgentServerConfig server;
+    double scale = number("latency", 1.0);
+    server.joinLatency = Scaled(server.joinLatency, scale);
+    server.leaveLatency = Scaled(server.leaveLatency, scale);
+    server.healthLatency = Scaled(server.healthLatency, scale);
+    server.tokenLatency = Scaled(server.tokenLatency, scale);
+    server.errorRate = number("errors", server.errorRate);
+    server.resetRate = number("resets", server.resetRate);
+    server.lostResponseRate = number("lost", server.lostResponseRate);
+    server.rateLimitPerSecond = (int)number("rate", server.rateLimitPerSecond);
+    server.rateLimitBurst = (int)number("burst", server.rateLimitBurst);
+    server.seed = (uint32_t)number("seed", server.seed);
+    server.inMemory = args.Text("transport", "curl") == "loopback";
+
+    LocalAgentServer localServer(server);
+    if (!localServer.Install()) {
+        LOG_ERROR("[AgentLoadDriver] Local server did not start, no load run");
+        return true;
+    }
+    AgentLoadReport report = Run(load);
+    report.transport = localServer.TransportName();
+    LogReport(report);
+
+    LocalAgentServerStats stats = localServer.Stats();
+    LOG_INFO("[LocalAgentServer] joins=" + std::to_string(stats.joins) + " leaves=" + std::to_string(stats.leaves) +
+             " conflicts=" + std::to_string(stats.conflicts) + " notFound=" + std::to_string(stats.notFound) +
+             " rateLimited=" + std::to_string(stats.rateLimited) + " injectedErrors=" +
+             std::to_string(stats.injectedErrors) + " lostResponses=" + std::to_string(stats.lostResponses) +
+             " conflictsAfterLoss=" + std::to_string(stats.conflictsAfterLoss) + " notFoundAfterLoss=" +
+             std::to_string(stats.notFoundAfterLoss) + " tokens=" + std::to_string(stats.tokens) + " peakAgents=" +
+             std::to_string(stats.peakAgents) + " stillRunning=" + std::to_string(stats.runningAgents) +
+             " connections=" + std::to_string(stats.connections));
+    localServer.Uninstall();
+    return true;
+}
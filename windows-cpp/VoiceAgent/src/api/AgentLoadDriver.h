@@ -0,0 +1,55 @@
+// AgentLoadDriver.h: Load generator for AgentManager start/stop cycles
+//
+#pragma once
+
+#include <string>
+#include <cstdint>
+#include "LocalAgentServer.h"
+#include "../tools/BenchmarkUtils.h"
+
+/// Shape of the load
+struct AgentLoadConfig {
+    int clients = 20;               // Simulated users running cycles concurrently, back to back
+    int durationSeconds = 30;       // No new cycles after this; running ones finish
+    int holdMs = 1000;              // How long each agent stays up between start and stop
+    int failureBackoffMs = 500;     // Pause after a failed step before the user's next cycle
+    bool generateToken = true;      // Fetch a token before each start, like a real session
+    bool verbose = false;           // Keep the per-request Info logging during the run
+};
+
+/// Latency percentiles of one step, in milliseconds
+using AgentLoadLatency = LatencySummary;
+
+struct AgentLoadReport {
+    std::string transport;          // What the requests went through (set by the caller)
+    double seconds = 0;
+    uint64_t cycles = 0;            // Token, start and stop all succeeded
+    uint64_t failedTokens = 0;
+    uint64_t failedStarts = 0;
+    uint64_t failedStops = 0;
+    uint64_t httpRequests = 0;      // Logical requests (retries and hedges not counted)
+    double cyclesPerSecond = 0;
+    double requestsPerSecond = 0;
+    AgentLoadLatency token;
+    AgentLoadLatency start;
+    AgentLoadLatency stop;
+    AgentLoadLatency cycle;         // Token + start + stop, hold excluded
+    AgentLoadLatency failed;        // Failed steps, which the per-step figures leave out
+};
+
+/// Runs StartAgent/StopAgent cycles through AgentManager (and TokenGenerator) from many
+/// concurrent simulated users, measuring what the callers see: retries, hedges and backoff
+/// included. Requests go to whatever transport HttpClient uses by default.
+class AgentLoadDriver {
+public:
+    static AgentLoadReport Run(const AgentLoadConfig& config);
+    static void LogReport(const AgentLoadReport& report);
+
+    /// Handles "/loadtest [clients=N] [seconds=N] [hold=MS] [backoff=MS] [token=0|1] [verbose=0|1]
+    /// [latency=SCALE] [errors=RATE] [resets=RATE] [lost=RATE] [rate=PER_SECOND] [burst=N] [seed=N]
+    /// [transport=curl|loopback]": runs the load against a LocalAgentServer and logs the report.
+    /// latency scales the server's default latencies (2: twice as slow). transport=curl (the
+    /// default) serves over TCP on 127.0.0.1 through CurlTransport; loopback answers in memory and
+    /// skips CurlTransport entirely. Returns false, doing nothing, for other command lines.
+    static bool RunFromCommandLine(const std::string& commandLine);
+};
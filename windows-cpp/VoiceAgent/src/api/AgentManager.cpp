@@ -7,6 +7,7 @@
 #include "HttpClient.h"
 #include "../KeyCenter.h"
 #include "../tools/Logger.h"
+#include "../tools/Base64.h"
 
 #include <nlohmann/json.hpp>
 #include <sstream>
@@ -15,66 +16,16 @@ using json = nlohmann::json;
 
 // Helper Functions
 
-#include <curl/curl.h>
-
-static std::string Base64Encode(const std::string& input) {
-    // Use libcurl's base64 encoding
-    char* encoded = curl_easy_escape(nullptr, input.c_str(), (int)input.length());
-    
-    // Actually, let's use proper base64 encoding
-    static const char base64_chars[] = 
-        "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-        "abcdefghijklmnopqrstuvwxyz"
-        "0123456789+/";
-    
-    std::string ret;
-    int i = 0;
-    int j = 0;
-    unsigned char char_array_3[3];
-    unsigned char char_array_4[4];
-    const unsigned char* bytes_to_encode = (const unsigned char*)input.c_str();
-    size_t in_len = input.length();
-
-    while (in_len--) {
-        char_array_3[i++] = *(bytes_to_encode++);
-        if (i == 3) {
-            char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-            char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-            char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-            char_array_4[3] = char_array_3[2] & 0x3f;
-
-            for(i = 0; i < 4; i++)
-                ret += base64_chars[char_array_4[i]];
-            i = 0;
-        }
-    }
-
-    if (i) {
-        for(j = i; j < 3; j++)
-            char_array_3[j] = '\0';
-
-        char_array_4[0] = (char_array_3[0] & 0xfc) >> 2;
-        char_array_4[1] = ((char_array_3[0] & 0x03) << 4) + ((char_array_3[1] & 0xf0) >> 4);
-        char_array_4[2] = ((char_array_3[1] & 0x0f) << 2) + ((char_array_3[2] & 0xc0) >> 6);
-
-        for (j = 0; j < i + 1; j++)
-            ret += base64_chars[char_array_4[j]];
-
-        while((i++ < 3))
-            ret += '=';
-    }
-
-    return ret;
-}
-
-std::string AgentManager::GenerateAuthorization() {
-    std::string credentials = std::string(KeyCenter::REST_KEY) + ":" + std::string(KeyCenter::REST_SECRET);
-    return "Basic " + Base64Encode(credentials);
+const std::string& AgentManager::GenerateAuthorization() {
+    // The credentials are compile-time constants: encode them once, not on every request
+    static const std::string authorization =
+        "Basic " + Base64::Encode(std::string(KeyCenter::REST_KEY) + ":" + std::string(KeyCenter::REST_SECRET));
+    return authorization;
 }
 
 // AgentManager Implementation (using HttpClient with libcurl)
 
-void AgentManager::StartAgent(
+std::shared_ptr<HttpRequest> AgentManager::StartAgent(
     const std::string& channelName,
     const std::string& agentRtcUid,
     const std::string& token,
@@ -111,9 +62,22 @@ void AgentManager::StartAgent(
     // ✅ Use HttpClient (libcurl) - automatically handles all redirects including 308!
     HttpClient client;
     client.SetTimeout(30);
+    client.SetMetricsName("agent.join");
     
-    client.PostAsync(urlString, requestBodyStr, headers,
+    // Not idempotent: a join the server acted on but whose answer was lost gets 409 when sent
+    // again, and the agent it started would never be stopped. Retry only what the server surely
+    // did not act on (connect failures, 429, 503), and never hedge.
+    HttpRetryPolicy retry;
+    retry.maxAttempts = 3;
+    retry.idempotent = false;
+    client.SetRetryPolicy(retry);
+    
+    return client.PostAsync(urlString, requestBodyStr, headers,
         [callback](bool success, const std::string& response, int statusCode) {
+            if (statusCode == HttpClient::kStatusCanceled) {
+                LOG_INFO("[AgentManager] Start request canceled");
+                return;
+            }
             if (!success) {
                 LOG_ERROR("[AgentManager] Request failed: " + response);
                 if (callback) {
@@ -151,7 +115,7 @@ void AgentManager::StartAgent(
     );
 }
 
-void AgentManager::StopAgent(
+std::shared_ptr<HttpRequest> AgentManager::StopAgent(
     const std::string& agentId,
     AgentCallback callback
 ) {
@@ -172,9 +136,20 @@ void AgentManager::StopAgent(
     // ✅ Use HttpClient (libcurl) - automatically handles all redirects including 308!
     HttpClient client;
     client.SetTimeout(30);
+    client.SetMetricsName("agent.leave");
+    
+    // Leaving twice is harmless
+    HttpRetryPolicy retry;
+    retry.maxAttempts = 3;
+    retry.idempotent = true;
+    client.SetRetryPolicy(retry);
     
-    client.PostAsync(urlString, "", headers,
+    return client.PostAsync(urlString, "", headers,
         [callback](bool success, const std::string& response, int statusCode) {
+            if (statusCode == HttpClient::kStatusCanceled) {
+                LOG_INFO("[AgentManager] Stop request canceled");
+                return;
+            }
             if (!success) {
                 LOG_ERROR("[AgentManager] Stop request failed: " + response);
                 if (callback) {
@@ -191,7 +166,7 @@ void AgentManager::StopAgent(
     );
 }
 
-void AgentManager::CheckServerHealth(AgentCallback callback) {
+std::shared_ptr<HttpRequest> AgentManager::CheckServerHealth(AgentCallback callback) {
     std::string baseURL = KeyCenter::AGENT_SERVER_BASE_URL;
     
     // Health check only for local server
@@ -200,7 +175,7 @@ void AgentManager::CheckServerHealth(AgentCallback callback) {
         if (callback) {
             callback(true, "Agora API (assumed healthy)");
         }
-        return;
+        return nullptr;
     }
     
     std::string urlString = baseURL + "/health";
@@ -209,10 +184,11 @@ void AgentManager::CheckServerHealth(AgentCallback callback) {
     
     HttpClient client;
     client.SetTimeout(5);
+    client.SetMetricsName("agent.health");
     
-    client.PostAsync(urlString, "", headers,
+    return client.PostAsync(urlString, "", headers,
         [callback](bool success, const std::string& response, int statusCode) {
-            if (callback) {
+            if (callback && statusCode != HttpClient::kStatusCanceled) {
                 callback(success && statusCode == 200, response);
             }
         }
@@ -2,6 +2,9 @@
 
 #include <string>
 #include <functional>
+#include <memory>
+
+class HttpRequest;
 
 // Agent operation callback
 using AgentCallback = std::function<void(bool success, const std::string& agentIdOrError)>;
@@ -9,6 +12,8 @@ using AgentCallback = std::function<void(bool success, const std::string& agentI
 // Agent Manager
 // Unified interface for starting/stopping AI agents
 // Supports both local server and Agora API
+// Each call returns a handle that cancels its request; callbacks are not called for
+// canceled requests.
 class AgentManager {
 public:
     /// Start an agent
@@ -16,7 +21,7 @@ public:
     /// @param agentRtcUid Agent RTC UID
     /// @param token Agent token (required)
     /// @param callback Completion handler with success flag and agentId or error message
-    static void StartAgent(
+    static std::shared_ptr<HttpRequest> StartAgent(
         const std::string& channelName,
         const std::string& agentRtcUid,
         const std::string& token,
@@ -26,18 +31,19 @@ public:
     /// Stop an agent
     /// @param agentId Agent ID returned from StartAgent
     /// @param callback Completion handler with success flag and error message if failed
-    static void StopAgent(
+    static std::shared_ptr<HttpRequest> StopAgent(
         const std::string& agentId,
         AgentCallback callback = nullptr
     );
     
     /// Check server health (for debugging)
     /// @param callback Completion handler with success flag and response
-    static void CheckServerHealth(AgentCallback callback = nullptr);
+    /// @return Request handle, or null when no request was needed
+    static std::shared_ptr<HttpRequest> CheckServerHealth(AgentCallback callback = nullptr);
     
 private:
-    // Generate Basic Authorization header (Base64 encoded REST_KEY:REST_SECRET)
-    static std::string GenerateAuthorization();
+    // Basic Authorization header (Base64 encoded REST_KEY:REST_SECRET), built on first use
+    static const std::string& GenerateAuthorization();
     
     // HTTP POST request helper
     static void PostRequest(
@@ -0,0 +1,955 @@
+// CurlTransport.cpp: HttpClient transport over libcurl
+//
+
+#include "../general/pch.h"
+#include <memory>
+#include <thread>
+#include <sstream>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <random>
+#include "CurlTransport.h"
+#include "../tools/Logger.h"
+#include <curl/curl.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+namespace {
+
+// One logical request: its attempts (first try, retries, a hedge) and the single completion.
+// Filled in by Post; once the first attempt is submitted only the I/O thread touches it.
+struct HttpCall {
+    std::shared_ptr<HttpRequest> request;
+    HttpClient::ResponseCallback callback;
+    HttpClient::BodyCallback onBody;  // Streaming calls only
+    bool probe = false;         // HEAD request that only opens/keeps a connection (Prewarm)
+    std::string url;
+    std::string body;
+    std::map<std::string, std::string> headers;
+    HttpRequestOptions options;
+    int attempts = 0;           // Started so far
+    int running = 0;            // Submitted and not finished yet
+    bool hedgeWon = false;
+    bool streamed = false;      // onBody got data: a retry would deliver it twice
+    bool done = false;
+    std::string lastError;      // Most recent failed attempt, reported if none succeeds
+    int lastStatus = 0;
+    HttpTiming timing;          // Of the attempt that finished last
+
+    bool IsOver() const { return done || request->IsCanceled(); }
+};
+
+// One attempt handed to the I/O thread; owns everything curl points into while it runs
+struct HttpTransfer {
+    std::shared_ptr<HttpCall> call;
+    bool hedge = false;
+    CURL* curl = nullptr;
+    struct curl_slist* headerList = nullptr;
+    std::string responseBody;
+    size_t received = 0;
+    bool tooLarge = false;
+    bool bodyRejected = false;  // onBody returned false
+
+    ~HttpTransfer();
+    void Finish(CURLcode result);
+};
+
+// Process-wide libcurl state shared by every HttpClient (they are short-lived, one per call):
+// global init, a share object holding the DNS cache, TLS session IDs and live connections,
+// a few idle easy handles, and one I/O thread driving every transfer through a multi handle.
+// A request to an origin we talked to recently then skips the DNS lookup and the TCP/TLS
+// handshakes entirely, and no request costs a thread of its own.
+class CurlSession {
+public:
+    static const size_t kMaxOutstanding = 256;  // Queued + running transfers
+
+    static CurlSession& Instance() {
+        // Never destroyed: Shutdown() stops the I/O thread, the rest is reclaimed by the OS
+        static CurlSession* session = new CurlSession();
+        return *session;
+    }
+
+    CURL* Acquire() {
+        CURL* curl = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(m_poolMutex);
+            if (!m_pool.empty()) {
+                curl = m_pool.back();
+                m_pool.pop_back();
+            }
+        }
+        if (!curl) {
+            curl = curl_easy_init();
+        }
+        if (curl && m_share) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, m_share);
+        }
+        return curl;
+    }
+
+    void Release(CURL* curl) {
+        // Reset drops the options (and the share link) but keeps the handle's own caches
+        curl_easy_reset(curl);
+        {
+            std::lock_guard<std::mutex> lock(m_poolMutex);
+            if (m_pool.size() < kMaxPooledHandles) {
+                m_pool.push_back(curl);
+                return;
+            }
+        }
+        curl_easy_cleanup(curl);
+    }
+
+    // Cost (DNS + connect + TLS, microseconds) of the last fresh connection to an origin
+    void RecordHandshake(const std::string& origin, int64_t us) {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        m_handshakeUs[origin] = us;
+    }
+
+    int64_t LastHandshake(const std::string& origin) {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        auto it = m_handshakeUs.find(origin);
+        return it != m_handshakeUs.end() ? it->second : 0;
+    }
+
+    // Latency of successful attempts per endpoint (HttpMetrics::EndpointName), for the hedging
+    // delay: one origin serves calls as different as join and leave
+    void RecordLatency(const std::string& endpoint, int latencyMs) {
+        std::lock_guard<std::mutex> lock(m_poolMutex);
+        std::deque<int>& samples = m_latencyMs[endpoint];
+        samples.push_back(latencyMs);
+        if (samples.size() > kLatencySamples) {
+            samples.pop_front();
+        }
+    }
+
+    // 95th percentile of the recent samples; -1 while there are too few to tell
+    int LatencyP95(const std::string& endpoint) {
+        std::vector<int> sorted;
+        {
+            std::lock_guard<std::mutex> lock(m_poolMutex);
+            auto it = m_latencyMs.find(endpoint);
+            if (it == m_latencyMs.end() || it->second.size() < kMinLatencySamples) {
+                return -1;
+            }
+            sorted.assign(it->second.begin(), it->second.end());
+        }
+        auto p95 = sorted.begin() + sorted.size() * 95 / 100;
+        std::nth_element(sorted.begin(), p95, sorted.end());
+        return *p95;
+    }
+
+    /// Queue a prepared transfer for the I/O thread; leaves it with the caller when the
+    /// queue is full or the session is shutting down
+    bool Submit(std::unique_ptr<HttpTransfer>& transfer) {
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            if (!m_multi || m_stopping || m_outstanding >= kMaxOutstanding) {
+                return false;
+            }
+            ++m_outstanding;
+            m_submitted.push_back(std::move(transfer));
+            if (!m_ioThread.joinable()) {
+                m_ioThread = std::thread(&CurlSession::Run, this);
+            }
+        }
+        curl_multi_wakeup(m_multi);
+        return true;
+    }
+
+    /// Run fire on the I/O thread after delayMs, or right away once the call is over (so a
+    /// canceled call doesn't sit out its backoff). Counts as outstanding for Shutdown().
+    bool Schedule(int delayMs, const std::shared_ptr<HttpCall>& call, std::function<void()> fire) {
+        {
+            std::lock_guard<std::mutex> lock(m_queueMutex);
+            if (!m_multi || m_stopping) {
+                return false;
+            }
+            ++m_outstanding;
+            m_timers.push_back(Timer{ std::chrono::steady_clock::now() + std::chrono::milliseconds(delayMs), call, std::move(fire) });
+            if (!m_ioThread.joinable()) {
+                m_ioThread = std::thread(&CurlSession::Run, this);
+            }
+        }
+        curl_multi_wakeup(m_multi);
+        return true;
+    }
+
+    /// Make the I/O thread look at its transfers again (e.g. after a cancel)
+    void Wake() {
+        if (m_multi) {
+            curl_multi_wakeup(m_multi);
+        }
+    }
+
+    /// Let running transfers finish for up to graceMs, then stop the I/O thread. Whatever is
+    /// left is dropped without calling back. Later Submit() calls fail.
+    void Shutdown(int graceMs) {
+        {
+            std::unique_lock<std::mutex> lock(m_queueMutex);
+            m_idle.wait_for(lock, std::chrono::milliseconds(graceMs), [this] { return m_outstanding == 0; });
+            m_stopping = true;
+        }
+        if (m_multi) {
+            curl_multi_wakeup(m_multi);
+        }
+        if (m_ioThread.joinable()) {
+            m_ioThread.join();
+        }
+    }
+
+private:
+    static const size_t kMaxPooledHandles = 4;
+    static const size_t kLatencySamples = 100;
+    static const size_t kMinLatencySamples = 20;
+
+    struct Timer {
+        std::chrono::steady_clock::time_point due;
+        std::shared_ptr<HttpCall> call;
+        std::function<void()> fire;
+    };
+
+    CurlSession() : m_share(nullptr), m_multi(nullptr), m_outstanding(0), m_stopping(false) {
+        curl_global_init(CURL_GLOBAL_ALL);
+        m_share = curl_share_init();
+        if (m_share) {
+            curl_share_setopt(m_share, CURLSHOPT_LOCKFUNC, &CurlSession::Lock);
+            curl_share_setopt(m_share, CURLSHOPT_UNLOCKFUNC, &CurlSession::Unlock);
+            curl_share_setopt(m_share, CURLSHOPT_USERDATA, this);
+            curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            curl_share_setopt(m_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+        } else {
+            LOG_ERROR("[HttpClient] curl_share_init failed, connections won't be reused across requests");
+        }
+        m_multi = curl_multi_init();
+        if (m_multi) {
+            // Concurrent requests to one origin become streams on a single HTTP/2 connection
+            curl_multi_setopt(m_multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        } else {
+            LOG_ERROR("[HttpClient] curl_multi_init failed");
+        }
+    }
+
+    static void Lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+        static_cast<CurlSession*>(userptr)->m_locks[data].lock();
+    }
+
+    static void Unlock(CURL*, curl_lock_data data, void* userptr) {
+        static_cast<CurlSession*>(userptr)->m_locks[data].unlock();
+    }
+
+    void Run() {
+        std::unordered_map<CURL*, std::unique_ptr<HttpTransfer>> running;
+        std::vector<std::unique_ptr<HttpTransfer>> submitted;
+        std::vector<Timer> due;
+
+        while (true) {
+            // Timers first: the retries and hedges they start are picked up just below
+            {
+                std::lock_guard<std::mutex> lock(m_queueMutex);
+                if (m_stopping) {
+                    break;
+                }
+                auto now = std::chrono::steady_clock::now();
+                auto ready = std::partition(m_timers.begin(), m_timers.end(), [now](const Timer& timer) {
+                    return timer.due > now && !timer.call->IsOver();
+                });
+                std::move(ready, m_timers.end(), std::back_inserter(due));
+                m_timers.erase(ready, m_timers.end());
+            }
+            for (Timer& timer : due) {
+                timer.fire();
+                Retire();
+            }
+            due.clear();
+
+            {
+                std::lock_guard<std::mutex> lock(m_queueMutex);
+                submitted.swap(m_submitted);
+            }
+            for (auto& transfer : submitted) {
+                CURL* curl = transfer->curl;
+                if (transfer->call->IsOver()) {
+                    transfer->Finish(CURLE_ABORTED_BY_CALLBACK);
+                    Retire();
+                    continue;
+                }
+                if (curl_multi_add_handle(m_multi, curl) != CURLM_OK) {
+                    transfer->Finish(CURLE_FAILED_INIT);
+                    Retire();
+                    continue;
+                }
+                running.emplace(curl, std::move(transfer));
+            }
+            submitted.clear();
+
+            // Transfers of canceled calls, and hedge losers, leave the multi handle right away
+            for (auto it = running.begin(); it != running.end();) {
+                if (!it->second->call->IsOver()) {
+                    ++it;
+                    continue;
+                }
+                curl_multi_remove_handle(m_multi, it->first);
+                std::unique_ptr<HttpTransfer> transfer = std::move(it->second);
+                it = running.erase(it);
+                transfer->Finish(CURLE_ABORTED_BY_CALLBACK);
+                transfer.reset();
+                Retire();
+            }
+
+            int stillRunning = 0;
+            curl_multi_perform(m_multi, &stillRunning);
+
+            int queued = 0;
+            while (CURLMsg* message = curl_multi_info_read(m_multi, &queued)) {
+                if (message->msg != CURLMSG_DONE) {
+                    continue;
+                }
+                CURL* curl = message->easy_handle;
+                CURLcode result = message->data.result;
+                curl_multi_remove_handle(m_multi, curl);
+                auto it = running.find(curl);
+                if (it == running.end()) {
+                    continue;
+                }
+                std::unique_ptr<HttpTransfer> transfer = std::move(it->second);
+                running.erase(it);
+                transfer->Finish(result);
+                transfer.reset();
+                Retire();
+            }
+
+            // Sleeps until a socket is ready, a timeout or timer is due, or Submit()/Shutdown() wakes us
+            int waitMs = 1000;
+            {
+                std::lock_guard<std::mutex> lock(m_queueMutex);
+                auto now = std::chrono::steady_clock::now();
+                for (const Timer& timer : m_timers) {
+                    long long left = std::chrono::duration_cast<std::chrono::milliseconds>(timer.due - now).count() + 1;
+                    waitMs = (int)(std::min)((long long)waitMs, (std::max)(left, 0LL));
+                }
+            }
+            curl_multi_poll(m_multi, nullptr, 0, waitMs, nullptr);
+        }
+
+        // Shutting down: abandon what's left, its owners are going away
+        for (auto& entry : running) {
+            curl_multi_remove_handle(m_multi, entry.first);
+        }
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        if (!running.empty() || !m_submitted.empty() || !m_timers.empty()) {
+            LOG_INFO("[HttpClient] Shutdown dropped " + std::to_string(running.size() + m_submitted.size()) +
+                     " unfinished request(s) and " + std::to_string(m_timers.size()) + " pending retries");
+        }
+        m_submitted.clear();
+        m_timers.clear();
+        m_outstanding = 0;
+    }
+
+    void Retire() {
+        std::lock_guard<std::mutex> lock(m_queueMutex);
+        if (--m_outstanding == 0) {
+            m_idle.notify_all();
+        }
+    }
+
+    CURLSH* m_share;
+    std::mutex m_locks[CURL_LOCK_DATA_LAST];
+    std::mutex m_poolMutex;
+    std::vector<CURL*> m_pool;
+    std::map<std::string, int64_t> m_handshakeUs;
+    std::map<std::string, std::deque<int>> m_latencyMs;
+
+    CURLM* m_multi;
+    std::mutex m_queueMutex;
+    std::condition_variable m_idle;
+    std::vector<std::unique_ptr<HttpTransfer>> m_submitted;
+    std::vector<Timer> m_timers;
+    size_t m_outstanding;
+    bool m_stopping;
+    std::thread m_ioThread;
+};
+
+// scheme://host[:port] of a URL
+std::string OriginOf(const std::string& url) {
+    size_t scheme = url.find("://");
+    size_t hostStart = scheme == std::string::npos ? 0 : scheme + 3;
+    return url.substr(0, url.find_first_of("/?#", hostStart));
+}
+
+const char* HttpVersionName(long version) {
+    switch (version) {
+        case CURL_HTTP_VERSION_1_0: return "HTTP/1.0";
+        case CURL_HTTP_VERSION_1_1: return "HTTP/1.1";
+        case CURL_HTTP_VERSION_2_0: return "HTTP/2";
+        default: return "HTTP/?";
+    }
+}
+
+// curl reports every time as an offset from the start of the transfer; turn them into phases
+HttpTiming ReadTiming(CURL* curl) {
+    curl_off_t dnsUs = 0;
+    curl_off_t connectUs = 0;
+    curl_off_t appConnectUs = 0;
+    curl_off_t preTransferUs = 0;
+    curl_off_t firstByteUs = 0;
+    curl_off_t totalUs = 0;
+    curl_off_t downloaded = 0;
+    long requestBytes = 0;
+    long headerBytes = 0;
+    long newConnections = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dnsUs);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connectUs);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &appConnectUs);
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME_T, &preTransferUs);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &firstByteUs);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &totalUs);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+    curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE, &requestBytes);
+    curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE, &headerBytes);
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &newConnections);
+
+    HttpTiming timing;
+    timing.reusedConnection = newConnections == 0;
+    if (!timing.reusedConnection) {
+        timing.dnsUs = dnsUs;
+        timing.connectUs = (std::max)(connectUs - dnsUs, (curl_off_t)0);
+        timing.tlsUs = appConnectUs > 0 ? (std::max)(appConnectUs - connectUs, (curl_off_t)0) : 0;
+    }
+    timing.serverUs = firstByteUs > 0 ? (std::max)(firstByteUs - preTransferUs, (curl_off_t)0) : 0;
+    timing.transferUs = firstByteUs > 0 ? (std::max)(totalUs - firstByteUs, (curl_off_t)0) : 0;
+    timing.totalUs = totalUs;
+    timing.bytesSent = requestBytes;
+    timing.bytesReceived = headerBytes + downloaded;
+    return timing;
+}
+
+// One line per request: protocol, whether it paid for a handshake or rode on a pooled /
+// multiplexed connection, and where the time went
+void LogTransferTiming(CURL* curl, const std::string& url, const HttpTiming& timing) {
+    long httpVersion = 0;
+    curl_easy_getinfo(curl, CURLINFO_HTTP_VERSION, &httpVersion);
+
+    CurlSession& session = CurlSession::Instance();
+    std::string origin = OriginOf(url);
+    std::string connection;
+    if (!timing.reusedConnection) {
+        int64_t handshakeUs = timing.dnsUs + timing.connectUs + timing.tlsUs;
+        session.RecordHandshake(origin, handshakeUs);
+        connection = "new connection (dns " + std::to_string(timing.dnsUs / 1000) + ", connect " +
+                     std::to_string(timing.connectUs / 1000) + ", tls " + std::to_string(timing.tlsUs / 1000) + " ms)";
+    } else {
+        connection = std::string(httpVersion == CURL_HTTP_VERSION_2_0 ? "shared" : "reused") + " connection, ~" +
+                     std::to_string(session.LastHandshake(origin) / 1000) + " ms handshake saved";
+    }
+    LOG_INFO("[HttpClient] " + origin + " " + HttpVersionName(httpVersion) + ", " + connection + ", server " +
+             std::to_string(timing.serverUs / 1000) + " ms, transfer " + std::to_string(timing.transferUs / 1000) +
+             " ms, total " + std::to_string(timing.totalUs / 1000) + " ms, " + std::to_string(timing.bytesSent) +
+             "/" + std::to_string(timing.bytesReceived) + " bytes out/in");
+}
+
+HttpTransfer::~HttpTransfer() {
+    if (headerList) {
+        curl_slist_free_all(headerList);
+    }
+    if (curl) {
+        CurlSession::Instance().Release(curl);
+    }
+}
+
+bool StartsWithNoCase(const char* data, size_t size, const char* prefix) {
+    for (; *prefix; ++prefix, ++data, --size) {
+        if (size == 0 || std::tolower((unsigned char)*data) != *prefix) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Header callback: size the body buffer once from Content-Length rather than growing it
+// chunk by chunk, and refuse an oversized body before any of it arrives
+size_t HeaderCallback(char* data, size_t size, size_t nmemb, HttpTransfer* transfer) {
+    size_t totalSize = size * nmemb;
+    static const char kContentLength[] = "content-length:";
+    if (StartsWithNoCase(data, totalSize, kContentLength)) {
+        std::string value(data + sizeof(kContentLength) - 1, totalSize - (sizeof(kContentLength) - 1));
+        unsigned long long length = std::strtoull(value.c_str(), nullptr, 10);
+        if (length > transfer->call->options.maxResponseSize) {
+            transfer->tooLarge = true;
+            return 0;  // Aborts the transfer
+        }
+        if (!transfer->call->onBody) {
+            transfer->responseBody.reserve((size_t)length);
+        }
+    }
+    return totalSize;
+}
+
+// Write callback for response data: buffered, or handed to a streaming caller
+size_t WriteCallback(char* data, size_t size, size_t nmemb, HttpTransfer* transfer) {
+    size_t totalSize = size * nmemb;
+    transfer->received += totalSize;
+    HttpCall& call = *transfer->call;
+    if (transfer->received > call.options.maxResponseSize) {
+        transfer->tooLarge = true;
+        return 0;
+    }
+    if (call.onBody) {
+        long statusCode = 0;
+        curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &statusCode);
+        if (statusCode == 200) {
+            if (call.IsOver()) {
+                return 0;
+            }
+            call.streamed = true;
+            bool keepGoing = false;
+            try {
+                keepGoing = call.onBody(data, totalSize);
+            } catch (const std::exception& e) {
+                LOG_ERROR("[HttpClient] Exception in body callback: " + std::string(e.what()));
+            }
+            if (!keepGoing) {
+                transfer->bodyRejected = true;
+                return 0;
+            }
+            return totalSize;
+        }
+    }
+    transfer->responseBody.append(data, totalSize);
+    return totalSize;
+}
+
+// Configure a pooled handle for one attempt at a call; nullptr if no handle could be created
+std::unique_ptr<HttpTransfer> PrepareTransfer(const std::shared_ptr<HttpCall>& call, long timeoutMs) {
+    std::unique_ptr<HttpTransfer> transfer(new HttpTransfer());
+    transfer->call = call;
+    transfer->curl = CurlSession::Instance().Acquire();
+    if (!transfer->curl) {
+        return nullptr;
+    }
+    CURL* curl = transfer->curl;
+    const HttpRequestOptions& options = call->options;
+
+    // Set URL
+    curl_easy_setopt(curl, CURLOPT_URL, call->url.c_str());
+
+    if (call->probe) {
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+    } else {
+        // Set POST method (curl doesn't copy the body: the call owns it)
+        curl_easy_setopt(curl, CURLOPT_POST, 1L);
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDS, call->body.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, (long)call->body.size());
+    }
+
+    // Add headers
+    for (const auto& header : call->headers) {
+        std::string headerLine = header.first + ": " + header.second;
+        transfer->headerList = curl_slist_append(transfer->headerList, headerLine.c_str());
+    }
+    if (transfer->headerList) {
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, transfer->headerList);
+    }
+
+    // Set response callbacks
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, HeaderCallback);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, transfer.get());
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer.get());
+
+    // ✅ Enable automatic redirect following (301, 302, 303, 307, 308)
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);  // Max 5 redirects
+
+    // ✅ For 307/308, keep POST method (don't change to GET)
+    curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
+
+    // HTTP/2 over TLS when the server offers it (plain http:// stays on HTTP/1.1); wait for
+    // a connection being set up to the same origin rather than open a parallel one
+    curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+
+    // Set timeout (the smaller of timeout and deadline)
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeoutMs);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+
+    // SSL settings
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, options.verifySSL ? 1L : 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, options.verifySSL ? 2L : 0L);
+
+    // Enable verbose logging in debug mode
+    #ifdef _DEBUG
+    curl_easy_setopt(curl, CURLOPT_VERBOSE, 0L);  // Set to 1L for debugging
+    #endif
+
+    return transfer;
+}
+
+// Report the call's outcome to its owner, once
+void CompleteCall(HttpCall& call, bool success, const std::string& response, int statusCode) {
+    call.done = true;
+    HttpRequestAccess::SetTiming(*call.request, call.timing);
+    HttpRequestAccess::MarkFinished(*call.request);
+    if (call.attempts > 1) {
+        int retries = call.request->Retries();
+        LOG_INFO("[HttpClient] POST " + call.url + " took " + std::to_string(call.attempts) + " attempts (" +
+                 std::to_string(retries) + " retries" +
+                 (call.request->Hedged() ? (call.hedgeWon ? ", hedge won" : ", hedge lost") : "") + ")");
+    }
+    try {
+        call.callback(success, response, statusCode);
+    } catch (const std::exception& e) {
+        // Never let a callback take the I/O thread down
+        LOG_ERROR("[HttpClient] Exception in callback: " + std::string(e.what()));
+    }
+}
+
+// Start one more attempt; false (with lastError set) if it could not be started
+bool StartAttempt(const std::shared_ptr<HttpCall>& call, bool hedge) {
+    long timeoutMs = call->options.TimeoutMs();
+    if (timeoutMs <= 0) {
+        call->lastError = "deadline exceeded";
+        call->lastStatus = HttpClient::kStatusTimedOut;
+        return false;
+    }
+    std::unique_ptr<HttpTransfer> transfer = PrepareTransfer(call, timeoutMs);
+    if (!transfer) {
+        LOG_ERROR("[HttpClient] Failed to initialize CURL");
+        call->lastError = "Failed to initialize CURL";
+        call->lastStatus = 0;
+        return false;
+    }
+    transfer->hedge = hedge;
+
+    // Counted before Submit: the I/O thread may finish the attempt before Submit returns
+    ++call->attempts;
+    ++call->running;
+    if (!CurlSession::Instance().Submit(transfer)) {
+        --call->attempts;
+        --call->running;
+        LOG_ERROR("[HttpClient] Request rejected: too many requests in flight or shutting down");
+        call->lastError = "HttpClient busy or shut down";
+        call->lastStatus = 0;
+        return false;
+    }
+    if (!call->probe) {
+        ++HttpMetrics::Instance().attempts;
+    }
+    return true;
+}
+
+// Whether a failed attempt may be sent again. Connection failures and 429/503 mean the server
+// did not act on it; after a timeout, reset or other 5xx it may have, so only if idempotent.
+bool IsRetryable(CURLcode result, long statusCode, bool idempotent) {
+    switch (result) {
+        case CURLE_OK:
+            break;
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_SSL_CONNECT_ERROR:
+            return true;
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            return idempotent;
+        default:
+            return false;
+    }
+    return IHttpTransport::IsRetryableStatus(statusCode, idempotent);
+}
+
+int BackoffMs(const HttpRetryPolicy& policy, int retry) {
+    static std::mt19937 rng(std::random_device{}());  // I/O thread only
+    return IHttpTransport::BackoffMs(policy, retry, rng);
+}
+
+void StartRetry(const std::shared_ptr<HttpCall>& call) {
+    if (call->done) {
+        return;
+    }
+    if (call->request->IsCanceled()) {
+        LOG_INFO("[HttpClient] Canceled: " + call->url);
+        CompleteCall(*call, false, "canceled", HttpClient::kStatusCanceled);
+        return;
+    }
+    if (!StartAttempt(call, false)) {
+        CompleteCall(*call, false, call->lastError, call->lastStatus);
+    }
+}
+
+void StartHedge(const std::shared_ptr<HttpCall>& call, int delayMs) {
+    if (call->IsOver() || call->running != 1 || call->request->Hedged() ||
+        call->attempts >= call->options.retry.maxAttempts) {
+        return;
+    }
+    LOG_INFO("[HttpClient] No response after " + std::to_string(delayMs) + " ms, hedging POST " + call->url);
+    if (StartAttempt(call, true)) {
+        HttpRequestAccess::MarkHedged(*call->request);
+        ++HttpMetrics::Instance().hedges;
+    }
+}
+
+// I/O thread: one attempt is over. Completes the call, waits for its other attempt, or
+// schedules a retry.
+void OnAttemptDone(HttpTransfer& transfer, CURLcode result, long statusCode) {
+    const std::shared_ptr<HttpCall>& call = transfer.call;
+    --call->running;
+    if (call->done) {
+        return;  // Lost a hedge race
+    }
+    if (call->request->IsCanceled()) {
+        CompleteCall(*call, false, "canceled", HttpClient::kStatusCanceled);
+        return;
+    }
+    if (result == CURLE_OK && statusCode == 200) {
+        if (transfer.hedge) {
+            call->hedgeWon = true;
+            ++HttpMetrics::Instance().hedgeWins;
+        }
+        CompleteCall(*call, true, transfer.responseBody, (int)statusCode);
+        return;
+    }
+
+    if (transfer.tooLarge) {
+        call->lastError = "response too large";
+        call->lastStatus = HttpClient::kStatusTooLarge;
+    } else if (transfer.bodyRejected) {
+        call->lastError = "aborted by body callback";
+        call->lastStatus = HttpClient::kStatusCanceled;
+    } else if (result != CURLE_OK) {
+        call->lastError = curl_easy_strerror(result);
+        call->lastStatus = result == CURLE_OPERATION_TIMEDOUT ? HttpClient::kStatusTimedOut : 0;
+    } else {
+        call->lastError = transfer.responseBody;
+        call->lastStatus = (int)statusCode;
+    }
+    if (call->running > 0) {
+        return;  // The other attempt may still succeed
+    }
+
+    const HttpRetryPolicy& policy = call->options.retry;
+    if (call->attempts < policy.maxAttempts && !call->streamed && IsRetryable(result, statusCode, policy.idempotent)) {
+        int delayMs = BackoffMs(policy, call->request->Retries() + 1);
+        if (call->options.TimeoutMs() > delayMs &&
+            CurlSession::Instance().Schedule(delayMs, call, [call] { StartRetry(call); })) {
+            HttpRequestAccess::AddRetry(*call->request);
+            ++HttpMetrics::Instance().retries;
+            LOG_INFO("[HttpClient] Retrying POST " + call->url + " in " + std::to_string(delayMs) + " ms (attempt " +
+                     std::to_string(call->attempts + 1) + "/" + std::to_string(policy.maxAttempts) + ")");
+            return;
+        }
+    }
+    CompleteCall(*call, false, call->lastError, call->lastStatus);
+}
+
+// Runs on the I/O thread once curl is done with the attempt (or it was abandoned)
+void HttpTransfer::Finish(CURLcode result) {
+    if (call->IsOver()) {
+        if (!call->done) {
+            LOG_INFO("[HttpClient] Canceled: " + call->url);
+        }
+        OnAttemptDone(*this, CURLE_ABORTED_BY_CALLBACK, 0);
+        return;
+    }
+
+    // Get HTTP status code
+    long statusCode = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &statusCode);
+
+    call->timing = ReadTiming(curl);
+    if (!call->probe) {
+        HttpMetrics::Instance().RecordAttempt(HttpMetrics::EndpointName(call->url, call->options), call->timing,
+                                              result == CURLE_OK && statusCode == 200);
+    }
+    if (tooLarge) {
+        LOG_ERROR("[HttpClient] Response larger than " + std::to_string(call->options.maxResponseSize) +
+                  " bytes, aborted: " + call->url);
+        OnAttemptDone(*this, result, 0);
+        return;
+    }
+    if (result != CURLE_OK) {
+        LOG_ERROR("[HttpClient] Request failed: " + std::string(curl_easy_strerror(result)));
+        OnAttemptDone(*this, result, 0);
+        return;
+    }
+
+    LogTransferTiming(curl, call->url, call->timing);
+    if (call->probe) {
+        // Any answer means the connection is up; its status and timing say nothing about the API
+        OnAttemptDone(*this, CURLE_OK, statusCode);
+        return;
+    }
+
+    // Get effective URL (after redirects)
+    char* effectiveUrl = nullptr;
+    curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effectiveUrl);
+    if (effectiveUrl && std::string(effectiveUrl) != call->url) {
+        LOG_INFO("[HttpClient] Redirected to: " + std::string(effectiveUrl));
+    }
+
+    LOG_INFO("[HttpClient] Response status: " + std::to_string(statusCode));
+
+    if (statusCode == 200) {
+        CurlSession::Instance().RecordLatency(HttpMetrics::EndpointName(call->url, call->options),
+                                              (int)(call->timing.totalUs / 1000));
+    } else {
+        LOG_ERROR("[HttpClient] HTTP error: " + std::to_string(statusCode));
+    }
+    OnAttemptDone(*this, CURLE_OK, statusCode);
+}
+
+// Keeps a connection to each origin warm with HEAD requests until stopped. Each origin has at
+// most one probe pending: running, or waiting out the keep-alive interval on the I/O thread.
+class Prewarmer {
+public:
+    // Well inside curl's idle connection limit (CURLOPT_MAXAGE_CONN, 118 s) and typical server
+    // keep-alive timeouts
+    static const int kKeepAliveMs = 45 * 1000;
+
+    static Prewarmer& Instance() {
+        // Leaked like CurlSession: probe callbacks may still run on the I/O thread at exit
+        static Prewarmer* prewarmer = new Prewarmer();
+        return *prewarmer;
+    }
+
+    void Start(const std::vector<std::string>& origins) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_active = true;
+        }
+        for (const std::string& url : origins) {
+            Probe(OriginOf(url), 0);
+        }
+    }
+
+    void Stop() {
+        std::map<std::string, std::shared_ptr<HttpRequest>> pending;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_active) {
+                return;
+            }
+            m_active = false;
+            pending.swap(m_pending);
+        }
+        for (auto& entry : pending) {
+            entry.second->Cancel();
+        }
+        LOG_INFO("[HttpClient] Prewarm stopped");
+    }
+
+private:
+    // Send a HEAD to origin after delayMs; called again from its completion to keep going
+    void Probe(const std::string& origin, int delayMs) {
+        auto call = std::make_shared<HttpCall>();
+        call->request = std::make_shared<HttpRequest>();
+        HttpRequestAccess::SetCancelHook(*call->request, [] { CurlSession::Instance().Wake(); });
+        call->url = origin + "/";
+        call->probe = true;
+        call->options.timeout = 10;
+        call->callback = [this, origin](bool, const std::string&, int statusCode) {
+            if (statusCode != HttpClient::kStatusCanceled) {
+                Probe(origin, kKeepAliveMs);
+            }
+        };
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_active) {
+                return;
+            }
+            if (m_pending.count(origin) && delayMs == 0) {
+                return;  // Already being kept warm
+            }
+            m_pending[origin] = call->request;
+        }
+        if (delayMs == 0) {
+            if (!StartAttempt(call, false)) {
+                LOG_ERROR("[HttpClient] Prewarm of " + origin + " failed: " + call->lastError);
+            }
+            return;
+        }
+        CurlSession::Instance().Schedule(delayMs, call, [call] {
+            if (call->request->IsCanceled()) {
+                CompleteCall(*call, false, "canceled", HttpClient::kStatusCanceled);
+            } else if (!StartAttempt(call, false)) {
+                CompleteCall(*call, false, call->lastError, call->lastStatus);
+            }
+        });
+    }
+
+    std::mutex m_mutex;
+    bool m_active = false;
+    std::map<std::string, std::shared_ptr<HttpRequest>> m_pending;  // Latest probe per origin
+};
+
+}  // namespace
+
+CurlTransport::CurlTransport() {
+    // Initializes libcurl globally (once, thread-safe) along with the shared connection pool
+    CurlSession::Instance();
+}
+
+std::shared_ptr<HttpRequest> CurlTransport::Post(
+    const HttpRequestSpec& spec,
+    HttpClient::BodyCallback onBody,
+    HttpClient::ResponseCallback callback
+) {
+    // The call copies everything it needs, so the HttpClient may go away right after this
+    auto call = std::make_shared<HttpCall>();
+    call->request = std::make_shared<HttpRequest>();
+    HttpRequestAccess::SetCancelHook(*call->request, [] { CurlSession::Instance().Wake(); });
+    call->callback = std::move(callback);
+    call->onBody = std::move(onBody);
+    call->url = spec.url;
+    call->body = spec.body;
+    call->headers = spec.headers;
+    call->options = spec.options;
+    std::shared_ptr<HttpRequest> request = call->request;
+    ++HttpMetrics::Instance().requests;
+
+    // Calls whose first attempt never reaches the I/O thread complete here, on the caller's thread
+    if (call->options.TimeoutMs() <= 0) {
+        LOG_ERROR("[HttpClient] Deadline passed before POST " + spec.url);
+        CompleteCall(*call, false, "deadline exceeded", HttpClient::kStatusTimedOut);
+        return request;
+    }
+    LOG_INFO("[HttpClient] POST " + spec.url);
+    const HttpRetryPolicy policy = call->options.retry;
+    const bool streaming = call->onBody != nullptr;
+    if (!StartAttempt(call, false)) {
+        CompleteCall(*call, false, call->lastError, call->lastStatus);
+        return request;
+    }
+
+    // Only the immutable parts of the call are read past this point: it belongs to the I/O thread
+    if (policy.idempotent && policy.hedgeAfterMs > 0 && policy.maxAttempts > 1 && !streaming) {
+        int p95 = CurlSession::Instance().LatencyP95(HttpMetrics::EndpointName(spec.url, call->options));
+        int delayMs = p95 > 0 ? p95 : policy.hedgeAfterMs;
+        CurlSession::Instance().Schedule(delayMs, call, [call, delayMs] { StartHedge(call, delayMs); });
+    }
+    return request;
+}
+
+void CurlTransport::Prewarm(const std::vector<std::string>& origins) {
+    Prewarmer::Instance().Start(origins);
+}
+
+void CurlTransport::StopPrewarm() {
+    Prewarmer::Instance().Stop();
+}
+
+void CurlTransport::Shutdown(int graceMs) {
+    Prewarmer::Instance().Stop();
+    CurlSession::Instance().Shutdown(graceMs);
+}
@@ -0,0 +1,27 @@
+// CurlTransport.h: HttpClient transport over libcurl
+//
+#pragma once
+
+#include "HttpTransport.h"
+
+/// Real network transport, the default for HttpClient
+/// Every instance shares one process-wide libcurl session: global init, a share object holding
+/// the DNS cache, TLS session IDs and live connections, and one I/O thread driving every
+/// transfer through a multi handle. Callbacks run on that thread.
+class CurlTransport : public IHttpTransport {
+public:
+    CurlTransport();
+
+    std::shared_ptr<HttpRequest> Post(
+        const HttpRequestSpec& spec,
+        HttpClient::BodyCallback onBody,
+        HttpClient::ResponseCallback callback
+    ) override;
+
+    /// Keep a connection to each origin warm with a HEAD request every 45 s until StopPrewarm()
+    void Prewarm(const std::vector<std::string>& origins) override;
+    void StopPrewarm() override;
+
+    /// Stop the shared I/O thread; requests still running get up to graceMs to finish
+    void Shutdown(int graceMs) override;
+};
@@ -1,179 +1,260 @@
-// HttpClient.cpp: Modern HTTP client implementation using libcurl
+// HttpClient.cpp: HTTP client front end; the requests themselves run on an IHttpTransport
 //
 
 #include "../general/pch.h"
 #include <memory>
-#include <thread>
-#include <sstream>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <random>
 #include "HttpClient.h"
+#include "HttpTransport.h"
+#include "CurlTransport.h"
 #include "../tools/Logger.h"
-#include <curl/curl.h>
-
-// RAII wrapper for CURL cleanup
-struct CurlHandle {
-    CURL* curl;
-    
-    CurlHandle() : curl(curl_easy_init()) {}
-    ~CurlHandle() { if (curl) curl_easy_cleanup(curl); }
-    
-    operator CURL*() { return curl; }
+#include <algorithm>
+#include <climits>
+
+const int HttpHistogram::kUpperMs[HttpHistogram::kBuckets] = {
+    1, 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, INT_MAX
 };
 
-// Implementation details
-struct HttpClient::Impl {
-    int timeout = 30;
-    bool verifySSL = true;
-    
-    // Write callback for response data
-    static size_t WriteCallback(void* contents, size_t size, size_t nmemb, std::string* userp) {
-        size_t totalSize = size * nmemb;
-        userp->append((char*)contents, totalSize);
-        return totalSize;
+void HttpHistogram::Add(int64_t us) {
+    int64_t ms = (us + 999) / 1000;
+    int bucket = 0;
+    while (bucket < kBuckets - 1 && ms > kUpperMs[bucket]) {
+        ++bucket;
     }
-    
-    // Perform synchronous HTTP POST (called in async thread)
-    void PostSync(
-        const std::string& url,
-        const std::string& body,
-        const std::map<std::string, std::string>& headers,
-        HttpClient::ResponseCallback callback
-    ) {
-        CurlHandle curl;
-        if (!curl.curl) {
-            LOG_ERROR("[HttpClient] Failed to initialize CURL");
-            callback(false, "Failed to initialize CURL", 0);
-            return;
-        }
-        
-        std::string responseBody;
-        struct curl_slist* headerList = nullptr;
-        
-        try {
-            // Set URL
-            curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-            
-            // Set POST method
-            curl_easy_setopt(curl, CURLOPT_POST, 1L);
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
-            curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE, body.size());
-            
-            // Add headers
-            for (const auto& header : headers) {
-                std::string headerLine = header.first + ": " + header.second;
-                headerList = curl_slist_append(headerList, headerLine.c_str());
-            }
-            if (headerList) {
-                curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headerList);
-            }
-            
-            // Set response callback
-            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, WriteCallback);
-            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &responseBody);
-            
-            // ✅ Enable automatic redirect following (301, 302, 303, 307, 308)
-            curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
-            curl_easy_setopt(curl, CURLOPT_MAXREDIRS, 5L);  // Max 5 redirects
-            
-            // ✅ For 307/308, keep POST method (don't change to GET)
-            curl_easy_setopt(curl, CURLOPT_POSTREDIR, CURL_REDIR_POST_ALL);
-            
-            // Set timeout
-            curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
-            curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
-            
-            // SSL settings
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, verifySSL ? 1L : 0L);
-            curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, verifySSL ? 2L : 0L);
-            
-            // Enable verbose logging in debug mode
-            #ifdef _DEBUG
-            curl_easy_setopt(curl, CURLOPT_VERBOSE, 0L);  // Set to 1L for debugging
-            #endif
-            
-            // Perform request
-            LOG_INFO("[HttpClient] POST " + url);
-            CURLcode res = curl_easy_perform(curl);
-            
-            // Cleanup headers
-            if (headerList) {
-                curl_slist_free_all(headerList);
-                headerList = nullptr;
-            }
-            
-            // Check result
-            if (res != CURLE_OK) {
-                std::string error = curl_easy_strerror(res);
-                LOG_ERROR("[HttpClient] Request failed: " + error);
-                callback(false, error, 0);
-                return;
-            }
-            
-            // Get HTTP status code
-            long statusCode = 0;
-            curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &statusCode);
-            
-            // Get effective URL (after redirects)
-            char* effectiveUrl = nullptr;
-            curl_easy_getinfo(curl, CURLINFO_EFFECTIVE_URL, &effectiveUrl);
-            if (effectiveUrl && std::string(effectiveUrl) != url) {
-                LOG_INFO("[HttpClient] Redirected to: " + std::string(effectiveUrl));
-            }
-            
-            LOG_INFO("[HttpClient] Response status: " + std::to_string(statusCode));
-            
-            if (statusCode == 200) {
-                callback(true, responseBody, (int)statusCode);
-            } else {
-                LOG_ERROR("[HttpClient] HTTP error: " + std::to_string(statusCode));
-                callback(false, responseBody, (int)statusCode);
-            }
-            
-        } catch (const std::exception& e) {
-            LOG_ERROR("[HttpClient] Exception: " + std::string(e.what()));
-            if (headerList) {
-                curl_slist_free_all(headerList);
-            }
-            callback(false, e.what(), 0);
+    ++counts[bucket];
+    ++count;
+    sumUs += us;
+    maxUs = (std::max)(maxUs, us);
+}
+
+int HttpHistogram::PercentileMs(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p / 100.0 * (double)(count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int bucket = 0; bucket < kBuckets; ++bucket) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            int maxMs = (int)((maxUs + 999) / 1000);
+            return (std::min)(kUpperMs[bucket], maxMs);
         }
     }
+    return (int)((maxUs + 999) / 1000);
+}
+
+long HttpRequestOptions::TimeoutMs() const {
+    long timeoutMs = timeout * 1000L;
+    if (hasDeadline) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+        timeoutMs = (std::min)(timeoutMs, (long)left.count());
+    }
+    return timeoutMs;
+}
+
+bool IHttpTransport::IsRetryableStatus(long statusCode, bool idempotent) {
+    // 429/503 (and no response at all, once the transport called it retryable) mean the server
+    // did not act on the request; after another 5xx it may have
+    if (statusCode == 429 || statusCode == 503) {
+        return true;
+    }
+    return idempotent && (statusCode == 500 || statusCode == 502 || statusCode == 504);
+}
+
+int IHttpTransport::BackoffMs(const HttpRetryPolicy& policy, int retry, std::mt19937& rng) {
+    long long delay = (std::min)((long long)policy.maxDelayMs, (long long)policy.baseDelayMs << (std::min)(retry - 1, 20));
+    std::uniform_int_distribution<long long> jitter(0, delay / 2);
+    return (int)(delay - jitter(rng));
+}
+
+HttpMetrics& HttpMetrics::Instance() {
+    // Leaked on purpose: transport threads may still record at exit
+    static HttpMetrics* metrics = new HttpMetrics();
+    return *metrics;
+}
+
+std::string HttpMetrics::EndpointName(const std::string& url, const HttpRequestOptions& options) {
+    if (!options.metricsName.empty()) {
+        return options.metricsName;
+    }
+    return url.substr(0, url.find_first_of("?#"));
+}
+
+void HttpMetrics::RecordAttempt(const std::string& endpoint, const HttpTiming& timing, bool success) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    HttpEndpointStats& stats = m_endpoints[endpoint];
+    stats.endpoint = endpoint;
+    ++stats.requests;
+    if (!success) {
+        ++stats.failures;
+    }
+    if (timing.reusedConnection) {
+        ++stats.reusedConnections;
+    }
+    stats.bytesSent += timing.bytesSent;
+    stats.bytesReceived += timing.bytesReceived;
+    if (!timing.reusedConnection) {
+        stats.dns.Add(timing.dnsUs);
+        stats.connect.Add(timing.connectUs);
+        stats.tls.Add(timing.tlsUs);
+    }
+    stats.server.Add(timing.serverUs);
+    stats.transfer.Add(timing.transferUs);
+    stats.total.Add(timing.totalUs);
+}
+
+HttpRetryStats HttpMetrics::RetryStats() const {
+    HttpRetryStats stats;
+    stats.requests = requests;
+    stats.attempts = attempts;
+    stats.retries = retries;
+    stats.hedges = hedges;
+    stats.hedgeWins = hedgeWins;
+    return stats;
+}
+
+std::vector<HttpEndpointStats> HttpMetrics::EndpointStats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::vector<HttpEndpointStats> snapshot;
+    for (const auto& entry : m_endpoints) {
+        snapshot.push_back(entry.second);
+    }
+    return snapshot;
+}
+
+namespace {
+
+std::mutex g_transportMutex;
+std::shared_ptr<IHttpTransport> g_defaultTransport;
+
+std::shared_ptr<IHttpTransport> DefaultTransport() {
+    std::lock_guard<std::mutex> lock(g_transportMutex);
+    if (!g_defaultTransport) {
+        g_defaultTransport = std::make_shared<CurlTransport>();
+    }
+    return g_defaultTransport;
+}
+
+}  // namespace
+
+// Implementation details
+struct HttpClient::Impl {
+    HttpRequestOptions options;
+    std::shared_ptr<IHttpTransport> transport;
 };
 
 // Constructor / Destructor
 // Note: These must be defined in .cpp where Impl is complete (for std::shared_ptr)
-HttpClient::HttpClient() : m_impl(std::make_shared<Impl>()) {
-    // Initialize libcurl globally (thread-safe)
-    static bool curlInitialized = false;
-    if (!curlInitialized) {
-        curl_global_init(CURL_GLOBAL_ALL);
-        curlInitialized = true;
-    }
+HttpClient::HttpClient() : HttpClient(DefaultTransport()) {
+}
+
+HttpClient::HttpClient(std::shared_ptr<IHttpTransport> transport) : m_impl(std::make_shared<Impl>()) {
+    m_impl->transport = transport ? std::move(transport) : DefaultTransport();
 }
 
 // Destructor must be in .cpp to properly delete Impl via shared_ptr
 HttpClient::~HttpClient() = default;
 
+void HttpClient::SetDefaultTransport(std::shared_ptr<IHttpTransport> transport) {
+    std::lock_guard<std::mutex> lock(g_transportMutex);
+    g_defaultTransport = std::move(transport);
+}
+
 // Public methods
-void HttpClient::PostAsync(
+void HttpRequest::Cancel() {
+    if (!m_finished && !m_canceled.exchange(true) && m_cancelHook) {
+        m_cancelHook();
+    }
+}
+
+std::shared_ptr<HttpRequest> HttpClient::PostAsync(
     const std::string& url,
     const std::string& body,
     const std::map<std::string, std::string>& headers,
     ResponseCallback callback
 ) {
-    // CRITICAL: Capture shared_ptr copy to keep Impl alive during async operation
-    // This increments the reference count, preventing Impl from being deleted
-    // even if the HttpClient object is destroyed before the thread completes
-    auto impl = m_impl;
-    
-    std::thread([impl, url, body, headers, callback]() {
-        impl->PostSync(url, body, headers, callback);
-    }).detach();
+    return PostStreaming(url, body, headers, nullptr, std::move(callback));
+}
+
+std::shared_ptr<HttpRequest> HttpClient::PostStreaming(
+    const std::string& url,
+    const std::string& body,
+    const std::map<std::string, std::string>& headers,
+    BodyCallback onBody,
+    ResponseCallback callback
+) {
+    HttpRequestSpec spec;
+    spec.url = url;
+    spec.body = body;
+    spec.headers = headers;
+    spec.options = m_impl->options;
+    return m_impl->transport->Post(spec, std::move(onBody), std::move(callback));
+}
+
+void HttpClient::SetMaxResponseSize(size_t bytes) {
+    m_impl->options.maxResponseSize = bytes;
 }
 
 void HttpClient::SetTimeout(int seconds) {
-    m_impl->timeout = seconds;
+    m_impl->options.timeout = seconds;
+}
+
+void HttpClient::SetDeadline(std::chrono::steady_clock::time_point deadline) {
+    m_impl->options.hasDeadline = true;
+    m_impl->options.deadline = deadline;
 }
 
 void HttpClient::SetVerifySSL(bool verify) {
-    m_impl->verifySSL = verify;
+    m_impl->options.verifySSL = verify;
+}
+
+void HttpClient::SetRetryPolicy(const HttpRetryPolicy& policy) {
+    m_impl->options.retry = policy;
+}
+
+HttpRetryStats HttpClient::GetRetryStats() {
+    return HttpMetrics::Instance().RetryStats();
+}
+
+void HttpClient::SetMetricsName(const std::string& name) {
+    m_impl->options.metricsName = name;
+}
+
+std::vector<HttpEndpointStats> HttpClient::GetEndpointStats() {
+    return HttpMetrics::Instance().EndpointStats();
 }
 
+void HttpClient::LogStats() {
+    HttpRetryStats stats = GetRetryStats();
+    LOG_INFO("[HttpClient] requests=" + std::to_string(stats.requests) + " attempts=" + std::to_string(stats.attempts) +
+             " retries=" + std::to_string(stats.retries) + " hedges=" + std::to_string(stats.hedges) +
+             " (won " + std::to_string(stats.hedgeWins) + ")");
+
+    auto phase = [](const char* name, const HttpHistogram& histogram) {
+        return std::string(" ") + name + " " + std::to_string(histogram.PercentileMs(50)) + "/" +
+               std::to_string(histogram.PercentileMs(95));
+    };
+    for (const HttpEndpointStats& endpoint : GetEndpointStats()) {
+        LOG_INFO("[HttpClient] " + endpoint.endpoint + ": n=" + std::to_string(endpoint.requests) + " failed=" +
+                 std::to_string(endpoint.failures) + " reused=" + std::to_string(endpoint.reusedConnections) +
+                 ", p50/p95 ms:" + phase("dns", endpoint.dns) + phase("connect", endpoint.connect) +
+                 phase("tls", endpoint.tls) + phase("server", endpoint.server) +
+                 phase("transfer", endpoint.transfer) + phase("total", endpoint.total));
+    }
+}
+
+void HttpClient::Prewarm(const std::vector<std::string>& origins) {
+    DefaultTransport()->Prewarm(origins);
+}
+
+void HttpClient::StopPrewarm() {
+    DefaultTransport()->StopPrewarm();
+}
+
+void HttpClient::Shutdown(int graceMs) {
+    DefaultTransport()->Shutdown(graceMs);
+}
@@ -1,4 +1,4 @@
-// HttpClient.h: Modern HTTP client wrapper using libcurl
+// HttpClient.h: Modern HTTP client wrapper over a pluggable transport (libcurl by default)
 // Handles redirects, SSL, timeouts automatically
 //
 #pragma once
@@ -7,39 +7,219 @@
 #include <map>
 #include <functional>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
 
 // Forward declaration to avoid including curl.h in header
 typedef void CURL;
 
-/// Simple HTTP client using libcurl
-/// Automatically handles redirects (including 308), SSL, timeouts
+class IHttpTransport;
+
+/// Where one request's time went, for the attempt that produced its outcome
+/// The phases are consecutive: dns + connect + tls + server + transfer adds up to total (any
+/// redirects and local queueing make up the rest). On a reused connection the first three are 0.
+struct HttpTiming {
+    int64_t dnsUs = 0;
+    int64_t connectUs = 0;          // TCP handshake
+    int64_t tlsUs = 0;              // TLS handshake (0 for http://)
+    int64_t serverUs = 0;           // Request sent until the first response byte: processing + a round trip
+    int64_t transferUs = 0;         // First to last response byte
+    int64_t totalUs = 0;
+    int64_t bytesSent = 0;          // Headers and body
+    int64_t bytesReceived = 0;
+    bool reusedConnection = false;
+};
+
+/// Latency histogram with fixed, roughly logarithmic buckets
+struct HttpHistogram {
+    static const int kBuckets = 14;
+    static const int kUpperMs[kBuckets];    // Inclusive upper bound of each bucket; the last is open
+    
+    uint64_t counts[kBuckets] = {};
+    uint64_t count = 0;
+    int64_t sumUs = 0;
+    int64_t maxUs = 0;
+    
+    void Add(int64_t us);
+    /// Upper bound (ms) of the bucket holding the p-th percentile (0-100); 0 when empty
+    int PercentileMs(double p) const;
+};
+
+/// Phase histograms and counters of one endpoint (see HttpClient::SetMetricsName), per attempt
+struct HttpEndpointStats {
+    std::string endpoint;
+    uint64_t requests = 0;
+    uint64_t failures = 0;          // Transport errors and non-200 responses
+    uint64_t reusedConnections = 0;
+    uint64_t bytesSent = 0;
+    uint64_t bytesReceived = 0;
+    HttpHistogram dns;
+    HttpHistogram connect;
+    HttpHistogram tls;
+    HttpHistogram server;
+    HttpHistogram transfer;
+    HttpHistogram total;
+};
+
+/// Handle to one request started by HttpClient
+class HttpRequest {
+public:
+    /// Abort the request. Unless it already completed, its callback runs once (on the I/O
+    /// thread, shortly after) with HttpClient::kStatusCanceled. Safe to call from any thread.
+    void Cancel();
+    
+    bool IsCanceled() const { return m_canceled.load(); }
+    bool IsFinished() const { return m_finished.load(); }
+    
+    /// Attempts repeated after a failure so far (see HttpRetryPolicy)
+    int Retries() const { return m_retries.load(); }
+    /// Whether a hedged second attempt was started
+    bool Hedged() const { return m_hedged.load(); }
+    /// Phase timing; valid once IsFinished() (and in the response callback)
+    const HttpTiming& Timing() const { return m_timing; }
+    
+private:
+    friend class HttpClient;
+    friend struct HttpRequestAccess;
+    
+    std::function<void()> m_cancelHook;    // Set by the transport before the handle is returned
+    std::atomic<bool> m_canceled{ false };
+    std::atomic<bool> m_finished{ false };
+    std::atomic<int> m_retries{ 0 };
+    std::atomic<bool> m_hedged{ false };
+    HttpTiming m_timing;
+};
+
+/// How a client retries failed requests (default: a single attempt)
+/// Failures that show the request never reached the server (DNS, connect, 429, 503) are
+/// retried for any request; ones after which it may have been processed (timeouts, resets,
+/// 500/502/504) only for idempotent requests. Backoff before retry n is
+/// baseDelayMs * 2^(n-1), capped at maxDelayMs, with a random half of it taken off.
+struct HttpRetryPolicy {
+    int maxAttempts = 1;        // Total attempts, hedge included
+    int baseDelayMs = 250;
+    int maxDelayMs = 4000;
+    bool idempotent = false;    // Safe for the server to see twice
+    int hedgeAfterMs = 0;       // Idempotent only: with no answer after this long (or the endpoint's
+                                // observed p95 once known) send a second attempt; first success wins
+};
+
+/// Per-client settings, copied into every request so the HttpClient may go away right after PostAsync
+struct HttpRequestOptions {
+    int timeout = 30;                   // Seconds
+    bool verifySSL = true;
+    size_t maxResponseSize = 8 * 1024 * 1024;
+    std::string metricsName;
+    bool hasDeadline = false;
+    std::chrono::steady_clock::time_point deadline;
+    HttpRetryPolicy retry;
+    
+    /// Milliseconds an attempt started now may take (<= 0: the deadline already passed)
+    long TimeoutMs() const;
+};
+
+/// Process-wide request counters, for tail latency analysis
+struct HttpRetryStats {
+    uint64_t requests;
+    uint64_t attempts;
+    uint64_t retries;
+    uint64_t hedges;
+    uint64_t hedgeWins;         // Hedges that answered first
+};
+
+/// Simple HTTP client
+/// Requests go through an IHttpTransport (HttpTransport.h): by default CurlTransport, which
+/// handles redirects (including 308), SSL and timeouts, and runs all requests concurrently on
+/// one shared I/O thread (curl_multi). Callbacks are invoked on the transport's thread, so keep
+/// them short and hand real work off elsewhere.
 class HttpClient {
 public:
     /// Callback type for HTTP response
     /// Parameters: (success, response_or_error, status_code)
+    /// status_code is the HTTP status, 0 for transport errors, or one of the values below
     using ResponseCallback = std::function<void(bool, const std::string&, int)>;
     
+    /// Receives the body of a 200 response chunk by chunk (on the I/O thread); return false to abort
+    using BodyCallback = std::function<bool(const char* data, size_t size)>;
+    
+    static const int kStatusCanceled = -1;  // HttpRequest::Cancel(), or a BodyCallback returned false
+    static const int kStatusTimedOut = -2;  // Timeout or deadline reached
+    static const int kStatusTooLarge = -3;  // Body larger than SetMaxResponseSize()
+    
+    /// Client on the default transport (see SetDefaultTransport)
     HttpClient();
+    /// Client on a given transport, e.g. a LoopbackTransport in tests
+    explicit HttpClient(std::shared_ptr<IHttpTransport> transport);
     ~HttpClient();
     
+    /// Transport used by clients created afterwards with the default constructor (nullptr:
+    /// back to the shared CurlTransport). Prewarm/StopPrewarm/Shutdown act on it.
+    static void SetDefaultTransport(std::shared_ptr<IHttpTransport> transport);
+    
     /// Perform HTTP POST request
     /// @param url Target URL
     /// @param body Request body (JSON string)
     /// @param headers Request headers (key-value pairs)
-    /// @param callback Response callback
-    void PostAsync(
+    /// @param callback Response callback, called exactly once
+    /// @return Handle to cancel the request (may be ignored)
+    std::shared_ptr<HttpRequest> PostAsync(
+        const std::string& url,
+        const std::string& body,
+        const std::map<std::string, std::string>& headers,
+        ResponseCallback callback
+    );
+    
+    /// PostAsync for large responses: a 200 body goes to onBody as it arrives instead of being
+    /// buffered, and callback gets an empty response on success (error bodies are still
+    /// buffered). Never hedged, and only retried until the first chunk was delivered.
+    std::shared_ptr<HttpRequest> PostStreaming(
         const std::string& url,
         const std::string& body,
         const std::map<std::string, std::string>& headers,
+        BodyCallback onBody,
         ResponseCallback callback
     );
     
+    /// Largest response body accepted, in bytes (default: 8 MB); the transfer is aborted with
+    /// kStatusTooLarge as soon as Content-Length or the received data exceeds it
+    void SetMaxResponseSize(size_t bytes);
+    
     /// Set timeout in seconds (default: 30)
     void SetTimeout(int seconds);
     
+    /// Absolute deadline for requests started afterwards (default: none)
+    /// A request is given whichever comes first, the deadline or the timeout; one started
+    /// after its deadline fails at once with kStatusTimedOut.
+    void SetDeadline(std::chrono::steady_clock::time_point deadline);
+    
     /// Enable/disable SSL certificate verification (default: true)
     void SetVerifySSL(bool verify);
     
+    /// Retry/hedging policy for requests started afterwards
+    void SetRetryPolicy(const HttpRetryPolicy& policy);
+    
+    /// Endpoint name requests started afterwards are aggregated under in GetEndpointStats()
+    /// (default: the URL without its query; name endpoints whose path carries IDs)
+    void SetMetricsName(const std::string& name);
+    
+    static HttpRetryStats GetRetryStats();
+    static std::vector<HttpEndpointStats> GetEndpointStats();
+    /// Log the retry counters and a p50/p95 line per endpoint and phase
+    static void LogStats();
+    
+    /// Open pooled connections (DNS, TCP, TLS) to the given origins or URLs in the background,
+    /// and keep them open with a HEAD request every 45 s, so the first real request to each
+    /// skips the cold handshakes. Runs until StopPrewarm().
+    static void Prewarm(const std::vector<std::string>& origins);
+    static void StopPrewarm();
+    
+    /// Stop the default transport's I/O thread at application exit
+    /// Requests still running get up to graceMs to finish (e.g. a final StopAgent); the rest
+    /// are dropped without their callbacks. Requests made afterwards fail immediately.
+    static void Shutdown(int graceMs = 2000);
+    
 private:
     struct Impl;
     std::shared_ptr<Impl> m_impl;
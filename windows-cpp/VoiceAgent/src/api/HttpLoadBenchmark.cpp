@@ -0,0 +1,148 @@
+// HttpLoadBenchmark.cpp: Concurrent requests through HttpClient against a LocalHttpServer
+//
+
+#include "../general/pch.h"
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <sstream>
+#include "HttpLoadBenchmark.h"
+#include "HttpClient.h"
+#include "LocalHttpServer.h"
+#include "../tools/BenchmarkUtils.h"
+#include "../tools/Logger.h"
+#include <algorithm>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// How often the thread count is sampled while requests are in flight
+const auto kSampleInterval = std::chrono::milliseconds(20);
+
+// Requests still out this long after the last one was sent are given up on
+const auto kDrainTimeout = std::chrono::seconds(60);
+
+// Shared with the callbacks, which may outlive a run that gave up waiting
+struct Progress {
+    std::mutex mutex;
+    std::condition_variable changed;
+    int inFlight = 0;
+    uint64_t succeeded = 0;
+    uint64_t failed = 0;
+    std::vector<double> latency;
+};
+
+}  // namespace
+
+bool HttpLoadBenchmark::RunFromCommandLine(const std::string& commandLine) {
+    CommandLineArgs args(commandLine);
+    if (!args.Has("/benchhttp")) {
+        return false;
+    }
+    int requests = (std::max)(1, (int)args.Number("requests", 5000));
+    int concurrency = (std::max)(1, (int)args.Number("concurrency", 200));
+    LoopbackLatency latency;
+    latency.medianMs = (std::max)(0, (int)args.Number("latency", 20));
+    latency.p99Ms = (std::max)(0, (int)args.Number("p99", latency.medianMs * 3));
+    size_t size = (size_t)(std::max)(0.0, args.Number("size", 1024));
+
+    LocalHttpServer server;
+    server.Route("/bench", LoopbackResponse{ 200, "{\"data\":\"" + std::string(size, 'x') + "\"}" }, latency);
+    if (!server.Start()) {
+        LOG_ERROR("[HttpLoadBenchmark] No local server, nothing to measure");
+        return true;
+    }
+    std::string url = server.Origin() + "/bench";
+    std::string body = R"({"benchmark":"http","payload":"0123456789abcdef"})";
+    std::map<std::string, std::string> headers;
+    headers["Content-Type"] = "application/json; charset=utf-8";
+
+    HttpClient client;
+    client.SetMetricsName("bench.http");
+    int threadsBefore = ProcessThreadCount();
+    int threadsPeak = threadsBefore;
+    Clock::time_point lastSample = Clock::now();
+    auto sampleThreads = [&threadsPeak, &lastSample]() {
+        if (Clock::now() - lastSample >= kSampleInterval) {
+            threadsPeak = (std::max)(threadsPeak, ProcessThreadCount());
+            lastSample = Clock::now();
+        }
+    };
+    if (args.Number("verbose", 0) == 0) {
+        Logger::instance().setLogLevel(LogLevel::Warn);
+    }
+
+    auto progress = std::make_shared<Progress>();
+    Clock::time_point start = Clock::now();
+    for (int sent = 0; sent < requests;) {
+        {
+            std::unique_lock<std::mutex> lock(progress->mutex);
+            if (!progress->changed.wait_for(lock, kSampleInterval,
+                                            [&] { return progress->inFlight < concurrency; })) {
+                lock.unlock();
+                sampleThreads();
+                continue;
+            }
+            ++progress->inFlight;
+        }
+        Clock::time_point requestStart = Clock::now();
+        client.PostAsync(url, body, headers, [progress, requestStart](bool success, const std::string&, int) {
+            double ms = MillisecondsSince(requestStart);
+            std::lock_guard<std::mutex> lock(progress->mutex);
+            --progress->inFlight;
+            progress->latency.push_back(ms);
+            if (success) {
+                ++progress->succeeded;
+            } else {
+                ++progress->failed;
+            }
+            progress->changed.notify_all();
+        });
+        ++sent;
+        sampleThreads();
+    }
+    Clock::time_point drainEnd = Clock::now() + kDrainTimeout;
+    bool drained = false;
+    while (!drained && Clock::now() < drainEnd) {
+        std::unique_lock<std::mutex> lock(progress->mutex);
+        drained = progress->changed.wait_for(lock, kSampleInterval, [&] { return progress->inFlight == 0; });
+        lock.unlock();
+        sampleThreads();
+    }
+    double seconds = MillisecondsSince(start) / 1000.0;
+    int threadsAfter = ProcessThreadCount();
+    Logger::instance().setLogLevel(LogLevel::Info);
+
+    std::vector<double> samples;
+    uint64_t succeeded = 0;
+    uint64_t failed = 0;
+    int abandoned = 0;
+    {
+        std::lock_guard<std::mutex> lock(progress->mutex);
+        samples = progress->latency;
+        succeeded = progress->succeeded;
+        failed = progress->failed;
+        abandoned = progress->inFlight;
+    }
+    server.Stop();
+
+    std::ostringstream summary;
+    summary.setf(std::ios::fixed);
+    summary.precision(1);
+    summary << "[HttpLoadBenchmark] " << requests << " requests, " << concurrency << " in flight, server latency p50 "
+            << latency.medianMs << " / p99 " << latency.p99Ms << " ms, " << size << " byte bodies: " << seconds
+            << " s, " << (seconds > 0 ? (succeeded + failed) / seconds : 0) << " req/s, ok " << succeeded
+            << ", failed " << failed << ", no answer " << abandoned;
+    LOG_INFO(summary.str());
+    LOG_INFO("[HttpLoadBenchmark] " + LatencySummary::Of(samples).Format("latency"));
+    LOG_INFO("[HttpLoadBenchmark] threads: " + std::to_string(threadsBefore) + " before, " +
+             std::to_string(threadsPeak) + " at peak, " + std::to_string(threadsAfter) +
+             " after (server thread included); " + std::to_string(server.Connections()) +
+             " TCP connections for " + std::to_string(server.Requests()) + " requests");
+    HttpClient::LogStats();
+    return true;
+}
@@ -0,0 +1,21 @@
+// HttpLoadBenchmark.h: Concurrent requests through HttpClient's default transport against a
+// LocalHttpServer, reporting latency and the process's thread count
+//
+#pragma once
+
+#include <string>
+
+/// Runs "/benchhttp [requests=N] [concurrency=N] [latency=MS] [p99=MS] [size=BYTES] [verbose=1]"
+/// and logs the report
+///
+/// Keeps concurrency requests (200 by default) in flight through CurlTransport until requests
+/// (5000) have completed. The server answers on 127.0.0.1 over HTTP/1.1 after a log-normal
+/// latency (median latency, 99th percentile p99) with a size-byte body. Reported: throughput,
+/// client-side latency percentiles, the process's thread count before, at peak and after
+/// (the server's one thread included), TCP connections opened against requests served, and
+/// HttpClient::LogStats(). More than 256 in flight shows the transport's bound as failed requests.
+class HttpLoadBenchmark {
+public:
+    /// Returns false, doing nothing, for other command lines
+    static bool RunFromCommandLine(const std::string& commandLine);
+};
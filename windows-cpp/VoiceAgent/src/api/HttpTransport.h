@@ -0,0 +1,84 @@
+// HttpTransport.h: Transport interface behind HttpClient, and what implementations share
+// CurlTransport talks to real servers; LoopbackTransport answers from memory (tests, load runs)
+//
+#pragma once
+
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <vector>
+#include "HttpClient.h"
+
+/// Everything a transport needs to run one POST; copied, so the client may go away meanwhile
+struct HttpRequestSpec {
+    std::string url;
+    std::string body;
+    std::map<std::string, std::string> headers;
+    HttpRequestOptions options;
+};
+
+/// Runs HttpClient's requests
+/// Post must honour the whole HttpClient contract: the callback runs exactly once (or never
+/// after Shutdown), HttpRequest::Cancel, timeout and deadline end the request with
+/// kStatusCanceled / kStatusTimedOut, bodies over maxResponseSize with kStatusTooLarge, and
+/// options.retry is applied. Counters go to HttpMetrics so GetRetryStats/LogStats see them.
+class IHttpTransport {
+public:
+    virtual ~IHttpTransport() = default;
+
+    /// Start a request; onBody is null unless the caller streams (HttpClient::PostStreaming)
+    virtual std::shared_ptr<HttpRequest> Post(
+        const HttpRequestSpec& spec,
+        HttpClient::BodyCallback onBody,
+        HttpClient::ResponseCallback callback
+    ) = 0;
+
+    virtual void Prewarm(const std::vector<std::string>& origins) {}
+    virtual void StopPrewarm() {}
+    virtual void Shutdown(int graceMs) {}
+
+    /// Whether an HTTP status (0: no response) is worth another attempt under HttpRetryPolicy.
+    /// Transport-level failures are classified by each transport.
+    static bool IsRetryableStatus(long statusCode, bool idempotent);
+    /// Exponential backoff before the given retry (1-based), with up to half of it taken off
+    /// at random so clients that failed together don't come back together
+    static int BackoffMs(const HttpRetryPolicy& policy, int retry, std::mt19937& rng);
+};
+
+/// Lets transports update handles without widening HttpRequest's interface
+struct HttpRequestAccess {
+    static void MarkFinished(HttpRequest& request) { request.m_finished = true; }
+    static void AddRetry(HttpRequest& request) { ++request.m_retries; }
+    static void MarkHedged(HttpRequest& request) { request.m_hedged = true; }
+    static void SetTiming(HttpRequest& request, const HttpTiming& timing) { request.m_timing = timing; }
+    static void SetCancelHook(HttpRequest& request, std::function<void()> hook) { request.m_cancelHook = std::move(hook); }
+};
+
+/// Process-wide counters and per-endpoint histograms, shared by every transport
+class HttpMetrics {
+public:
+    static HttpMetrics& Instance();
+
+    /// Name an attempt is aggregated under: options.metricsName, else the URL minus its query
+    static std::string EndpointName(const std::string& url, const HttpRequestOptions& options);
+
+    /// One finished attempt (prewarm probes excepted)
+    void RecordAttempt(const std::string& endpoint, const HttpTiming& timing, bool success);
+
+    HttpRetryStats RetryStats() const;
+    std::vector<HttpEndpointStats> EndpointStats();
+
+    std::atomic<uint64_t> requests{ 0 };
+    std::atomic<uint64_t> attempts{ 0 };
+    std::atomic<uint64_t> retries{ 0 };
+    std::atomic<uint64_t> hedges{ 0 };
+    std::atomic<uint64_t> hedgeWins{ 0 };
+
+private:
+    HttpMetrics() = default;
+
+    std::mutex m_mutex;
+    std::map<std::string, HttpEndpointStats> m_endpoints;
+};
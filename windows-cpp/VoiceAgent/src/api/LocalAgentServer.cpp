@@ -0,0 +1,230 @@
+// LocalAgentServer.cpp: In-process stand-in for the Conversational AI REST API
+//
+
+#include "../general/pch.h"
+#include <memory>
+#include <mutex>
+#include <map>
+#include <set>
+#include <random>
+#include <chrono>
+#include "LocalAgentServer.h"
+#include "HttpClient.h"
+#include "../tools/Logger.h"
+#include <nlohmann/json.hpp>
+#include <algorithm>
+
+using json = nlohmann::json;
+
+template <typename Server>
+void LocalAgentServer::AddRoutes(Server& server) {
+    server.Route("/join/", [this](const HttpRequestSpec& request) { return Join(request); },
+                 m_config.joinLatency, m_config.resetRate);
+    server.Route("/leave", [this](const HttpRequestSpec& request) { return Leave(request); },
+                 m_config.leaveLatency, m_config.resetRate);
+    server.Route("/v2/token/generate", [this](const HttpRequestSpec& request) { return Token(request); },
+                 m_config.tokenLatency, m_config.resetRate);
+    server.Route("/health", [this](const HttpRequestSpec& request) { return Health(request); },
+                 m_config.healthLatency);
+}
+
+LocalAgentServer::LocalAgentServer(const LocalAgentServerConfig& config)
+    : m_config(config)
+    , m_bucket((std::max)(config.rateLimitBurst, 1))
+    , m_bucketTime(std::chrono::steady_clock::now())
+    , m_rng(config.seed + 1)
+{
+    if (config.inMemory) {
+        m_loopback = std::make_shared<LoopbackTransport>(config.seed);
+        AddRoutes(*m_loopback);
+    } else {
+        m_http = std::make_unique<LocalHttpServer>(config.seed);
+        AddRoutes(*m_http);
+    }
+}
+
+LocalAgentServer::~LocalAgentServer() {
+    Uninstall();
+    // Stop the server thread before the handlers' state goes away
+    if (m_http) {
+        m_http->Stop();
+    }
+    if (m_loopback) {
+        m_loopback->Shutdown(0);
+    }
+}
+
+bool LocalAgentServer::Install() {
+    if (m_http) {
+        if (!m_http->Start()) {
+            return false;
+        }
+        m_transport = std::make_shared<LocalRedirectTransport>(m_http->Origin());
+    } else {
+        m_transport = m_loopback;
+    }
+    HttpClient::SetDefaultTransport(m_transport);
+    m_installed = true;
+    LOG_INFO("[LocalAgentServer] Serving join/leave/health/token through " + TransportName());
+    return true;
+}
+
+std::string LocalAgentServer::TransportName() const {
+    if (m_loopback) {
+        return "LoopbackTransport in memory (CurlTransport's I/O thread, request bound, connection reuse and "
+               "hedging are not exercised)";
+    }
+    return "CurlTransport to " + m_http->Origin() + " (HTTP/1.1 over TCP: no TLS, no HTTP/2 multiplexing)";
+}
+
+void LocalAgentServer::Uninstall() {
+    if (m_installed) {
+        HttpClient::SetDefaultTransport(nullptr);
+        m_installed = false;
+    }
+}
+
+LocalAgentServerStats LocalAgentServer::Stats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    LocalAgentServerStats stats = m_stats;
+    stats.runningAgents = m_agentsById.size();
+    stats.connections = m_http ? m_http->Connections() : 0;
+    return stats;
+}
+
+LocalAgentServer::Response LocalAgentServer::Join(const HttpRequestSpec& request) {
+    std::string name;
+    try {
+        json body = json::parse(request.body);
+        if (body.contains("name") && body["name"].is_string()) {
+            name = body["name"].get<std::string>();
+        }
+    } catch (const std::exception&) {
+    }
+    if (name.empty()) {
+        return Response{ 400, R"({"detail":"name is required"})" };
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!TakeRateLimitToken()) {
+        return Response{ 429, R"({"detail":"too many requests"})" };
+    }
+    if (InjectError()) {
+        return Response{ 503, R"({"detail":"service unavailable"})" };
+    }
+    if (m_agentsByName.count(name)) {
+        if (m_lostJoins.count(name)) {
+            ++m_stats.conflictsAfterLoss;
+        } else {
+            ++m_stats.conflicts;
+        }
+        return Response{ 409, R"({"detail":"task conflict"})" };
+    }
+    std::string agentId = "local-" + std::to_string(m_nextAgent++);
+    m_agentsById[agentId] = name;
+    m_agentsByName[name] = agentId;
+    ++m_stats.joins;
+    m_stats.peakAgents = (std::max)(m_stats.peakAgents, m_agentsById.size());
+    bool lost = LoseResponse();
+    if (lost) {
+        m_lostJoins.insert(name);
+    }
+
+    json response = {
+        {"agent_id", agentId},
+        {"create_ts", std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count()},
+        {"status", "RUNNING"}
+    };
+    return Response{ 200, response.dump(), lost };
+}
+
+LocalAgentServer::Response LocalAgentServer::Leave(const HttpRequestSpec& request) {
+    static const std::string kAgents = "/agents/";
+    size_t start = request.url.find(kAgents);
+    size_t end = request.url.find("/leave");
+    if (start == std::string::npos || end == std::string::npos || end <= start + kAgents.size()) {
+        return Response{ 404, R"({"detail":"not found"})" };
+    }
+    std::string agentId = request.url.substr(start + kAgents.size(), end - start - kAgents.size());
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!TakeRateLimitToken()) {
+        return Response{ 429, R"({"detail":"too many requests"})" };
+    }
+    if (InjectError()) {
+        return Response{ 503, R"({"detail":"service unavailable"})" };
+    }
+    auto agent = m_agentsById.find(agentId);
+    if (agent == m_agentsById.end()) {
+        if (m_lostLeaves.count(agentId)) {
+            ++m_stats.notFoundAfterLoss;
+        } else {
+            ++m_stats.notFound;
+        }
+        return Response{ 404, R"({"detail":"task not found"})" };
+    }
+    m_lostJoins.erase(agent->second);
+    m_agentsByName.erase(agent->second);
+    m_agentsById.erase(agent);
+    ++m_stats.leaves;
+    bool lost = LoseResponse();
+    if (lost) {
+        m_lostLeaves.insert(agentId);
+    }
+    return Response{ 200, "{}", lost };
+}
+
+LocalAgentServer::Response LocalAgentServer::Token(const HttpRequestSpec& request) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (InjectError()) {
+        return Response{ 503, R"({"code":503,"msg":"service unavailable"})" };
+    }
+    ++m_stats.tokens;
+    json response = {
+        {"code", 0},
+        {"msg", "success"},
+        {"data", {{"token", "007local" + std::to_string(m_stats.tokens)}}}
+    };
+    return Response{ 200, response.dump() };
+}
+
+LocalAgentServer::Response LocalAgentServer::Health(const HttpRequestSpec& request) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ++m_stats.healthChecks;
+    return Response{ 200, R"({"status":"ok"})" };
+}
+
+bool LocalAgentServer::TakeRateLimitToken() {
+    if (m_config.rateLimitPerSecond <= 0) {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - m_bucketTime).count();
+    m_bucketTime = now;
+    double capacity = (std::max)(m_config.rateLimitBurst, 1);
+    m_bucket = (std::min)(capacity, m_bucket + elapsed * m_config.rateLimitPerSecond);
+    if (m_bucket < 1.0) {
+        ++m_stats.rateLimited;
+        return false;
+    }
+    m_bucket -= 1.0;
+    return true;
+}
+
+bool LocalAgentServer::InjectError() {
+    if (m_config.errorRate <= 0 || std::uniform_real_distribution<double>(0.0, 1.0)(m_rng) >= m_config.errorRate) {
+        return false;
+    }
+    ++m_stats.injectedErrors;
+    return true;
+}
+
+bool LocalAgentServer::LoseResponse() {
+    if (m_config.lostResponseRate <= 0 ||
+        std::uniform_real_distribution<double>(0.0, 1.0)(m_rng) >= m_config.lostResponseRate) {
+        return false;
+    }
+    ++m_stats.lostResponses;
+    return true;
+}
@@ -0,0 +1,108 @@
+// LocalAgentServer.h: In-process stand-in for the Conversational AI REST API and the toolbox
+// token service, for load-testing AgentManager without touching the real services
+// Served over TCP on 127.0.0.1 (LocalHttpServer) by default, so requests take the production
+// path through CurlTransport; inMemory answers through a LoopbackTransport instead
+//
+#pragma once
+
+#include <string>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <cstdint>
+#include "LoopbackTransport.h"
+#include "LocalHttpServer.h"
+
+/// Behaviour of the stand-in server
+struct LocalAgentServerConfig {
+    LoopbackLatency joinLatency{ 800, 3000 };
+    LoopbackLatency leaveLatency{ 300, 1500 };
+    LoopbackLatency healthLatency{ 5, 20 };
+    LoopbackLatency tokenLatency{ 150, 600 };
+    double resetRate = 0.0;         // Attempts dropped as connection resets, before the server sees them
+    double errorRate = 0.0;         // Attempts answered with 503 (join/leave/token)
+    double lostResponseRate = 0.0;  // Joins/leaves applied, then the connection reset before the answer
+    int rateLimitPerSecond = 0;     // join + leave requests per second before 429s (0: unlimited)
+    int rateLimitBurst = 10;
+    uint32_t seed = 1;
+    bool inMemory = false;          // LoopbackTransport, no sockets: CurlTransport is not exercised
+};
+
+/// What the stand-in server saw
+struct LocalAgentServerStats {
+    uint64_t joins = 0;             // Agents started
+    uint64_t leaves = 0;            // Agents stopped
+    uint64_t conflicts = 0;         // 409: an agent with that name is already running
+    uint64_t notFound = 0;          // 404: leave for an unknown agent
+    uint64_t rateLimited = 0;       // 429
+    uint64_t injectedErrors = 0;    // 503
+    uint64_t lostResponses = 0;     // Applied, answer dropped (lostResponseRate)
+    uint64_t conflictsAfterLoss = 0;    // 409 for a name whose join answer was lost: the client
+                                        // retried or rejoined an agent it never heard of
+    uint64_t notFoundAfterLoss = 0;     // 404 for an agent whose leave answer was lost
+    uint64_t tokens = 0;
+    uint64_t healthChecks = 0;
+    uint64_t connections = 0;       // TCP connections accepted (0 in memory)
+    size_t runningAgents = 0;
+    size_t peakAgents = 0;
+};
+
+/// Answers the requests AgentManager and TokenGenerator send
+/// POST {base}/{appId}/join/ starts an agent named after the request's "name" (409 if one with
+/// that name is running), POST {base}/{appId}/agents/{id}/leave stops it (404 if unknown),
+/// POST {base}/health and POST {toolbox}/v2/token/generate always succeed. Join and leave share
+/// one token-bucket rate limit, like the real API's per-project limit. Routes match on the path,
+/// so the configured server URLs don't matter. With lostResponseRate a join or leave is applied
+/// and its connection then reset, as when an answer is lost on the way back; the 409s and 404s
+/// that follow for that agent are counted apart from the others.
+/// Install() starts the server and makes the default HttpClient transport a CurlTransport whose
+/// URLs are redirected to it (or the LoopbackTransport, in memory); Uninstall() puts the plain
+/// CurlTransport back.
+class LocalAgentServer {
+public:
+    explicit LocalAgentServer(const LocalAgentServerConfig& config = LocalAgentServerConfig());
+    ~LocalAgentServer();
+
+    /// False if the local listener could not be started
+    bool Install();
+    void Uninstall();
+
+    /// What requests go through once installed, for reports
+    std::string TransportName() const;
+    LocalAgentServerStats Stats();
+
+private:
+    using Response = LoopbackTransport::Response;
+
+    template <typename Server>
+    void AddRoutes(Server& server);
+    Response Join(const HttpRequestSpec& request);
+    Response Leave(const HttpRequestSpec& request);
+    Response Token(const HttpRequestSpec& request);
+    Response Health(const HttpRequestSpec& request);
+
+    // Both take m_mutex
+    bool TakeRateLimitToken();
+    bool InjectError();
+    bool LoseResponse();
+
+    LocalAgentServerConfig m_config;
+    std::unique_ptr<LocalHttpServer> m_http;            // Over TCP...
+    std::shared_ptr<LoopbackTransport> m_loopback;      // ...or in memory
+    std::shared_ptr<IHttpTransport> m_transport;        // Installed as the default
+    bool m_installed = false;
+
+    std::mutex m_mutex;             // Handlers run on the server's thread, Stats() anywhere
+    std::map<std::string, std::string> m_agentsById;    // agent_id -> name
+    std::map<std::string, std::string> m_agentsByName;  // name -> agent_id
+    std::set<std::string> m_lostJoins;                  // Names started with the answer dropped
+    std::set<std::string> m_lostLeaves;                 // agent_ids stopped with the answer dropped
+    uint64_t m_nextAgent = 1;
+    double m_bucket = 0;
+    std::chrono::steady_clock::time_point m_bucketTime;
+    std::mt19937 m_rng;
+    LocalAgentServerStats m_stats;
+};
@@ -0,0 +1,496 @@
+// LocalHttpServer.cpp: Minimal HTTP/1.1 server on 127.0.0.1
+//
+
+#include "../general/pch.h"
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cctype>
+#include <cstdlib>
+#include "LocalHttpServer.h"
+#include "CurlTransport.h"
+#include "../tools/Logger.h"
+#include <algorithm>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+#ifdef _WIN32
+
+using SocketHandle = SOCKET;
+using PollEntry = WSAPOLLFD;
+const SocketHandle kNoSocket = INVALID_SOCKET;
+const int kSendFlags = 0;
+
+void CloseSocket(SocketHandle socket) { closesocket(socket); }
+bool WouldBlock() { return WSAGetLastError() == WSAEWOULDBLOCK; }
+int PollSockets(PollEntry* entries, size_t count, int timeoutMs) { return WSAPoll(entries, (ULONG)count, timeoutMs); }
+
+bool SetNonBlocking(SocketHandle socket) {
+    u_long on = 1;
+    return ioctlsocket(socket, FIONBIO, &on) == 0;
+}
+
+#else
+
+using SocketHandle = int;
+using PollEntry = pollfd;
+const SocketHandle kNoSocket = -1;
+#ifdef MSG_NOSIGNAL
+const int kSendFlags = MSG_NOSIGNAL;    // A client that hung up must not raise SIGPIPE
+#else
+const int kSendFlags = 0;
+#endif
+
+void CloseSocket(SocketHandle socket) { close(socket); }
+bool WouldBlock() { return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR; }
+int PollSockets(PollEntry* entries, size_t count, int timeoutMs) { return poll(entries, (nfds_t)count, timeoutMs); }
+
+bool SetNonBlocking(SocketHandle socket) {
+    int flags = fcntl(socket, F_GETFL, 0);
+    return flags >= 0 && fcntl(socket, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+#endif
+
+// Longest the server thread sleeps in poll(); bounds how long Stop() takes
+const int kPollIntervalMs = 20;
+
+// A header that grows past this without ending is not from curl: drop the connection
+const size_t kMaxHeaderSize = 64 * 1024;
+
+const size_t kReadChunk = 16 * 1024;
+
+// Drop a connection with a RST rather than a FIN, as when a server process goes away
+void ResetSocket(SocketHandle socket) {
+    linger option = {};
+    option.l_onoff = 1;
+    option.l_linger = 0;
+    setsockopt(socket, SOL_SOCKET, SO_LINGER, reinterpret_cast<const char*>(&option), sizeof(option));
+    CloseSocket(socket);
+}
+
+const char* ReasonPhrase(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 409: return "Conflict";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default:  return "Status";
+    }
+}
+
+std::string Lowercase(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return text;
+}
+
+}  // namespace
+
+// One accepted connection; server thread only
+struct LocalHttpServer::Connection {
+    SocketHandle socket = kNoSocket;
+    std::string in;                 // Received and not consumed yet
+    std::string out;                // Response (or 100 Continue) being written
+    size_t written = 0;
+    bool continued = false;         // 100 Continue sent for the request being read
+    bool waiting = false;           // A request was read; out goes out at due
+    bool reset = false;             // ...or the connection is reset at due instead
+    bool closeAfterWrite = false;   // The request asked for "Connection: close"
+    bool closed = false;
+    Clock::time_point due;
+};
+
+struct LocalHttpServer::Sockets {
+    SocketHandle listener = kNoSocket;
+    std::vector<std::unique_ptr<Connection>> connections;
+#ifdef _WIN32
+    bool winsockStarted = false;
+#endif
+};
+
+LocalHttpServer::LocalHttpServer(uint32_t seed)
+    : m_sockets(std::make_unique<Sockets>())
+    , m_rng(seed)
+{
+}
+
+LocalHttpServer::~LocalHttpServer() {
+    Stop();
+}
+
+void LocalHttpServer::Route(const std::string& urlPart, Handler handler, Latency latency, double errorRate) {
+    std::lock_guard<std::mutex> lock(m_routeMutex);
+    m_routes.push_back(RouteEntry{ urlPart, std::move(handler), latency, errorRate });
+}
+
+void LocalHttpServer::Route(const std::string& urlPart, const Response& response, Latency latency, double errorRate) {
+    Route(urlPart, [response](const HttpRequestSpec&) { return response; }, latency, errorRate);
+}
+
+bool LocalHttpServer::Start(int port) {
+    if (m_thread.joinable()) {
+        return true;
+    }
+#ifdef _WIN32
+    WSADATA data;
+    if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+        LOG_ERROR("[LocalHttpServer] WSAStartup failed");
+        return false;
+    }
+    m_sockets->winsockStarted = true;
+#endif
+
+    SocketHandle listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons((uint16_t)port);
+    socklen_t length = sizeof(address);
+    if (listener == kNoSocket ||
+        bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+        listen(listener, SOMAXCONN) != 0 ||
+        getsockname(listener, reinterpret_cast<sockaddr*>(&address), &length) != 0 ||
+        !SetNonBlocking(listener)) {
+        LOG_ERROR("[LocalHttpServer] Cannot listen on 127.0.0.1:" + std::to_string(port));
+        if (listener != kNoSocket) {
+            CloseSocket(listener);
+        }
+#ifdef _WIN32
+        WSACleanup();
+        m_sockets->winsockStarted = false;
+#endif
+        return false;
+    }
+
+    m_sockets->listener = listener;
+    m_port = ntohs(address.sin_port);
+    m_stopping = false;
+    m_thread = std::thread(&LocalHttpServer::Run, this);
+    LOG_INFO("[LocalHttpServer] Listening on " + Origin());
+    return true;
+}
+
+void LocalHttpServer::Stop() {
+    if (!m_thread.joinable()) {
+        return;
+    }
+    m_stopping = true;
+    m_thread.join();
+
+    for (auto& connection : m_sockets->connections) {
+        if (connection->socket != kNoSocket) {
+            CloseSocket(connection->socket);
+        }
+    }
+    m_sockets->connections.clear();
+    CloseSocket(m_sockets->listener);
+    m_sockets->listener = kNoSocket;
+#ifdef _WIN32
+    if (m_sockets->winsockStarted) {
+        WSACleanup();
+        m_sockets->winsockStarted = false;
+    }
+#endif
+    LOG_INFO("[LocalHttpServer] Stopped after " + std::to_string(m_connections.load()) + " connections, " +
+             std::to_string(m_requests.load()) + " requests");
+}
+
+std::string LocalHttpServer::Origin() const {
+    return "http://127.0.0.1:" + std::to_string(m_port);
+}
+
+void LocalHttpServer::Run() {
+    std::vector<PollEntry> entries;
+    std::vector<Connection*> polled;
+    while (!m_stopping) {
+        // Connections waiting out a latency are left out of the poll; the earliest one sets the timeout
+        Clock::time_point now = Clock::now();
+        long long timeoutMs = kPollIntervalMs;
+        entries.clear();
+        polled.clear();
+        PollEntry listener = {};
+        listener.fd = m_sockets->listener;
+        listener.events = POLLIN;
+        entries.push_back(listener);
+        for (auto& connection : m_sockets->connections) {
+            if (connection->waiting) {
+                long long wait = std::chrono::duration_cast<std::chrono::milliseconds>(connection->due - now).count();
+                timeoutMs = (std::max)(0LL, (std::min)(timeoutMs, wait));
+                continue;
+            }
+            PollEntry entry = {};
+            entry.fd = connection->socket;
+            entry.events = connection->out.empty() ? POLLIN : POLLOUT;
+            entries.push_back(entry);
+            polled.push_back(connection.get());
+        }
+        if (PollSockets(entries.data(), entries.size(), (int)timeoutMs) < 0) {
+            entries.assign(entries.size(), PollEntry());  // Interrupted: only answers that are due
+        }
+
+        if (entries[0].revents & POLLIN) {
+            Accept();
+        }
+        for (size_t i = 0; i < polled.size(); ++i) {
+            Connection& connection = *polled[i];
+            short events = entries[i + 1].revents;
+            if (events & POLLNVAL) {
+                connection.closed = true;
+            } else if (events & POLLOUT) {
+                connection.closed = !Write(connection);
+            } else if (events & (POLLIN | POLLHUP | POLLERR)) {
+                if (Read(connection)) {
+                    Answer(connection);
+                } else {
+                    connection.closed = true;
+                }
+            }
+        }
+
+        now = Clock::now();
+        for (auto& connection : m_sockets->connections) {
+            if (!connection->waiting || connection->due > now) {
+                continue;
+            }
+            connection->waiting = false;
+            if (connection->reset) {
+                ResetSocket(connection->socket);
+                connection->socket = kNoSocket;
+                connection->closed = true;
+            } else {
+                connection->closed = !Write(*connection);
+            }
+        }
+
+        auto& connections = m_sockets->connections;
+        for (auto& connection : connections) {
+            if (connection->closed && connection->socket != kNoSocket) {
+                CloseSocket(connection->socket);
+                connection->socket = kNoSocket;
+            }
+        }
+        connections.erase(std::remove_if(connections.begin(), connections.end(),
+                                         [](const std::unique_ptr<Connection>& connection) { return connection->closed; }),
+                          connections.end());
+    }
+}
+
+void LocalHttpServer::Accept() {
+    for (;;) {
+        SocketHandle socket = accept(m_sockets->listener, nullptr, nullptr);
+        if (socket == kNoSocket) {
+            return;
+        }
+        if (!SetNonBlocking(socket)) {
+            CloseSocket(socket);
+            continue;
+        }
+        int noDelay = 1;
+        setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+        auto connection = std::make_unique<Connection>();
+        connection->socket = socket;
+        m_sockets->connections.push_back(std::move(connection));
+        ++m_connections;
+    }
+}
+
+// Everything the socket has; false once the client closed or the connection failed
+bool LocalHttpServer::Read(Connection& connection) {
+    char buffer[kReadChunk];
+    for (;;) {
+        int received = (int)recv(connection.socket, buffer, (int)sizeof(buffer), 0);
+        if (received > 0) {
+            connection.in.append(buffer, received);
+            continue;
+        }
+        return received < 0 && WouldBlock();
+    }
+}
+
+// If a whole request has arrived, run its route and schedule the response
+void LocalHttpServer::Answer(Connection& connection) {
+    if (connection.waiting || !connection.out.empty()) {
+        return;
+    }
+    const std::string& in = connection.in;
+    size_t headerEnd = in.find("\r\n\r\n");
+    if (headerEnd == std::string::npos) {
+        if (in.size() > kMaxHeaderSize) {
+            connection.closed = true;
+        }
+        return;
+    }
+
+    size_t lineEnd = in.find("\r\n");
+    size_t methodEnd = in.find(' ');
+    size_t targetEnd = methodEnd == std::string::npos ? std::string::npos : in.find(' ', methodEnd + 1);
+    if (methodEnd == std::string::npos || targetEnd == std::string::npos || targetEnd > lineEnd) {
+        connection.closed = true;
+        return;
+    }
+    std::string method = in.substr(0, methodEnd);
+    std::string target = in.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+
+    HttpRequestSpec request;
+    size_t contentLength = 0;
+    bool expectContinue = false;
+    bool close = false;
+    for (size_t pos = lineEnd + 2; pos < headerEnd;) {
+        size_t end = in.find("\r\n", pos);
+        std::string line = in.substr(pos, end - pos);
+        pos = end + 2;
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        std::string name = line.substr(0, colon);
+        size_t valueStart = line.find_first_not_of(" \t", colon + 1);
+        std::string value = valueStart == std::string::npos ? std::string() : line.substr(valueStart);
+        std::string key = Lowercase(name);
+        if (key == "content-length") {
+            contentLength = (size_t)std::strtoull(value.c_str(), nullptr, 10);
+        } else if (key == "connection") {
+            close = Lowercase(value) == "close";
+        } else if (key == "expect") {
+            expectContinue = Lowercase(value) == "100-continue";
+        }
+        request.headers[name] = value;
+    }
+    if (in.size() < headerEnd + 4 + contentLength) {
+        if (expectContinue && !connection.continued) {
+            connection.continued = true;
+            connection.out = "HTTP/1.1 100 Continue\r\n\r\n";
+            connection.written = 0;
+        }
+        return;
+    }
+
+    request.url = Origin() + target;
+    request.body = in.substr(headerEnd + 4, contentLength);
+    connection.in.erase(0, headerEnd + 4 + contentLength);
+    connection.continued = false;
+    connection.closeAfterWrite = close;
+    ++m_requests;
+
+    RouteEntry route;
+    bool found = false;
+    {
+        std::lock_guard<std::mutex> lock(m_routeMutex);
+        for (const RouteEntry& entry : m_routes) {
+            if (request.url.find(entry.urlPart) != std::string::npos) {
+                route = entry;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    Response response;
+    int latencyMs = 0;
+    connection.reset = false;
+    if (!found) {
+        response.status = 404;
+        response.body = "no local route for " + target;
+    } else {
+        latencyMs = route.latency.Draw(m_rng);
+        if (route.errorRate > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(m_rng) < route.errorRate) {
+            connection.reset = true;
+        } else {
+            try {
+                response = route.handler(request);
+                connection.reset = response.drop;
+            } catch (const std::exception& e) {
+                LOG_ERROR("[LocalHttpServer] Exception in handler for " + target + ": " + e.what());
+                response.status = 500;
+                response.body = e.what();
+            }
+        }
+    }
+
+    connection.out = "HTTP/1.1 " + std::to_string(response.status) + " " + ReasonPhrase(response.status) +
+                     "\r\nContent-Type: application/json\r\nContent-Length: " + std::to_string(response.body.size()) +
+                     (close ? "\r\nConnection: close" : "") + "\r\n\r\n" + (method == "HEAD" ? "" : response.body);
+    connection.written = 0;
+    connection.waiting = true;
+    connection.due = Clock::now() + std::chrono::milliseconds(latencyMs);
+}
+
+// As much of out as the socket takes; false if the connection is done for
+bool LocalHttpServer::Write(Connection& connection) {
+    while (connection.written < connection.out.size()) {
+        int sent = (int)send(connection.socket, connection.out.data() + connection.written,
+                             (int)(connection.out.size() - connection.written), kSendFlags);
+        if (sent > 0) {
+            connection.written += sent;
+            continue;
+        }
+        return sent < 0 && WouldBlock();
+    }
+    connection.out.clear();
+    connection.written = 0;
+    if (connection.closeAfterWrite) {
+        return false;
+    }
+    Answer(connection);  // The next request may already be in
+    return true;
+}
+
+LocalRedirectTransport::LocalRedirectTransport(const std::string& origin, std::shared_ptr<IHttpTransport> transport)
+    : m_origin(origin)
+    , m_transport(transport ? std::move(transport) : std::make_shared<CurlTransport>())
+{
+}
+
+std::shared_ptr<HttpRequest> LocalRedirectTransport::Post(
+    const HttpRequestSpec& spec,
+    HttpClient::BodyCallback onBody,
+    HttpClient::ResponseCallback callback
+) {
+    HttpRequestSpec local = spec;
+    local.url = Rewrite(spec.url);
+    return m_transport->Post(local, std::move(onBody), std::move(callback));
+}
+
+void LocalRedirectTransport::Prewarm(const std::vector<std::string>& origins) {
+    std::vector<std::string> local;
+    for (const std::string& origin : origins) {
+        local.push_back(Rewrite(origin));
+    }
+    m_transport->Prewarm(local);
+}
+
+void LocalRedirectTransport::StopPrewarm() {
+    m_transport->StopPrewarm();
+}
+
+void LocalRedirectTransport::Shutdown(int graceMs) {
+    m_transport->Shutdown(graceMs);
+}
+
+std::string LocalRedirectTransport::Rewrite(const std::string& url) const {
+    size_t scheme = url.find("://");
+    size_t path = scheme == std::string::npos ? 0 : url.find('/', scheme + 3);
+    return m_origin + (path == std::string::npos ? std::string() : url.substr(path));
+}
@@ -0,0 +1,102 @@
+// LocalHttpServer.h: Minimal HTTP/1.1 server on 127.0.0.1, so load runs and benchmarks can go
+// through CurlTransport and real sockets without touching a remote service
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <cstdint>
+#include "LoopbackTransport.h"
+
+/// Serves routes like LoopbackTransport's, over TCP connections on the loopback interface
+/// One thread accepts, reads, answers and keeps connections alive with poll(). A route's handler
+/// runs on that thread once a request has been read in full; its response is written after the
+/// route's latency, without holding up other connections. A fraction errorRate of requests is
+/// answered with a connection reset instead, before the handler runs; a handler can also have
+/// the reset come after it acted (LoopbackResponse::drop). Speaks what curl sends over plain
+/// http: one request at a time per connection, Content-Length bodies, keep-alive unless
+/// "Connection: close".
+class LocalHttpServer {
+public:
+    using Response = LoopbackResponse;
+    using Latency = LoopbackLatency;
+    using Handler = LoopbackTransport::Handler;
+
+    explicit LocalHttpServer(uint32_t seed = 1);
+    ~LocalHttpServer();
+
+    LocalHttpServer(const LocalHttpServer&) = delete;
+    LocalHttpServer& operator=(const LocalHttpServer&) = delete;
+
+    /// Serve URLs containing urlPart (first registered match wins; none: 404)
+    void Route(const std::string& urlPart, Handler handler, Latency latency = Latency(), double errorRate = 0.0);
+    void Route(const std::string& urlPart, const Response& response, Latency latency = Latency(), double errorRate = 0.0);
+
+    /// Listen on 127.0.0.1:port (0: any free port) and start serving
+    bool Start(int port = 0);
+    /// Close the listener and every connection; requests not answered yet get no response
+    void Stop();
+
+    int Port() const { return m_port; }
+    /// "http://127.0.0.1:<port>"
+    std::string Origin() const;
+
+    uint64_t Connections() const { return m_connections.load(); }  // Accepted so far
+    uint64_t Requests() const { return m_requests.load(); }        // Read in full so far
+
+private:
+    struct Sockets;
+    struct Connection;
+    struct RouteEntry {
+        std::string urlPart;
+        Handler handler;
+        Latency latency;
+        double errorRate;
+    };
+
+    void Run();
+    void Accept();
+    bool Read(Connection& connection);
+    void Answer(Connection& connection);
+    bool Write(Connection& connection);
+
+    std::unique_ptr<Sockets> m_sockets;     // Server thread only once started
+    std::mutex m_routeMutex;
+    std::vector<RouteEntry> m_routes;
+    std::mt19937 m_rng;                     // Server thread only
+    std::thread m_thread;
+    std::atomic<bool> m_stopping{ false };
+    std::atomic<uint64_t> m_connections{ 0 };
+    std::atomic<uint64_t> m_requests{ 0 };
+    int m_port = 0;
+};
+
+/// Sends requests to a LocalHttpServer through another transport: the scheme, host and port of
+/// each URL are replaced with the server's origin and nothing else changes, so callers with
+/// hard-wired service URLs (AgentManager, TokenGenerator) run unmodified over real sockets
+class LocalRedirectTransport : public IHttpTransport {
+public:
+    /// transport: where the rewritten requests go (nullptr: CurlTransport)
+    explicit LocalRedirectTransport(const std::string& origin, std::shared_ptr<IHttpTransport> transport = nullptr);
+
+    std::shared_ptr<HttpRequest> Post(
+        const HttpRequestSpec& spec,
+        HttpClient::BodyCallback onBody,
+        HttpClient::ResponseCallback callback
+    ) override;
+
+    void Prewarm(const std::vector<std::string>& origins) override;
+    void StopPrewarm() override;
+    void Shutdown(int graceMs) override;
+
+private:
+    std::string Rewrite(const std::string& url) const;
+
+    std::string m_origin;
+    std::shared_ptr<IHttpTransport> m_transport;
+};
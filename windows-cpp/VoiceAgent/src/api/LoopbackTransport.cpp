@@ -0,0 +1,354 @@
+// LoopbackTransport.cpp: In-memory HttpClient transport with scripted responses
+//
+
+#include "../general/pch.h"
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <vector>
+#include <map>
+#include <condition_variable>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include "LoopbackTransport.h"
+#include "../tools/Logger.h"
+#include <algorithm>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// z-score of the 99th percentile of a standard normal distribution
+const double kZ99 = 2.3263478740;
+
+// Streaming callers get the body in chunks of about the size curl delivers
+const size_t kChunkSize = 16 * 1024;
+
+}  // namespace
+
+// One logical request; after Post queues it only the worker thread touches it
+struct LoopbackTransport::Call {
+    std::shared_ptr<HttpRequest> request;
+    HttpClient::ResponseCallback callback;
+    HttpClient::BodyCallback onBody;
+    HttpRequestSpec spec;
+    int attempts = 0;
+    bool done = false;
+};
+
+struct LoopbackTransport::Event {
+    enum Kind { kStart, kDeliver, kCancel };
+    Kind kind = kStart;
+    std::shared_ptr<Call> call;
+    Response response;          // kDeliver: what the attempt got back...
+    int latencyMs = 0;
+    bool timedOut = false;      // ...unless it ran out of time
+    bool reset = false;         // ...or failed as a dropped connection
+};
+
+// Simulated-time event queue. Every unfinished call has exactly one kStart or kDeliver event
+// in it, so an empty queue means nothing is in flight.
+struct LoopbackTransport::Queue {
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::multimap<Clock::time_point, Event> events;
+    bool closed = false;        // Shutdown: no new requests, drain until stopBy
+    bool stopped = false;       // Worker gone
+    Clock::time_point stopBy;
+
+    bool Push(Clock::time_point at, Event event, bool newRequest) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (stopped || (newRequest && closed)) {
+            return false;
+        }
+        events.emplace(at, std::move(event));
+        wake.notify_one();
+        return true;
+    }
+};
+
+LoopbackTransport::LoopbackTransport(uint32_t seed)
+    : m_queue(std::make_shared<Queue>())
+    , m_rng(seed)
+{
+    m_worker = std::thread(&LoopbackTransport::Run, this);
+}
+
+LoopbackTransport::~LoopbackTransport() {
+    Shutdown(0);
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+}
+
+void LoopbackTransport::Route(const std::string& urlPart, Handler handler, Latency latency, double errorRate) {
+    std::lock_guard<std::mutex> lock(m_routeMutex);
+    m_routes.push_back(RouteEntry{ urlPart, std::move(handler), latency, errorRate });
+}
+
+void LoopbackTransport::Route(const std::string& urlPart, const Response& response, Latency latency, double errorRate) {
+    Route(urlPart, [response](const HttpRequestSpec&) { return response; }, latency, errorRate);
+}
+
+std::shared_ptr<HttpRequest> LoopbackTransport::Post(
+    const HttpRequestSpec& spec,
+    HttpClient::BodyCallback onBody,
+    HttpClient::ResponseCallback callback
+) {
+    auto call = std::make_shared<Call>();
+    call->request = std::make_shared<HttpRequest>();
+    call->callback = std::move(callback);
+    call->onBody = std::move(onBody);
+    call->spec = spec;
+    std::shared_ptr<HttpRequest> request = call->request;
+
+    // Weak: a request handle may outlive the transport, and must not keep its call alive
+    std::weak_ptr<Queue> weakQueue = m_queue;
+    std::weak_ptr<Call> weakCall = call;
+    HttpRequestAccess::SetCancelHook(*request, [weakQueue, weakCall] {
+        std::shared_ptr<Queue> queue = weakQueue.lock();
+        std::shared_ptr<Call> call = weakCall.lock();
+        if (queue && call) {
+            Event event;
+            event.kind = Event::kCancel;
+            event.call = call;
+            queue->Push(Clock::now(), std::move(event), false);
+        }
+    });
+    ++HttpMetrics::Instance().requests;
+
+    if (spec.options.TimeoutMs() <= 0) {
+        Complete(*call, false, "deadline exceeded", HttpClient::kStatusTimedOut);
+        return request;
+    }
+    Event event;
+    event.kind = Event::kStart;
+    event.call = call;
+    if (!m_queue->Push(Clock::now(), std::move(event), true)) {
+        Complete(*call, false, "HttpClient busy or shut down", 0);
+    }
+    return request;
+}
+
+void LoopbackTransport::Shutdown(int graceMs) {
+    {
+        std::lock_guard<std::mutex> lock(m_queue->mutex);
+        if (!m_queue->closed) {
+            m_queue->closed = true;
+            m_queue->stopBy = Clock::now() + std::chrono::milliseconds(graceMs);
+        }
+        m_queue->wake.notify_one();
+    }
+    if (m_worker.joinable() && m_worker.get_id() != std::this_thread::get_id()) {
+        m_worker.join();
+    }
+}
+
+void LoopbackTransport::Run() {
+    Queue& queue = *m_queue;
+    std::unique_lock<std::mutex> lock(queue.mutex);
+    for (;;) {
+        Clock::time_point now = Clock::now();
+        if (queue.closed && (queue.events.empty() || now >= queue.stopBy)) {
+            break;
+        }
+        if (queue.events.empty()) {
+            queue.wake.wait(lock);
+            continue;
+        }
+        auto next = queue.events.begin();
+        if (next->first > now) {
+            queue.wake.wait_until(lock, queue.closed ? (std::min)(next->first, queue.stopBy) : next->first);
+            continue;
+        }
+        Event event = std::move(next->second);
+        queue.events.erase(next);
+        lock.unlock();
+
+        switch (event.kind) {
+            case Event::kStart:
+                StartAttempt(event.call);
+                break;
+            case Event::kDeliver:
+                Deliver(event);
+                break;
+            case Event::kCancel:
+                if (!event.call->done) {
+                    Complete(*event.call, false, "canceled", HttpClient::kStatusCanceled);
+                }
+                break;
+        }
+        lock.lock();
+    }
+
+    // Whatever did not finish in the grace period is dropped without its callback
+    queue.stopped = true;
+    std::multimap<Clock::time_point, Event> dropped;
+    dropped.swap(queue.events);
+    lock.unlock();
+    if (!dropped.empty()) {
+        LOG_INFO("[LoopbackTransport] Dropped " + std::to_string(dropped.size()) + " pending requests at shutdown");
+    }
+}
+
+// Worker thread: an attempt reaches the "server", which decides now what it answers and when
+void LoopbackTransport::StartAttempt(const std::shared_ptr<Call>& call) {
+    if (call->done) {
+        return;
+    }
+    if (call->request->IsCanceled()) {
+        Complete(*call, false, "canceled", HttpClient::kStatusCanceled);
+        return;
+    }
+    long timeoutMs = call->spec.options.TimeoutMs();
+    if (timeoutMs <= 0) {
+        Complete(*call, false, "deadline exceeded", HttpClient::kStatusTimedOut);
+        return;
+    }
+    ++call->attempts;
+    ++HttpMetrics::Instance().attempts;
+
+    RouteEntry route;
+    bool found = false;
+    {
+        std::lock_guard<std::mutex> lock(m_routeMutex);
+        for (const RouteEntry& entry : m_routes) {
+            if (call->spec.url.find(entry.urlPart) != std::string::npos) {
+                route = entry;
+                found = true;
+                break;
+            }
+        }
+    }
+
+    Event event;
+    event.kind = Event::kDeliver;
+    event.call = call;
+    if (!found) {
+        event.response.status = 404;
+        event.response.body = "no loopback route for " + call->spec.url;
+    } else {
+        event.latencyMs = route.latency.Draw(m_rng);
+        if (route.errorRate > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(m_rng) < route.errorRate) {
+            event.reset = true;
+        } else {
+            try {
+                event.response = route.handler(call->spec);
+                event.reset = event.response.drop;
+            } catch (const std::exception& e) {
+                LOG_ERROR("[LoopbackTransport] Exception in handler for " + call->spec.url + ": " + e.what());
+                event.response.status = 500;
+                event.response.body = e.what();
+            }
+        }
+    }
+    if (event.latencyMs >= timeoutMs) {
+        event.timedOut = true;
+        event.latencyMs = (int)timeoutMs;
+    }
+    Clock::time_point at = Clock::now() + std::chrono::milliseconds(event.latencyMs);
+    m_queue->Push(at, std::move(event), false);
+}
+
+// Worker thread: the attempt's answer arrives. Completes the call or schedules a retry.
+void LoopbackTransport::Deliver(Event& event) {
+    const std::shared_ptr<Call>& call = event.call;
+    if (call->done) {
+        return;
+    }
+    if (call->request->IsCanceled()) {
+        Complete(*call, false, "canceled", HttpClient::kStatusCanceled);
+        return;
+    }
+    const HttpRequestOptions& options = call->spec.options;
+    const Response& response = event.response;
+    bool answered = !event.timedOut && !event.reset;
+    bool tooLarge = answered && response.body.size() > options.maxResponseSize;
+    bool success = answered && !tooLarge && response.status == 200;
+
+    HttpTiming timing;
+    timing.reusedConnection = true;
+    timing.serverUs = event.latencyMs * 1000LL;
+    timing.totalUs = timing.serverUs;
+    timing.bytesSent = (int64_t)call->spec.body.size();
+    timing.bytesReceived = answered ? (int64_t)response.body.size() : 0;
+    HttpRequestAccess::SetTiming(*call->request, timing);
+    HttpMetrics::Instance().RecordAttempt(HttpMetrics::EndpointName(call->spec.url, options), timing, success);
+
+    if (success) {
+        if (!call->onBody) {
+            Complete(*call, true, response.body, response.status);
+            return;
+        }
+        for (size_t offset = 0; offset < response.body.size(); offset += kChunkSize) {
+            bool keepGoing = false;
+            try {
+                size_t size = (std::min)(kChunkSize, response.body.size() - offset);
+                keepGoing = call->onBody(response.body.data() + offset, size);
+            } catch (const std::exception& e) {
+                LOG_ERROR("[LoopbackTransport] Exception in body callback: " + std::string(e.what()));
+            }
+            if (!keepGoing) {
+                Complete(*call, false, "aborted by body callback", HttpClient::kStatusCanceled);
+                return;
+            }
+        }
+        Complete(*call, true, "", response.status);
+        return;
+    }
+
+    // Same classification as CurlTransport: a reset or timeout may have been acted on
+    std::string error;
+    int status = 0;
+    bool retryable = false;
+    if (event.timedOut) {
+        error = "Timeout was reached";
+        status = HttpClient::kStatusTimedOut;
+        retryable = options.retry.idempotent;
+    } else if (event.reset) {
+        error = "Connection reset by peer";
+        retryable = options.retry.idempotent;
+    } else if (tooLarge) {
+        error = "response too large";
+        status = HttpClient::kStatusTooLarge;
+    } else {
+        error = response.body;
+        status = response.status;
+        retryable = IsRetryableStatus(response.status, options.retry.idempotent);
+    }
+
+    if (retryable && call->attempts < options.retry.maxAttempts) {
+        int delayMs = BackoffMs(options.retry, call->request->Retries() + 1, m_rng);
+        if (options.TimeoutMs() > delayMs) {
+            HttpRequestAccess::AddRetry(*call->request);
+            ++HttpMetrics::Instance().retries;
+            Event retry;
+            retry.kind = Event::kStart;
+            retry.call = call;
+            m_queue->Push(Clock::now() + std::chrono::milliseconds(delayMs), std::move(retry), false);
+            return;
+        }
+    }
+    Complete(*call, false, error, status);
+}
+
+void LoopbackTransport::Complete(Call& call, bool success, const std::string& response, int statusCode) {
+    call.done = true;
+    HttpRequestAccess::MarkFinished(*call.request);
+    try {
+        call.callback(success, response, statusCode);
+    } catch (const std::exception& e) {
+        LOG_ERROR("[LoopbackTransport] Exception in callback: " + std::string(e.what()));
+    }
+}
+
+int LoopbackLatency::Draw(std::mt19937& rng) const {
+    if (p99Ms <= medianMs) {
+        return (std::max)(medianMs, 0);
+    }
+    double mu = std::log((double)(std::max)(medianMs, 1));
+    double sigma = (std::log((double)p99Ms) - mu) / kZ99;
+    std::lognormal_distribution<double> distribution(mu, sigma);
+    return (int)std::lround((std::min)(distribution(rng), 1e9));
+}
@@ -0,0 +1,87 @@
+// LoopbackTransport.h: In-memory HttpClient transport with scripted responses
+// Lets the API layer (TokenGenerator, AgentManager) and the retry/deadline logic run without
+// a network: install it with HttpClient::SetDefaultTransport or pass it to an HttpClient.
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include "HttpTransport.h"
+
+/// Scripted answer to one attempt
+struct LoopbackResponse {
+    int status = 200;
+    std::string body;
+    bool drop = false;      // The handler acted, then the connection is reset instead of answering
+};
+
+/// Server time per attempt, drawn from a log-normal distribution with the given median and
+/// 99th percentile (p99Ms <= medianMs: always medianMs)
+struct LoopbackLatency {
+    int medianMs = 0;
+    int p99Ms = 0;
+
+    int Draw(std::mt19937& rng) const;
+};
+
+/// Answers requests from routes registered up front, after a simulated server latency
+/// Requests complete on one worker thread as their latency elapses; all randomness comes from one
+/// seeded generator, so a run that posts from a single thread is reproducible. Cancel, timeout,
+/// deadline, maxResponseSize, streaming and the retry policy behave as on CurlTransport (except
+/// hedging, which is not simulated). Timing reports the latency as server time on a reused
+/// connection, and attempts are recorded in HttpMetrics like real ones.
+class LoopbackTransport : public IHttpTransport {
+public:
+    using Response = LoopbackResponse;
+    using Latency = LoopbackLatency;
+
+    /// Builds the response to one attempt; runs on the worker thread when the attempt arrives
+    using Handler = std::function<Response(const HttpRequestSpec& request)>;
+
+    explicit LoopbackTransport(uint32_t seed = 1);
+    ~LoopbackTransport();
+
+    /// Serve URLs containing urlPart (first registered match wins; none: 404). A fraction
+    /// errorRate of attempts fails as a connection reset instead of reaching the handler.
+    void Route(const std::string& urlPart, Handler handler, Latency latency = Latency(), double errorRate = 0.0);
+    void Route(const std::string& urlPart, const Response& response, Latency latency = Latency(), double errorRate = 0.0);
+
+    std::shared_ptr<HttpRequest> Post(
+        const HttpRequestSpec& spec,
+        HttpClient::BodyCallback onBody,
+        HttpClient::ResponseCallback callback
+    ) override;
+
+    /// Let pending requests finish for up to graceMs, then drop the rest without callbacks
+    void Shutdown(int graceMs) override;
+
+private:
+    struct Call;
+    struct Event;
+    struct Queue;
+    struct RouteEntry {
+        std::string urlPart;
+        Handler handler;
+        Latency latency;
+        double errorRate;
+    };
+
+    void Run();
+    void StartAttempt(const std::shared_ptr<Call>& call);
+    void Deliver(Event& event);
+    void Complete(Call& call, bool success, const std::string& response, int statusCode);
+
+    std::shared_ptr<Queue> m_queue;     // Shared with the cancel hooks of requests still out there
+    std::mutex m_routeMutex;
+    std::vector<RouteEntry> m_routes;
+    std::mt19937 m_rng;                 // Worker thread only
+    std::thread m_worker;
+};
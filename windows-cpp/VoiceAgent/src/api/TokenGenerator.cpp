@@ -23,7 +23,7 @@ static int64_t GetCurrentTimestampMs() {
 
 // TokenGenerator Implementation
 
-void TokenGenerator::GenerateToken(
+std::shared_ptr<HttpRequest> TokenGenerator::GenerateToken(
     const std::string& channelName,
     const std::string& uid,
     int expire,
@@ -62,11 +62,24 @@ void TokenGenerator::GenerateToken(
     // ✅ Use HttpClient (libcurl) - automatically handles redirects!
     HttpClient client;
     client.SetTimeout(15);
+    client.SetMetricsName("token.generate");
 
-    client.PostAsync(urlString, requestBodyStr, headers,
+    // Token generation has no side effects
+    HttpRetryPolicy retry;
+    retry.maxAttempts = 3;
+    retry.idempotent = true;
+    retry.hedgeAfterMs = 1500;
+    client.SetRetryPolicy(retry);
+
+    return client.PostAsync(urlString, requestBodyStr, headers,
         [callback, channelName, uid](bool success, const std::string& response, int statusCode) {
             LOG_INFO("[TokenGenerator] Response status: " + std::to_string(statusCode));
 
+            if (statusCode == HttpClient::kStatusCanceled) {
+                // Whoever canceled no longer wants the token
+                return;
+            }
+
             if (!success) {
                 LOG_ERROR("[TokenGenerator] Request failed: " + response);
                 if (callback) {
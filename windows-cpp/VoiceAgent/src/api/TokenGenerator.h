@@ -3,6 +3,9 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
+
+class HttpRequest;
 
 // Token Type
 enum class AgoraTokenType {
@@ -18,13 +21,17 @@ using TokenGenerateCallback = std::function<void(bool success, const std::string
 // Generate Agora RTC and RTM tokens via Toolbox Server API
 class TokenGenerator {
 public:
+    // Toolbox Server for Token Generation
+    static constexpr const char* TOOLBOX_SERVER_URL = "https://toolbox.bj2.agoralab.co";
+    
     /// Generate token
     /// @param channelName Channel name (use empty string for RTM-only token)
     /// @param uid User ID
     /// @param expire Token expiration time in seconds (default: 24 hours)
     /// @param types Token types to generate (default: RTC and RTM)
-    /// @param callback Callback with success flag, token, and error message
-    static void GenerateToken(
+    /// @param callback Callback with success flag, token, and error message (not called if canceled)
+    /// @return Handle to cancel the request
+    static std::shared_ptr<HttpRequest> GenerateToken(
         const std::string& channelName,
         const std::string& uid,
         int expire = 86400,
@@ -33,9 +40,6 @@ public:
     );
     
 private:
-    // Toolbox Server for Token Generation
-    static constexpr const char* TOOLBOX_SERVER_URL = "https://toolbox.bj2.agoralab.co";
-    
     // HTTP POST request helper
     static void PostRequest(
         const std::string& url,
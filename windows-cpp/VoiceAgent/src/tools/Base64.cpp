@@ -0,0 +1,115 @@
+#include "Base64.h"
+
+#include <cstdint>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BASE64_SSSE3 1
+#include <tmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define BASE64_SSSE3_TARGET
+#else
+#include <cpuid.h>
+#define BASE64_SSSE3_TARGET __attribute__((target("ssse3")))
+#endif
+#endif
+
+namespace {
+
+const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+// Whole 3-byte groups plus the padded tail
+void EncodeScalar(const unsigned char* in, size_t len, char* out) {
+    size_t i = 0;
+    for (; i + 3 <= len; i += 3) {
+        uint32_t v = (uint32_t(in[i]) << 16) | (uint32_t(in[i + 1]) << 8) | in[i + 2];
+        out[0] = kAlphabet[v >> 18];
+        out[1] = kAlphabet[(v >> 12) & 0x3F];
+        out[2] = kAlphabet[(v >> 6) & 0x3F];
+        out[3] = kAlphabet[v & 0x3F];
+        out += 4;
+    }
+    if (i < len) {
+        uint32_t v = uint32_t(in[i]) << 16;
+        if (i + 1 < len) {
+            v |= uint32_t(in[i + 1]) << 8;
+        }
+        out[0] = kAlphabet[v >> 18];
+        out[1] = kAlphabet[(v >> 12) & 0x3F];
+        out[2] = (i + 1 < len) ? kAlphabet[(v >> 6) & 0x3F] : '=';
+        out[3] = '=';
+    }
+}
+
+#ifdef BASE64_SSSE3
+
+bool HasSsse3() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    unsigned int eax, ebx, ecx, edx;
+    return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_SSSE3) != 0;
+#endif
+}
+
+// W. Mula's pshufb encoder: spread each 3 input bytes over 4 lanes, isolate the 6-bit
+// indices with two multiplies, then map index ranges to ASCII with one table lookup
+BASE64_SSSE3_TARGET
+size_t EncodeSsse3(const unsigned char* in, size_t len, char* out) {
+    const __m128i spread = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i maskHigh = _mm_set1_epi32(0x0fc0fc00);
+    const __m128i shiftHigh = _mm_set1_epi32(0x04000040);
+    const __m128i maskLow = _mm_set1_epi32(0x003f03f0);
+    const __m128i shiftLow = _mm_set1_epi32(0x01000010);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+
+    // Each step loads 16 bytes but consumes 12
+    size_t done = 0;
+    for (; done + 16 <= len; done += 12) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + done));
+        v = _mm_shuffle_epi8(v, spread);
+        __m128i high = _mm_mulhi_epu16(_mm_and_si128(v, maskHigh), shiftHigh);
+        __m128i low = _mm_mullo_epi16(_mm_and_si128(v, maskLow), shiftLow);
+        __m128i indices = _mm_or_si128(high, low);
+
+        // 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+        __m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+        __m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+        range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+        __m128i ascii = _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out), ascii);
+        out += 16;
+    }
+    return done;
+}
+
+const bool kUseSsse3 = HasSsse3();
+
+#endif
+
+}  // namespace
+
+void Base64::Encode(const void* data, size_t size, char* out) {
+    const unsigned char* in = static_cast<const unsigned char*>(data);
+#ifdef BASE64_SSSE3
+    if (kUseSsse3) {
+        size_t done = EncodeSsse3(in, size, out);
+        in += done;
+        size -= done;
+        out += done / 3 * 4;
+    }
+#endif
+    EncodeScalar(in, size, out);
+}
+
+void Base64::Append(std::string& out, const void* data, size_t size) {
+    size_t start = out.size();
+    out.resize(start + EncodedLength(size));
+    if (size > 0) {
+        Encode(data, size, &out[start]);
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <cstddef>
+
+// Standard (RFC 4648, padded) base64 encoding
+// Output is always presized: callers size the destination with EncodedLength() and the
+// encoder writes straight into it. Uses SSSE3 (12 bytes per step) when the CPU has it.
+class Base64 {
+public:
+    static size_t EncodedLength(size_t bytes) { return (bytes + 2) / 3 * 4; }
+
+    // Encode size bytes into exactly EncodedLength(size) chars at out
+    static void Encode(const void* data, size_t size, char* out);
+
+    // Append the encoding of data to out
+    static void Append(std::string& out, const void* data, size_t size);
+
+    static std::string Encode(std::string_view data) {
+        std::string out;
+        Append(out, data.data(), data.size());
+        return out;
+    }
+};
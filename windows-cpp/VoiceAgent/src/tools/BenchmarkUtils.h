@@ -0,0 +1,121 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstddef>
+
+#ifdef _WIN32
+#include <tlhelp32.h>
+#elif defined(__linux__)
+#include <filesystem>
+#endif
+
+// Helpers shared by the command-line benchmark drivers (VoiceAgent.exe /bench... key=value ...)
+
+// The "key=value" words of a command line; other words are ignored
+class CommandLineArgs {
+public:
+    explicit CommandLineArgs(const std::string& commandLine) {
+        std::istringstream words(commandLine);
+        std::string word;
+        while (words >> word) {
+            m_words.push_back(word);
+            size_t equals = word.find('=');
+            if (equals != std::string::npos) {
+                m_values[word.substr(0, equals)] = word.substr(equals + 1);
+            }
+        }
+    }
+
+    // True if the command line contains name (e.g. "/loadtest") as a word of its own
+    bool Has(const std::string& name) const {
+        return std::find(m_words.begin(), m_words.end(), name) != m_words.end();
+    }
+
+    double Number(const char* key, double fallback) const {
+        auto value = m_values.find(key);
+        return value == m_values.end() ? fallback : std::atof(value->second.c_str());
+    }
+
+    std::string Text(const char* key, const std::string& fallback = std::string()) const {
+        auto value = m_values.find(key);
+        return value == m_values.end() ? fallback : value->second;
+    }
+
+private:
+    std::vector<std::string> m_words;
+    std::map<std::string, std::string> m_values;
+};
+
+// Percentiles of a set of samples (milliseconds unless stated otherwise)
+struct LatencySummary {
+    size_t count = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+    double max = 0;
+
+    // Sorts samples
+    static LatencySummary Of(std::vector<double>& samples) {
+        LatencySummary summary;
+        summary.count = samples.size();
+        if (samples.empty()) {
+            return summary;
+        }
+        std::sort(samples.begin(), samples.end());
+        auto at = [&samples](double p) { return samples[(size_t)(p / 100.0 * (double)(samples.size() - 1))]; };
+        summary.p50 = at(50);
+        summary.p95 = at(95);
+        summary.p99 = at(99);
+        summary.max = samples.back();
+        return summary;
+    }
+
+    std::string Format(const char* name, int precision = 1, const char* unit = "ms") const {
+        std::ostringstream line;
+        line.setf(std::ios::fixed);
+        line.precision(precision);
+        line << name << ": n=" << count << " p50=" << p50 << " p95=" << p95 << " p99=" << p99 << " max=" << max
+             << " " << unit;
+        return line.str();
+    }
+};
+
+inline double MillisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Threads of this process right now (-1 where the platform can't tell)
+inline int ProcessThreadCount() {
+#ifdef _WIN32
+    HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPTHREAD, 0);
+    if (snapshot == INVALID_HANDLE_VALUE) {
+        return -1;
+    }
+    int count = 0;
+    DWORD process = GetCurrentProcessId();
+    THREADENTRY32 entry = {};
+    entry.dwSize = sizeof(entry);
+    for (BOOL more = Thread32First(snapshot, &entry); more; more = Thread32Next(snapshot, &entry)) {
+        if (entry.th32OwnerProcessID == process) {
+            ++count;
+        }
+    }
+    CloseHandle(snapshot);
+    return count;
+#elif defined(__linux__)
+    std::error_code ec;
+    int count = 0;
+    for (std::filesystem::directory_iterator task("/proc/self/task", ec), end; !ec && task != end; task.increment(ec)) {
+        ++count;
+    }
+    return ec ? -1 : count;
+#else
+    return -1;
+#endif
+}
@@ -0,0 +1,98 @@
+#include "BufferedFileWriter.h"
+#include "Logger.h"
+
+#include <cstring>
+
+BufferedFileWriter::BufferedFileWriter(size_t bufferSize)
+    : m_file(nullptr)
+    , m_buffer(bufferSize > 0 ? bufferSize : DEFAULT_BUFFER_SIZE)
+    , m_used(0)
+    , m_bytesWritten(0) {
+}
+
+BufferedFileWriter::~BufferedFileWriter() {
+    Close();
+}
+
+bool BufferedFileWriter::Open(const std::string& path) {
+    Close();
+
+#ifdef _WIN32
+    if (fopen_s(&m_file, path.c_str(), "wb") != 0) {
+        m_file = nullptr;
+    }
+#else
+    m_file = std::fopen(path.c_str(), "wb");
+#endif
+    if (!m_file) {
+        LOG_ERROR("[BufferedFileWriter] Failed to open " + path);
+        return false;
+    }
+    // We do our own buffering
+    std::setvbuf(m_file, nullptr, _IONBF, 0);
+    m_used = 0;
+    m_bytesWritten = 0;
+    return true;
+}
+
+void BufferedFileWriter::Close() {
+    if (!m_file) {
+        return;
+    }
+    FlushBuffer();
+    std::fclose(m_file);
+    m_file = nullptr;
+}
+
+void BufferedFileWriter::Write(std::string_view data) {
+    // Large payloads bypass the buffer instead of being copied through it
+    if (data.size() >= m_buffer.size()) {
+        FlushBuffer();
+        if (m_file) {
+            std::fwrite(data.data(), 1, data.size(), m_file);
+        }
+        m_bytesWritten += data.size();
+        return;
+    }
+    if (m_used + data.size() > m_buffer.size()) {
+        FlushBuffer();
+    }
+    memcpy(m_buffer.data() + m_used, data.data(), data.size());
+    m_used += data.size();
+}
+
+void BufferedFileWriter::WriteInt(int64_t value) {
+    char digits[24];
+    size_t n = 0;
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    do {
+        digits[n++] = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0) {
+        digits[n++] = '-';
+    }
+
+    if (m_used + n > m_buffer.size()) {
+        FlushBuffer();
+    }
+    while (n > 0) {
+        m_buffer[m_used++] = digits[--n];
+    }
+}
+
+bool BufferedFileWriter::Flush() {
+    FlushBuffer();
+    return m_file && std::fflush(m_file) == 0;
+}
+
+void BufferedFileWriter::FlushBuffer() {
+    if (m_used == 0) {
+        return;
+    }
+    if (m_file && std::fwrite(m_buffer.data(), 1, m_used, m_file) != m_used) {
+        LOG_ERROR("[BufferedFileWriter] Short write");
+    }
+    m_bytesWritten += m_used;
+    m_used = 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+
+// Append-only file writer with its own fixed buffer
+// Small writes are copied into the buffer; the file is only touched when it fills up,
+// on Flush() or on Close(). Not thread-safe.
+class BufferedFileWriter {
+public:
+    static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+
+    explicit BufferedFileWriter(size_t bufferSize = DEFAULT_BUFFER_SIZE);
+    ~BufferedFileWriter();
+
+    BufferedFileWriter(const BufferedFileWriter&) = delete;
+    BufferedFileWriter& operator=(const BufferedFileWriter&) = delete;
+
+    // Create (truncate) the file at path
+    bool Open(const std::string& path);
+    void Close();
+    bool IsOpen() const { return m_file != nullptr; }
+
+    void Write(std::string_view data);
+    void Put(char c) {
+        if (m_used == m_buffer.size()) FlushBuffer();
+        m_buffer[m_used++] = c;
+    }
+    void WriteInt(int64_t value);
+
+    // Hand the buffered bytes to the OS
+    bool Flush();
+
+    uint64_t BytesWritten() const { return m_bytesWritten + m_used; }
+
+private:
+    void FlushBuffer();
+
+    std::FILE* m_file;
+    std::vector<char> m_buffer;
+    size_t m_used;
+    uint64_t m_bytesWritten;
+};
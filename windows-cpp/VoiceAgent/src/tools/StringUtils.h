@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <Windows.h>
 #include <atlstr.h>
 
@@ -28,6 +29,25 @@ public:
         return result;
     }
 
+    // Convert a UTF-8 slice (not NUL-terminated) to Unicode CString for MFC controls
+    static CString Utf8ToCString(std::string_view utf8Str) {
+        if (utf8Str.empty()) {
+            return CString();
+        }
+
+        int wideCharLen = MultiByteToWideChar(CP_UTF8, 0, utf8Str.data(), (int)utf8Str.size(), nullptr, 0);
+        if (wideCharLen == 0) {
+            return CString();
+        }
+
+        CString result;
+        wchar_t* wideCharBuf = result.GetBuffer(wideCharLen);
+        MultiByteToWideChar(CP_UTF8, 0, utf8Str.data(), (int)utf8Str.size(), wideCharBuf, wideCharLen);
+        result.ReleaseBuffer(wideCharLen);
+
+        return result;
+    }
+
     // Convert UTF-8 std::string to std::wstring for logging
     static std::wstring Utf8ToWString(const std::string& utf8Str) {
         if (utf8Str.empty()) {
@@ -10,7 +10,9 @@
 #include "../tools/StringUtils.h"
 #include "../api/TokenGenerator.h"
 #include "../api/AgentManager.h"
+#include "../api/HttpClient.h"
 #include <ctime>
+#include <algorithm>
 
 #ifdef _DEBUG
 #define new DEBUG_NEW
@@ -25,12 +27,33 @@
 #define WM_AGENT_LEFT         (WM_USER + 7)
 #define WM_TRANSCRIPT_UPDATE  (WM_USER + 8)
 #define WM_AGENT_STATE_UPDATE (WM_USER + 9)
+#define WM_LOG_MESSAGE        (WM_USER + 10)  // lParam: CString* to log, owned by the handler
+#define WM_INTERRUPT_RESULT   (WM_USER + 11)  // wParam: success, lParam: error code
+#define WM_IMAGE_PREPARED     (WM_USER + 12)  // lParam: PreparedImage*, owned by the handler
+
+// An ImagePreparer result on its way from the worker thread to the UI thread
+struct PreparedImage {
+    bool ok = false;
+    std::vector<uint8_t> jpeg;
+    ImagePreparer::Result result;
+    std::string uuid;
+    std::string agentUserId;
+    uint64_t hash = 0;
+};
+
+static const char* const SESSION_JOURNAL_PATH = "logs/session.journal";
+static const char* const TRANSCRIPT_EXPORT_DIR = "logs/transcripts/";
 
 #define IDC_BTN_START     2001
 #define IDC_BTN_STOP      2002
 #define IDC_BTN_MUTE      2003
 #define IDC_LIST_MESSAGES 2004
 #define IDC_LIST_LOG      2005
+#define IDC_EDIT_SEARCH   2006
+#define IDC_BTN_SEARCH    2007
+#define IDC_EDIT_CHAT     2008
+#define IDC_BTN_SEND      2009
+#define IDC_BTN_IMAGE     2010
 
 IMPLEMENT_DYNAMIC(CMainFrame, CFrameWnd)
 
@@ -40,6 +63,9 @@ BEGIN_MESSAGE_MAP(CMainFrame, CFrameWnd)
     ON_BN_CLICKED(IDC_BTN_START, &CMainFrame::OnStartClicked)
     ON_BN_CLICKED(IDC_BTN_STOP, &CMainFrame::OnStopClicked)
     ON_BN_CLICKED(IDC_BTN_MUTE, &CMainFrame::OnMuteClicked)
+    ON_BN_CLICKED(IDC_BTN_SEARCH, &CMainFrame::OnSearchClicked)
+    ON_BN_CLICKED(IDC_BTN_SEND, &CMainFrame::OnSendClicked)
+    ON_BN_CLICKED(IDC_BTN_IMAGE, &CMainFrame::OnImageClicked)
     ON_MESSAGE(WM_TOKEN_FAILED, &CMainFrame::OnTokenFailed)
     ON_MESSAGE(WM_RTM_LOGIN_SUCCESS, &CMainFrame::OnRTMLoginSuccess)
     ON_MESSAGE(WM_RTM_LOGIN_FAILED, &CMainFrame::OnRTMLoginFailed)
@@ -49,6 +75,9 @@ BEGIN_MESSAGE_MAP(CMainFrame, CFrameWnd)
     ON_MESSAGE(WM_AGENT_LEFT, &CMainFrame::OnAgentLeft)
     ON_MESSAGE(WM_TRANSCRIPT_UPDATE, &CMainFrame::OnTranscriptUpdate)
     ON_MESSAGE(WM_AGENT_STATE_UPDATE, &CMainFrame::OnAgentStateUpdate)
+    ON_MESSAGE(WM_LOG_MESSAGE, &CMainFrame::OnLogMessage)
+    ON_MESSAGE(WM_INTERRUPT_RESULT, &CMainFrame::OnInterruptResult)
+    ON_MESSAGE(WM_IMAGE_PREPARED, &CMainFrame::OnImagePrepared)
 END_MESSAGE_MAP()
 
 // =============================================================================
@@ -61,6 +90,10 @@ CMainFrame::CMainFrame() noexcept
     , m_isActive(false)
     , m_isMuted(false)
     , m_rtmLoggedIn(false)
+    , m_searchCursor(0)
+    , m_imageCounter(0)
+    , m_requestsOpen(false)
+    , m_session(0)
     , m_userUid(9998)
     , m_agentUid(9999)
 {
@@ -68,10 +101,10 @@ CMainFrame::CMainFrame() noexcept
 
 CMainFrame::~CMainFrame()
 {
-    if (m_convoAIAPI) {
-        m_convoAIAPI->RemoveHandler(this);
-        m_convoAIAPI.reset();
-    }
+    // Pending HTTP callbacks capture this: let them finish (or drop them) first
+    HttpClient::Shutdown();
+    
+    ReleaseConvoAI();
     
     if (m_rtmClient) {
         if (m_rtmLoggedIn) {
@@ -106,6 +139,29 @@ BOOL CMainFrame::PreCreateWindow(CREATESTRUCT& cs)
     return TRUE;
 }
 
+BOOL CMainFrame::PreTranslateMessage(MSG* pMsg)
+{
+    // Esc anywhere in the window barges in on the agent
+    if (pMsg->message == WM_KEYDOWN && pMsg->wParam == VK_ESCAPE && m_isActive) {
+        InterruptAgent();
+        return TRUE;
+    }
+    
+    // Enter in the search box behaves like the Find button (repeat to jump to the next hit),
+    // Enter in the chat box sends
+    if (pMsg->message == WM_KEYDOWN && pMsg->wParam == VK_RETURN) {
+        if (pMsg->hwnd == m_editSearch.GetSafeHwnd()) {
+            OnSearchClicked();
+            return TRUE;
+        }
+        if (pMsg->hwnd == m_editChat.GetSafeHwnd()) {
+            OnSendClicked();
+            return TRUE;
+        }
+    }
+    return CFrameWnd::PreTranslateMessage(pMsg);
+}
+
 int CMainFrame::OnCreate(LPCREATESTRUCT lpCreateStruct)
 {
     if (CFrameWnd::OnCreate(lpCreateStruct) == -1)
@@ -116,6 +172,10 @@ int CMainFrame::OnCreate(LPCREATESTRUCT lpCreateStruct)
     
     SetupUI();
     SetupSDK();
+    RecoverLastSession();
+    
+    // DNS and TLS to both servers are done before the user clicks Start
+    HttpClient::Prewarm({ TokenGenerator::TOOLBOX_SERVER_URL, KeyCenter::AGENT_SERVER_BASE_URL });
 
     return 0;
 }
@@ -141,12 +201,34 @@ void CMainFrame::SetupTopPanel()
 {
     m_topPanel.Create(_T(""), WS_CHILD | WS_VISIBLE, CRect(0, 0, 10, 10), this);
     
-    m_listMessages.Create(WS_CHILD | WS_VISIBLE | WS_BORDER | LVS_REPORT | LVS_NOCOLUMNHEADER,
+    m_editSearch.Create(WS_CHILD | WS_VISIBLE | WS_BORDER | WS_TABSTOP | ES_AUTOHSCROLL,
+        CRect(0, 0, 10, 10), this, IDC_EDIT_SEARCH);
+    m_editSearch.SetFont(&m_normalFont);
+    m_editSearch.SetCueBanner(L"Search transcript");
+    
+    m_btnSearch.Create(_T("Find"), WS_CHILD | WS_VISIBLE | BS_PUSHBUTTON,
+        CRect(0, 0, 10, 10), this, IDC_BTN_SEARCH);
+    m_btnSearch.SetFont(&m_normalFont);
+    
+    m_listMessages.Create(WS_CHILD | WS_VISIBLE | WS_BORDER | LVS_REPORT | LVS_NOCOLUMNHEADER | LVS_SHOWSELALWAYS,
         CRect(0, 0, 10, 10), this, IDC_LIST_MESSAGES);
     m_listMessages.SetFont(&m_normalFont);
     m_listMessages.SetExtendedStyle(LVS_EX_FULLROWSELECT);
     m_listMessages.InsertColumn(0, _T("Messages"), LVCFMT_LEFT, 500);
     
+    m_editChat.Create(WS_CHILD | WS_VISIBLE | WS_BORDER | WS_TABSTOP | ES_AUTOHSCROLL,
+        CRect(0, 0, 10, 10), this, IDC_EDIT_CHAT);
+    m_editChat.SetFont(&m_normalFont);
+    m_editChat.SetCueBanner(L"Type a message to the agent");
+    
+    m_btnSend.Create(_T("Send"), WS_CHILD | WS_VISIBLE | BS_PUSHBUTTON,
+        CRect(0, 0, 10, 10), this, IDC_BTN_SEND);
+    m_btnSend.SetFont(&m_normalFont);
+    
+    m_btnImage.Create(_T("Image..."), WS_CHILD | WS_VISIBLE | BS_PUSHBUTTON,
+        CRect(0, 0, 10, 10), this, IDC_BTN_IMAGE);
+    m_btnImage.SetFont(&m_normalFont);
+    
     m_labelAgentStatus.Create(_T("Agent: Not Started"), WS_CHILD | WS_VISIBLE | SS_RIGHT,
         CRect(0, 0, 10, 10), this);
     m_labelAgentStatus.SetFont(&m_normalFont);
@@ -198,8 +280,15 @@ void CMainFrame::LayoutPanels()
     m_listLog.SetColumnWidth(0, LOG_PANEL_WIDTH - 20);
     
     m_topPanel.MoveWindow(0, 0, contentWidth, bottomTop);
-    m_listMessages.MoveWindow(PADDING, PADDING, msgWidth, bottomTop - PADDING - 30);
+    m_editSearch.MoveWindow(PADDING, PADDING, msgWidth - INPUT_BUTTON_WIDTH - 8, INPUT_HEIGHT);
+    m_btnSearch.MoveWindow(PADDING + msgWidth - INPUT_BUTTON_WIDTH, PADDING, INPUT_BUTTON_WIDTH, INPUT_HEIGHT);
+    int listTop = PADDING + INPUT_HEIGHT + 8;
+    int chatTop = bottomTop - 30 - INPUT_HEIGHT;
+    m_listMessages.MoveWindow(PADDING, listTop, msgWidth, chatTop - 8 - listTop);
     m_listMessages.SetColumnWidth(0, msgWidth - 20);
+    m_editChat.MoveWindow(PADDING, chatTop, msgWidth - 2 * (INPUT_BUTTON_WIDTH + 8), INPUT_HEIGHT);
+    m_btnImage.MoveWindow(PADDING + msgWidth - 2 * INPUT_BUTTON_WIDTH - 8, chatTop, INPUT_BUTTON_WIDTH, INPUT_HEIGHT);
+    m_btnSend.MoveWindow(PADDING + msgWidth - INPUT_BUTTON_WIDTH, chatTop, INPUT_BUTTON_WIDTH, INPUT_HEIGHT);
     m_labelAgentStatus.MoveWindow(PADDING, bottomTop - 25, msgWidth, 20);
     
     m_bottomPanel.MoveWindow(0, bottomTop, contentWidth, BOTTOM_PANEL_HEIGHT);
@@ -246,14 +335,24 @@ void CMainFrame::ShowActiveButtons()
 
 void CMainFrame::UpdateTranscripts()
 {
-    m_listMessages.DeleteAllItems();
-    for (size_t i = 0; i < m_transcripts.size(); ++i) {
-        const Transcript& t = m_transcripts[i];
-        CString prefix = (t.type == TranscriptType::Agent) ? _T("[Agent] ") : _T("[User] ");
-        m_listMessages.InsertItem((int)i, prefix + StringUtils::Utf8ToCString(t.text));
+    std::lock_guard<std::mutex> lock(m_transcriptMutex);
+    
+    // Only rows from the first modified turn onward can have changed
+    size_t count = m_transcripts.Size();
+    size_t first = m_transcripts.FirstDirtyIndex();
+    for (size_t i = first; i < count; ++i) {
+        CString prefix = (m_transcripts.GetType(i) == TranscriptType::Agent) ? _T("[Agent] ") : _T("[User] ");
+        CString line = prefix + StringUtils::Utf8ToCString(m_transcripts.GetText(i));
+        if ((int)i < m_listMessages.GetItemCount()) {
+            m_listMessages.SetItemText((int)i, 0, line);
+        } else {
+            m_listMessages.InsertItem((int)i, line);
+        }
     }
-    if (!m_transcripts.empty()) {
-        m_listMessages.EnsureVisible((int)m_transcripts.size() - 1, FALSE);
+    m_transcripts.ClearDirty();
+    
+    if (first < count) {
+        m_listMessages.EnsureVisible((int)count - 1, FALSE);
     }
 }
 
@@ -273,6 +372,15 @@ void CMainFrame::LogToView(const CString& message)
     LOG_INFO(std::string(CT2A(message)));
 }
 
+void CMainFrame::PostLog(const CString& message)
+{
+    // The list control belongs to the UI thread: never touch it from SDK or worker threads
+    CString* copy = new CString(message);
+    if (!GetSafeHwnd() || !PostMessage(WM_LOG_MESSAGE, 0, reinterpret_cast<LPARAM>(copy))) {
+        delete copy;
+    }
+}
+
 // =============================================================================
 // SDK Setup
 // =============================================================================
@@ -344,11 +452,42 @@ void CMainFrame::InitializeRTM()
 void CMainFrame::InitializeConvoAI()
 {
     if (!m_convoAIAPI) {
-        m_convoAIAPI = std::make_unique<ConversationalAIAPI>();
-        m_convoAIAPI->AddHandler(this);
+        auto api = std::make_shared<ConversationalAIAPI>(m_rtmClient);
+        api->AddHandler(this);
+        api->AddHandler(&m_exporter);
+        api->AddHandler(&m_stateAnalytics);
+        api->AddHandler(&m_imageCache);
+        std::lock_guard<std::mutex> lock(m_convoMutex);
+        m_convoAIAPI = api;
     }
 }
 
+void CMainFrame::ReleaseConvoAI()
+{
+    std::shared_ptr<ConversationalAIAPI> api;
+    {
+        std::lock_guard<std::mutex> lock(m_convoMutex);
+        api.swap(m_convoAIAPI);
+    }
+    if (!api) return;
+    
+    // An RTM callback may still hold a copy and finish the message it is handling, but with
+    // no handlers left that reaches nobody. Sends still queued fail here, on this thread,
+    // whichever thread drops the last reference.
+    api->RemoveHandler(this);
+    api->RemoveHandler(&m_exporter);
+    api->RemoveHandler(&m_stateAnalytics);
+    api->RemoveHandler(&m_imageCache);
+    api->Outbound().Shutdown();
+    api->Outbound().LogStats();
+}
+
+std::shared_ptr<ConversationalAIAPI> CMainFrame::ConvoAI()
+{
+    std::lock_guard<std::mutex> lock(m_convoMutex);
+    return m_convoAIAPI;
+}
+
 // =============================================================================
 // Button Actions
 // =============================================================================
@@ -374,19 +513,195 @@ void CMainFrame::OnMuteClicked()
     }
 }
 
+void CMainFrame::OnSearchClicked()
+{
+    CString text;
+    m_editSearch.GetWindowText(text);
+    std::string query = StringUtils::CStringToUtf8(text);
+    
+    // Queries take microseconds, so always re-run to pick up turns finished since the last click
+    std::vector<uint32_t> hits;
+    {
+        std::lock_guard<std::mutex> lock(m_transcriptMutex);
+        hits = m_transcripts.Search(query);
+    }
+    
+    // Same query again: continue after the row selected last time
+    size_t next = 0;
+    if (query == m_searchQuery && m_searchCursor > 0 && m_searchCursor <= m_searchHits.size()) {
+        uint32_t lastRow = m_searchHits[m_searchCursor - 1];
+        next = std::upper_bound(hits.begin(), hits.end(), lastRow) - hits.begin();
+        if (next == hits.size()) next = 0;
+    } else if (!hits.empty()) {
+        CString msg;
+        msg.Format(_T("Search: %d match(es)"), (int)hits.size());
+        LogToView(msg);
+    } else if (!query.empty()) {
+        LogToView(_T("Search: no match"));
+    }
+    
+    m_searchQuery = query;
+    m_searchHits.swap(hits);
+    m_searchCursor = 0;
+    SelectSearchHit(next);
+}
+
+void CMainFrame::OnSendClicked()
+{
+    CString text;
+    m_editChat.GetWindowText(text);
+    if (text.IsEmpty()) return;
+    
+    if (!m_convoAIAPI || !m_isActive) {
+        LogToView(_T("Chat: agent not ready"));
+        return;
+    }
+    
+    m_convoAIAPI->Chat(std::to_string(m_agentUid), TextMessage(StringUtils::CStringToUtf8(text)),
+        [this](bool success, int errorCode) {
+            // Completes on the RTM callback or dispatcher thread
+            CString msg;
+            if (success) {
+                msg = _T("Chat sent");
+            } else {
+                msg.Format(_T("Chat FAIL, code=%d"), errorCode);
+            }
+            PostLog(msg);
+        });
+    m_editChat.SetWindowText(_T(""));
+}
+
+void CMainFrame::OnImageClicked()
+{
+    if (!m_convoAIAPI || !m_isActive) {
+        LogToView(_T("Image: agent not ready"));
+        return;
+    }
+    if (m_convoAIAPI->Outbound().IsCongested(OutboundLane::Bulk)) {
+        LogToView(_T("Image: still sending earlier images, try again shortly"));
+        return;
+    }
+    
+    CFileDialog dlg(TRUE, nullptr, nullptr, OFN_FILEMUSTEXIST | OFN_HIDEREADONLY,
+        _T("Images (*.jpg;*.jpeg;*.png)|*.jpg;*.jpeg;*.png|All Files (*.*)|*.*||"), this);
+    if (dlg.DoModal() != IDOK) return;
+    
+    // Read here rather than passing the path down: CFile handles Unicode paths
+    std::vector<uint8_t> image;
+    CFile file;
+    if (file.Open(dlg.GetPathName(), CFile::modeRead | CFile::shareDenyWrite)) {
+        ULONGLONG length = file.GetLength();
+        if (length > 0 && length <= MAX_IMAGE_FILE_BYTES) {
+            image.resize(static_cast<size_t>(length));
+            image.resize(file.Read(image.data(), static_cast<UINT>(length)));
+        }
+        file.Close();
+    }
+    if (image.empty()) {
+        LogToView(_T("Image: cannot read file (or larger than 64 MB)"));
+        return;
+    }
+    
+    std::string uuid = "img_" + std::to_string(time(nullptr)) + "_" + std::to_string(++m_imageCounter);
+    std::string agentUserId = std::to_string(m_agentUid);
+    auto onSent = [this](bool success, int errorCode) { LogImageSendResult(success, errorCode); };
+    
+    // The same picture again: send its URL, or at least skip preparing it again
+    uint64_t hash = ImageUploadCache::Hash(image.data(), image.size());
+    ImageUploadCache::Hit hit = m_imageCache.Lookup(hash);
+    if (hit.kind == ImageUploadCache::HitKind::Url) {
+        LogToView(_T("Image sending: cached, by URL"));
+        m_imageCache.Alias(hash, uuid);
+        m_convoAIAPI->SendImageUrl(agentUserId, uuid, hit.imageUrl, onSent);
+        return;
+    }
+    if (hit.kind == ImageUploadCache::HitKind::Prepared) {
+        CString msg;
+        msg.Format(_T("Image sending: cached, %u bytes"), (unsigned)hit.prepared.size());
+        LogToView(msg);
+        m_imageCache.Alias(hash, uuid);
+        m_convoAIAPI->SendImage(agentUserId, uuid, std::move(hit.prepared), onSent);
+        return;
+    }
+    
+    // Downscale and re-encode on the preparer's worker; the result is sent from the UI thread,
+    // where the session (m_convoAIAPI) may have ended in the meantime
+    m_imagePreparer.Prepare(std::move(image), ImagePreparer::Options(),
+        [this, uuid, agentUserId, hash](bool ok, std::vector<uint8_t> jpeg, const ImagePreparer::Result& result) {
+            PreparedImage* prepared = new PreparedImage();
+            prepared->ok = ok;
+            prepared->jpeg = std::move(jpeg);
+            prepared->result = result;
+            prepared->uuid = uuid;
+            prepared->agentUserId = agentUserId;
+            prepared->hash = hash;
+            if (!GetSafeHwnd() || !PostMessage(WM_IMAGE_PREPARED, 0, reinterpret_cast<LPARAM>(prepared))) {
+                delete prepared;
+            }
+        });
+}
+
+void CMainFrame::InterruptAgent()
+{
+    if (!m_convoAIAPI) return;
+    
+    // The ack arrives on the RTM thread; report it from the UI thread
+    m_convoAIAPI->Interrupt(std::to_string(m_agentUid), [this](bool success, int errorCode) {
+        if (GetSafeHwnd()) {
+            PostMessage(WM_INTERRUPT_RESULT, success ? 1 : 0, (LPARAM)errorCode);
+        }
+    });
+}
+
+void CMainFrame::LogImageSendResult(bool success, int errorCode)
+{
+    // Runs on the RTM thread
+    CString msg;
+    if (success) {
+        msg = _T("Image sent");
+    } else {
+        msg.Format(_T("Image FAIL, code=%d"), errorCode);
+    }
+    PostLog(msg);
+}
+
+void CMainFrame::SelectSearchHit(size_t hit)
+{
+    if (hit >= m_searchHits.size()) return;
+    
+    int row = (int)m_searchHits[hit];
+    if (row < m_listMessages.GetItemCount()) {
+        m_listMessages.SetItemState(-1, 0, LVIS_SELECTED | LVIS_FOCUSED);
+        m_listMessages.SetItemState(row, LVIS_SELECTED | LVIS_FOCUSED, LVIS_SELECTED | LVIS_FOCUSED);
+        m_listMessages.EnsureVisible(row, FALSE);
+    }
+    m_searchCursor = hit + 1;
+}
+
 // =============================================================================
 // Session Management
 // =============================================================================
 
 void CMainFrame::StartSession()
 {
+    // The session's own requests keep the connections busy from here on
+    HttpClient::StopPrewarm();
     m_channelName = GenerateRandomChannelName();
-    m_transcripts.clear();
+    ClearTranscripts();
     m_listMessages.DeleteAllItems();
+    m_journal.Open(SESSION_JOURNAL_PATH, m_channelName);
+    m_stateAnalytics.Reset();
+    m_stateAnalytics.Start();
+    m_exporter.Open(TRANSCRIPT_EXPORT_DIR + m_channelName + "_" + std::to_string((long long)time(nullptr)));
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        m_requestsOpen = true;
+        ++m_session;
+    }
     UpdateAgentStatus(_T("Generating token..."));
     
     std::vector<AgoraTokenType> types = { AgoraTokenType::RTC, AgoraTokenType::RTM };
-    TokenGenerator::GenerateToken(m_channelName, std::to_string(m_userUid), 86400, types,
+    TrackRequest(TokenGenerator::GenerateToken(m_channelName, std::to_string(m_userUid), 86400, types,
         [this](bool ok, const std::string& token, const std::string&) {
             if (!GetSafeHwnd()) return;
             if (!ok) {
@@ -399,20 +714,26 @@ void CMainFrame::StartSession()
             UpdateAgentStatus(_T("Joining..."));
             JoinRTCChannel(token);
             LoginRTM(token);
-        });
+        }));
 }
 
 void CMainFrame::StopSession()
 {
     UpdateAgentStatus(_T("Stopping..."));
     
-    if (m_convoAIAPI) {
-        m_convoAIAPI->RemoveHandler(this);
-        m_convoAIAPI.reset();
-    }
+    ReleaseConvoAI();
+    
+    // Token requests still in flight are dropped. A start request is left to finish: once it
+    // reached the server the agent starts anyway, and only its response tells which one to stop
+    CancelRequests();
     
-    if (!m_agentId.empty()) {
-        AgentManager::StopAgent(m_agentId, [](bool, const std::string&) {});
+    std::string agentId;
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        agentId.swap(m_agentId);
+    }
+    if (!agentId.empty()) {
+        AgentManager::StopAgent(agentId, [](bool, const std::string&) {});
     }
     
     if (m_rtmLoggedIn && m_rtmClient) {
@@ -428,15 +749,23 @@ void CMainFrame::StopSession()
     m_channelName.clear();
     m_token.clear();
     m_agentToken.clear();
-    m_agentId.clear();
     m_isActive = false;
     m_isMuted = false;
-    m_transcripts.clear();
+    ClearTranscripts();
+    m_journal.Close();
+    m_exporter.Close();
+    m_stateAnalytics.Stop();
+    m_stateAnalytics.LogSummary();
+    m_imageCache.LogStats();
+    HttpClient::LogStats();
     
     m_listMessages.DeleteAllItems();
     m_btnMute.SetWindowText(_T("Mute"));
     ShowIdleButtons();
     UpdateAgentStatus(_T("Not Started"));
+    
+    // Warm again for the next session
+    HttpClient::Prewarm({ TokenGenerator::TOOLBOX_SERVER_URL, KeyCenter::AGENT_SERVER_BASE_URL });
 }
 
 void CMainFrame::JoinRTCChannel(const std::string& token)
@@ -477,9 +806,15 @@ void CMainFrame::StartAgent()
 {
     UpdateAgentStatus(_T("Starting agent..."));
     
+    uint64_t session = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        session = m_session;
+    }
+    
     std::vector<AgoraTokenType> types = { AgoraTokenType::RTC, AgoraTokenType::RTM };
-    TokenGenerator::GenerateToken(m_channelName, std::to_string(m_agentUid), 86400, types,
-        [this](bool ok, const std::string& token, const std::string&) {
+    TrackRequest(TokenGenerator::GenerateToken(m_channelName, std::to_string(m_agentUid), 86400, types,
+        [this, session](bool ok, const std::string& token, const std::string&) {
             if (!GetSafeHwnd()) return;
             if (!ok) {
                 LogToView(_T("Agent token FAIL"));
@@ -489,8 +824,15 @@ void CMainFrame::StartAgent()
             LogToView(_T("Agent token OK"));
             m_agentToken = token;
             
+            // Not tracked: StopSession must not cancel it (see there)
             AgentManager::StartAgent(m_channelName, std::to_string(m_agentUid), token,
-                [this](bool ok, const std::string& result) {
+                [this, session](bool ok, const std::string& result) {
+                    if (ok && !AdoptAgent(session, result)) {
+                        // The session stopped while the agent was starting: nobody else knows this id
+                        PostLog(_T("Agent started after stop, stopping it"));
+                        AgentManager::StopAgent(result, [](bool, const std::string&) {});
+                        return;
+                    }
                     if (!GetSafeHwnd()) return;
                     if (!ok) {
                         LogToView(_T("Agent start FAIL"));
@@ -498,11 +840,76 @@ void CMainFrame::StartAgent()
                         return;
                     }
                     LogToView(_T("Agent start OK"));
-                    m_agentId = result;
                     m_isActive = true;
                     PostMessage(WM_AGENT_STARTED, 0, 0);
                 });
-        });
+        }));
+}
+
+bool CMainFrame::AdoptAgent(uint64_t session, const std::string& agentId)
+{
+    std::lock_guard<std::mutex> lock(m_requestMutex);
+    if (!m_requestsOpen || session != m_session) {
+        return false;
+    }
+    m_agentId = agentId;
+    return true;
+}
+
+void CMainFrame::TrackRequest(const std::shared_ptr<HttpRequest>& request)
+{
+    // Called on the UI thread and from HTTP callbacks on the I/O thread
+    std::lock_guard<std::mutex> lock(m_requestMutex);
+    if (!m_requestsOpen) {
+        request->Cancel();
+        return;
+    }
+    m_requests.erase(std::remove_if(m_requests.begin(), m_requests.end(),
+        [](const std::shared_ptr<HttpRequest>& r) { return r->IsFinished(); }), m_requests.end());
+    m_requests.push_back(request);
+}
+
+void CMainFrame::CancelRequests()
+{
+    std::vector<std::shared_ptr<HttpRequest>> requests;
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        m_requestsOpen = false;
+        requests.swap(m_requests);
+    }
+    for (const auto& request : requests) {
+        request->Cancel();
+    }
+}
+
+void CMainFrame::ClearTranscripts()
+{
+    std::lock_guard<std::mutex> lock(m_transcriptMutex);
+    m_transcripts.Clear();
+    m_searchQuery.clear();
+    m_searchHits.clear();
+    m_searchCursor = 0;
+}
+
+void CMainFrame::RecoverLastSession()
+{
+    std::vector<Transcript> recovered;
+    std::string sessionName;
+    if (!TranscriptJournal::Recover(SESSION_JOURNAL_PATH, recovered, sessionName) || recovered.empty()) {
+        return;
+    }
+    
+    {
+        std::lock_guard<std::mutex> lock(m_transcriptMutex);
+        for (const auto& transcript : recovered) {
+            m_transcripts.Upsert(transcript);
+        }
+    }
+    UpdateTranscripts();
+    
+    CString msg;
+    msg.Format(_T("Recovered %d turns (%S)"), (int)recovered.size(), sessionName.c_str());
+    LogToView(msg);
 }
 
 std::string CMainFrame::GenerateRandomChannelName()
@@ -576,10 +983,24 @@ void CMainFrame::OnRtmLoginResult(int errorCode)
     }
 }
 
-void CMainFrame::OnRtmMessage(const char* message, const char* publisher)
+void CMainFrame::OnRtmMessage(const char* message, size_t length, const char* publisher)
+{
+    if (std::shared_ptr<ConversationalAIAPI> api = ConvoAI()) {
+        api->HandleMessage(message, length, publisher);
+    }
+}
+
+void CMainFrame::OnRtmPublishResult(uint64_t requestId, int errorCode)
+{
+    if (std::shared_ptr<ConversationalAIAPI> api = ConvoAI()) {
+        api->HandlePublishResult(requestId, errorCode);
+    }
+}
+
+void CMainFrame::OnRtmPresenceState(const char* publisher, const char* state, int turnId, int64_t timestamp)
 {
-    if (m_convoAIAPI) {
-        m_convoAIAPI->HandleMessage(message, publisher);
+    if (std::shared_ptr<ConversationalAIAPI> api = ConvoAI()) {
+        api->HandlePresenceState(publisher, state, turnId, timestamp);
     }
 }
 
@@ -590,10 +1011,9 @@ void CMainFrame::RtmEventHandler::onLoginResult(const uint64_t, agora::rtm::RTM_
 
 void CMainFrame::RtmEventHandler::onMessageEvent(const MessageEvent& e)
 {
+    // The SDK buffer is only valid during this callback; it is parsed in place without copying
     if (e.message && e.messageLength > 0) {
-        std::string msg(e.message, e.messageLength);
-        std::string pub = e.publisher ? e.publisher : "";
-        m_frame->OnRtmMessage(msg.c_str(), pub.c_str());
+        m_frame->OnRtmMessage(e.message, e.messageLength, e.publisher ? e.publisher : "");
     }
 }
 
@@ -601,23 +1021,27 @@ void CMainFrame::RtmEventHandler::onPresenceEvent(const PresenceEvent& e)
 {
     if (e.stateItemCount == 0 || !e.stateItems) return;
     
-    std::string state, turnId;
+    // Read the state items in place and hand them over typed, no JSON round trip
+    const char* state = nullptr;
+    int turnId = 0;
     for (size_t i = 0; i < e.stateItemCount; ++i) {
-        std::string k = e.stateItems[i].key ? e.stateItems[i].key : "";
-        std::string v = e.stateItems[i].value ? e.stateItems[i].value : "";
-        if (k == "state") state = v;
-        else if (k == "turn_id") turnId = v;
+        const char* k = e.stateItems[i].key;
+        const char* v = e.stateItems[i].value;
+        if (!k || !v) continue;
+        if (strcmp(k, "state") == 0) state = v;
+        else if (strcmp(k, "turn_id") == 0) turnId = (int)strtol(v, nullptr, 10);
     }
     
-    if (!state.empty()) {
-        std::string json = "{\"object\":\"message.state\",\"state\":\"" + state + 
-            "\",\"turn_id\":" + (turnId.empty() ? "0" : turnId) +
-            ",\"timestamp\":" + std::to_string(e.timestamp) + ",\"reason\":\"\"}";
-        std::string pub = e.publisher ? e.publisher : "";
-        m_frame->OnRtmMessage(json.c_str(), pub.c_str());
+    if (state && *state) {
+        m_frame->OnRtmPresenceState(e.publisher ? e.publisher : "", state, turnId, (int64_t)e.timestamp);
     }
 }
 
+void CMainFrame::RtmEventHandler::onPublishResult(const uint64_t requestId, agora::rtm::RTM_ERROR_CODE errorCode)
+{
+    m_frame->OnRtmPublishResult(requestId, errorCode);
+}
+
 void CMainFrame::RtmEventHandler::onLinkStateEvent(const LinkStateEvent&) {}
 void CMainFrame::RtmEventHandler::onSubscribeResult(const uint64_t, const char*, agora::rtm::RTM_ERROR_CODE) {}
 
@@ -627,24 +1051,48 @@ void CMainFrame::RtmEventHandler::onSubscribeResult(const uint64_t, const char*,
 
 void CMainFrame::OnTranscriptUpdated(const std::string&, const Transcript& transcript)
 {
-    auto it = std::find_if(m_transcripts.begin(), m_transcripts.end(), [&](const Transcript& t) {
-        return t.turnId == transcript.turnId && t.type == transcript.type && t.userId == transcript.userId;
-    });
-    
-    if (it != m_transcripts.end()) {
-        *it = transcript;
-    } else {
-        m_transcripts.push_back(transcript);
+    MergeTranscript(transcript);
+    PostMessage(WM_TRANSCRIPT_UPDATE, 0, 0);
+}
+
+void CMainFrame::OnTranscriptsBatchUpdated(const std::string&, const std::vector<Transcript>& transcripts)
+{
+    for (const auto& transcript : transcripts) {
+        MergeTranscript(transcript);
     }
-    
     PostMessage(WM_TRANSCRIPT_UPDATE, 0, 0);
 }
 
+void CMainFrame::MergeTranscript(const Transcript& transcript)
+{
+    // Journal every turn whose final state changed: finished now, retired by a later agent
+    // turn, or corrected after finishing (the journal keeps the last record of each turn)
+    std::lock_guard<std::mutex> lock(m_transcriptMutex);
+    m_settledTurns.clear();
+    m_transcripts.Upsert(transcript, &m_settledTurns);
+    for (uint32_t index : m_settledTurns) {
+        m_journal.Append(m_transcripts.Get(index));
+    }
+}
+
 void CMainFrame::OnAgentStateChanged(const std::string&, const StateChangeEvent& event)
 {
     PostMessage(WM_AGENT_STATE_UPDATE, (WPARAM)event.state, 0);
 }
 
+void CMainFrame::OnMessageReceiptUpdated(const std::string&, const MessageReceipt& receipt)
+{
+    if (receipt.type != ChatMessageType::Image) return;
+    PostLog(_T("Image accepted: ") + StringUtils::Utf8ToCString(receipt.uuid));
+}
+
+void CMainFrame::OnMessageError(const std::string&, const MessageError& error)
+{
+    CString msg;
+    msg.Format(_T("Message error %d: %s"), error.code, (LPCTSTR)StringUtils::Utf8ToCString(error.uuid));
+    PostLog(msg);
+}
+
 // =============================================================================
 // Async Message Handlers
 // =============================================================================
@@ -721,3 +1169,50 @@ LRESULT CMainFrame::OnAgentStateUpdate(WPARAM wParam, LPARAM)
     UpdateAgentStatus(idx >= 0 && idx < 5 ? states[idx] : states[5]);
     return 0;
 }
+
+LRESULT CMainFrame::OnLogMessage(WPARAM, LPARAM lParam)
+{
+    std::unique_ptr<CString> message(reinterpret_cast<CString*>(lParam));
+    LogToView(*message);
+    return 0;
+}
+
+LRESULT CMainFrame::OnImagePrepared(WPARAM, LPARAM lParam)
+{
+    std::unique_ptr<PreparedImage> prepared(reinterpret_cast<PreparedImage*>(lParam));
+    if (!prepared->ok) {
+        LogToView(_T("Image: cannot prepare image"));
+        return 0;
+    }
+    
+    // Cache it even if the session is gone: the same picture is likely to be sent again
+    m_imageCache.Store(prepared->hash, prepared->uuid, prepared->jpeg);
+    if (!m_convoAIAPI) {
+        LogToView(_T("Image: session ended, not sent"));
+        return 0;
+    }
+    
+    const ImagePreparer::Result& result = prepared->result;
+    CString msg;
+    msg.Format(_T("Image sending: %dx%d q=%d, %u bytes"), result.width, result.height, result.quality,
+        (unsigned)prepared->jpeg.size());
+    LogToView(msg);
+    
+    m_convoAIAPI->SendImage(prepared->agentUserId, prepared->uuid, std::move(prepared->jpeg),
+        [this](bool success, int errorCode) { LogImageSendResult(success, errorCode); });
+    return 0;
+}
+
+LRESULT CMainFrame::OnInterruptResult(WPARAM wParam, LPARAM lParam)
+{
+    CString msg;
+    if (wParam && m_convoAIAPI) {
+        msg.Format(_T("Interrupt acked in %lld ms"), (long long)m_convoAIAPI->LastInterruptRttMs());
+    } else if (wParam) {
+        msg = _T("Interrupt acked");
+    } else {
+        msg.Format(_T("Interrupt FAIL, code=%d"), (int)lParam);
+    }
+    LogToView(msg);
+    return 0;
+}
@@ -9,11 +9,19 @@
 #include <vector>
 #include <map>
 #include <functional>
+#include <mutex>
 
 #include <IAgoraRtcEngine.h>
 #include <IAgoraRtmClient.h>
 #include <AgoraRtmBase.h>
 #include "../ConversationalAIAPI/ConversationalAIAPI.h"
+#include "../ConversationalAIAPI/TranscriptStore.h"
+#include "../ConversationalAIAPI/TranscriptJournal.h"
+#include "../ConversationalAIAPI/TranscriptExporter.h"
+#include "../ConversationalAIAPI/AgentStateAnalytics.h"
+#include "../ConversationalAIAPI/ImagePreparer.h"
+#include "../ConversationalAIAPI/ImageUploadCache.h"
+#include "../api/HttpClient.h"
 
 class CMainFrame : public CFrameWnd, 
                    public agora::rtc::IRtcEngineEventHandler,
@@ -25,6 +33,7 @@ public:
     CMainFrame() noexcept;
     virtual ~CMainFrame();
     virtual BOOL PreCreateWindow(CREATESTRUCT& cs);
+    virtual BOOL PreTranslateMessage(MSG* pMsg);
     
 #ifdef _DEBUG
     virtual void AssertValid() const;
@@ -42,13 +51,20 @@ private:
     CButton m_btnStart;
     CButton m_btnStop;
     CButton m_btnMute;
+    CEdit m_editSearch;
+    CButton m_btnSearch;
+    CEdit m_editChat;
+    CButton m_btnSend;
+    CButton m_btnImage;
     CFont m_normalFont;
     CFont m_smallFont;
     
     // Agora SDK (direct management like macOS)
     agora::rtc::IRtcEngine* m_rtcEngine;
     agora::rtm::IRtmClient* m_rtmClient;
-    std::unique_ptr<ConversationalAIAPI> m_convoAIAPI;
+    // Replaced only on the UI thread, under m_convoMutex; RTM callbacks work on a copy (ConvoAI())
+    std::shared_ptr<ConversationalAIAPI> m_convoAIAPI;
+    std::mutex m_convoMutex;
     
     // RTM Event Handler (internal class)
     class RtmEventHandler;
@@ -58,12 +74,27 @@ private:
     std::string m_channelName;
     std::string m_token;
     std::string m_agentToken;
-    std::string m_agentId;
+    std::string m_agentId;               // Guarded by m_requestMutex (set from the HTTP thread)
     bool m_isActive;
     bool m_isMuted;
     bool m_rtmLoggedIn;
-    std::vector<Transcript> m_transcripts;
+    TranscriptStore m_transcripts;      // Written on the RTM thread, read on the UI thread
+    std::mutex m_transcriptMutex;
+    TranscriptJournal m_journal;         // Finished turns of the current session, survives crashes
+    std::vector<uint32_t> m_settledTurns; // MergeTranscript scratch, under m_transcriptMutex
+    TranscriptExporter m_exporter;       // JSONL/SRT/VTT export of the current session
+    AgentStateAnalytics m_stateAnalytics; // Time in state and thinking latency of the current session
     std::map<uint64_t, std::function<void(int, const std::string&)>> m_rtmCallbacks;
+    std::string m_searchQuery;           // Query of the current result set
+    std::vector<uint32_t> m_searchHits;  // Matching rows, ascending
+    size_t m_searchCursor;               // One past the selected hit, 0 when none
+    unsigned int m_imageCounter;         // Makes image uuids unique within a second
+    ImageUploadCache m_imageCache;       // Recently sent images by content hash, kept across sessions
+    ImagePreparer m_imagePreparer;       // Shrinks picked images to the image message budget
+    std::vector<std::shared_ptr<HttpRequest>> m_requests; // Token/agent requests of the current session
+    std::mutex m_requestMutex;
+    bool m_requestsOpen;                 // False once the session stops; late requests are canceled
+    uint64_t m_session;                  // Counts StartSession calls; tells a late agent start from a current one
     
     // Constants
     unsigned int m_userUid;
@@ -72,6 +103,9 @@ private:
     static const int LOG_PANEL_WIDTH = 200;
     static const int PADDING = 20;
     static const int BUTTON_HEIGHT = 44;
+    static const int INPUT_HEIGHT = 24;
+    static const int INPUT_BUTTON_WIDTH = 80;
+    static const ULONGLONG MAX_IMAGE_FILE_BYTES = 64 * 1024 * 1024;
     
     // UI Setup
     void SetupUI();
@@ -86,12 +120,18 @@ private:
     void ShowActiveButtons();
     void UpdateTranscripts();
     void LogToView(const CString& message);
+    void PostLog(const CString& message);      // LogToView from any thread
+    void SelectSearchHit(size_t hit);
+    void LogImageSendResult(bool success, int errorCode);
+    void InterruptAgent();
     
     // SDK Setup (direct like macOS)
     void SetupSDK();
     void InitializeRTC();
     void InitializeRTM();
     void InitializeConvoAI();
+    void ReleaseConvoAI();
+    std::shared_ptr<ConversationalAIAPI> ConvoAI();   // m_convoAIAPI from any thread
     
     // Session Management
     void StartSession();
@@ -99,6 +139,12 @@ private:
     void JoinRTCChannel(const std::string& token);
     void LoginRTM(const std::string& token);
     void StartAgent();
+    void TrackRequest(const std::shared_ptr<HttpRequest>& request);
+    void CancelRequests();
+    // Record a started agent as the session's, unless that session has stopped since
+    bool AdoptAgent(uint64_t session, const std::string& agentId);
+    void ClearTranscripts();
+    void RecoverLastSession();
     std::string GenerateRandomChannelName();
     
     // RTC Callbacks (IRtcEngineEventHandler)
@@ -111,11 +157,17 @@ private:
     
     // RTM Callbacks (called by internal handler)
     void OnRtmLoginResult(int errorCode);
-    void OnRtmMessage(const char* message, const char* publisher);
+    void OnRtmMessage(const char* message, size_t length, const char* publisher);
+    void OnRtmPresenceState(const char* publisher, const char* state, int turnId, int64_t timestamp);
+    void OnRtmPublishResult(uint64_t requestId, int errorCode);
     
     // ConvoAI Callbacks
     void OnAgentStateChanged(const std::string& agentUserId, const StateChangeEvent& event) override;
     void OnTranscriptUpdated(const std::string& agentUserId, const Transcript& transcript) override;
+    void OnTranscriptsBatchUpdated(const std::string& agentUserId, const std::vector<Transcript>& transcripts) override;
+    void OnMessageReceiptUpdated(const std::string& agentUserId, const MessageReceipt& receipt) override;
+    void OnMessageError(const std::string& agentUserId, const MessageError& error) override;
+    void MergeTranscript(const Transcript& transcript);
     
 protected:
     afx_msg int OnCreate(LPCREATESTRUCT lpCreateStruct);
@@ -123,6 +175,9 @@ protected:
     afx_msg void OnStartClicked();
     afx_msg void OnStopClicked();
     afx_msg void OnMuteClicked();
+    afx_msg void OnSearchClicked();
+    afx_msg void OnSendClicked();
+    afx_msg void OnImageClicked();
     
     afx_msg LRESULT OnTokenFailed(WPARAM wParam, LPARAM lParam);
     afx_msg LRESULT OnRTMLoginSuccess(WPARAM wParam, LPARAM lParam);
@@ -133,6 +188,9 @@ protected:
     afx_msg LRESULT OnAgentLeft(WPARAM wParam, LPARAM lParam);
     afx_msg LRESULT OnTranscriptUpdate(WPARAM wParam, LPARAM lParam);
     afx_msg LRESULT OnAgentStateUpdate(WPARAM wParam, LPARAM lParam);
+    afx_msg LRESULT OnLogMessage(WPARAM wParam, LPARAM lParam);
+    afx_msg LRESULT OnInterruptResult(WPARAM wParam, LPARAM lParam);
+    afx_msg LRESULT OnImagePrepared(WPARAM wParam, LPARAM lParam);
     
     DECLARE_MESSAGE_MAP()
 };
@@ -154,7 +212,7 @@ public:
     void onStorageEvent(const StorageEvent& event) override {}
     void onJoinResult(const uint64_t, const char*, const char*, agora::rtm::RTM_ERROR_CODE) override {}
     void onLeaveResult(const uint64_t, const char*, const char*, agora::rtm::RTM_ERROR_CODE) override {}
-    void onPublishResult(const uint64_t, agora::rtm::RTM_ERROR_CODE) override {}
+    void onPublishResult(const uint64_t requestId, agora::rtm::RTM_ERROR_CODE errorCode) override;
     void onUnsubscribeResult(const uint64_t, const char*, agora::rtm::RTM_ERROR_CODE) override {}
     
 private: